@@ -1,4 +1,6 @@
 #include <algorithm>
+#include <functional>
+#include <cmath>
 
 #include "circuit.hpp"
 
@@ -7,9 +9,12 @@ using namespace std;
 Circuit::Circuit() : CircuitBase() { }
 Circuit::Circuit(string filename) : CircuitBase(filename) { }
 Circuit::Circuit(istream& fp) : CircuitBase(fp) { }
+Circuit::Circuit(const CircuitFile& file) : CircuitBase(file) { }
 
 void Circuit::reset() {
     queue<shared_ptr<Gate<int8_t> > > q;
+    // without it a gate is visited once per path to it
+    set<shared_ptr<Gate<int8_t> > > seen;
     for (auto g : inputs) {
         g->id = g->val = -1;
         for (auto out_g : g->outputs) {
@@ -19,6 +24,9 @@ void Circuit::reset() {
     while (!q.empty()) {
         shared_ptr<Gate<int8_t> > g = q.front();
         q.pop();
+        if (!seen.insert(g).second) {
+            continue;
+        }
         g->id = g->val = -1;
         for (auto out_g : g->outputs) {
             q.push(out_g);
@@ -56,6 +64,8 @@ void Circuit::eval(vector<int8_t> in) {
             g->val = ! g->inputs[0]->val;
         } else if (g->type == NAND) {
             g->val = !(g->inputs[0]->val & g->inputs[1]->val);
+        } else if (g->type == MUX) {
+            g->val = g->inputs[0]->val ? g->inputs[1]->val : g->inputs[2]->val;
         }
         for (auto out_g : g->outputs) {
             q.push(out_g);
@@ -128,6 +138,184 @@ void Circuit::reduce(vector<bool> out, uint32_t in1) {
     num_wires = alive.size();
 }
 
+void Circuit::specialise(const string& pattern) {
+    typedef shared_ptr<Gate<int8_t> > GatePtr;
+    if (pattern.size() > inputs.size()) {
+        throw runtime_error("Pattern is longer than the circuit's inputs");
+    }
+    reset();
+
+    vector<GatePtr> free_inputs;
+    uintmax_t free_in1 = 0;
+    for (uintmax_t i = 0; i < inputs.size(); i++) {
+        const char c = i < pattern.size() ? pattern[i] : 'x';
+        if (c == '0' || c == '1') {
+            inputs[i]->val = c - '0';
+        } else if (c == 'x') {
+            free_inputs.push_back(inputs[i]);
+            free_in1 += i < num_in1;
+        } else {
+            throw runtime_error("Pattern values can only be 0, 1 or x");
+        }
+    }
+    if (free_inputs.empty()) {
+        throw runtime_error("Every input is fixed, nothing is left to encrypt");
+    }
+
+    // Gates after the gates they read
+    vector<GatePtr> order(inputs.begin(), inputs.end());
+    map<Gate<int8_t>*, size_t> pending;
+    for (size_t i = 0; i < order.size(); i++) {
+        for (auto out_g : order[i]->outputs) {
+            auto it = pending.find(out_g.get());
+            if (it == pending.end()) {
+                const set<GatePtr> in(out_g->inputs.begin(), out_g->inputs.end());
+                it = pending.insert(make_pair(out_g.get(), in.size())).first;
+            }
+            if (--it->second == 0) {
+                order.push_back(out_g);
+            }
+        }
+    }
+
+    auto make_gate = [](GateType type, vector<GatePtr> in) {
+        GatePtr g(new Gate<int8_t>);
+        g->type = type; g->inputs = in; g->val = g->id = -1; g->constant = 0;
+        return g;
+    };
+    // Gates that became one of their inputs, val holds the constant ones
+    map<Gate<int8_t>*, GatePtr> forward;
+    auto resolve = [&forward](GatePtr g) {
+        auto it = forward.find(g.get());
+        return it == forward.end() ? g : it->second;
+    };
+    for (size_t i = inputs.size(); i < order.size(); i++) {
+        GatePtr g = order[i];
+        for (auto &in_g : g->inputs) {
+            in_g = resolve(in_g);
+        }
+        if (g->type == MUX) {
+            const GatePtr c = g->inputs[0], x = g->inputs[1], y = g->inputs[2];
+            if (c->val != -1 || x == y) {
+                const GatePtr chosen = c->val == 0 ? y : x;
+                if (chosen->val != -1) {
+                    g->val = chosen->val;
+                } else {
+                    forward[g.get()] = chosen;
+                }
+            } else if (x->val != -1 && y->val != -1) {
+                if (x->val == y->val) {
+                    g->val = x->val;
+                } else if (x->val) {
+                    forward[g.get()] = c;
+                } else {
+                    g->type = INV;
+                    g->inputs.assign(1, c);
+                }
+            } else if (x->val == 0) {
+                g->type = AND;
+                g->inputs = {make_gate(INV, {c}), y};
+            } else if (y->val == 0) {
+                g->type = AND;
+                g->inputs = {c, x};
+            } else if (x->val == 1) {
+                // c OR y
+                g->type = NAND;
+                g->inputs = {make_gate(INV, {c}), make_gate(INV, {y})};
+            } else if (y->val == 1) {
+                // NOT c OR x
+                g->type = NAND;
+                g->inputs = {c, make_gate(INV, {x})};
+            }
+            continue;
+        }
+        const int8_t a = g->inputs[0]->val;
+        const int8_t b = g->inputs.size() > 1 ? g->inputs[1]->val : -1;
+        if (g->type == ADD || g->type == CMUL) {
+            if (a != -1 || b != -1) {
+                throw runtime_error("Integer gates can not read fixed inputs");
+            }
+        } else if (g->type == INV) {
+            if (a != -1) {
+                g->val = !a;
+            }
+        } else if (a != -1 && b != -1) {
+            switch (g->type) {
+                case AND: g->val = a & b; break;
+                case XOR: g->val = a ^ b; break;
+                case NAND: g->val = !(a & b); break;
+                default: break;
+            }
+        } else if (a != -1 || b != -1) {
+            const int8_t c = a != -1 ? a : b;
+            const GatePtr x = a != -1 ? g->inputs[1] : g->inputs[0];
+            if (g->type != XOR && !c) {
+                g->val = g->type == NAND;
+            } else if (g->type == AND || (g->type == XOR && !c)) {
+                forward[g.get()] = x;
+            } else {
+                // NAND and XOR with 1
+                g->type = INV;
+                g->inputs.assign(1, x);
+            }
+        }
+    }
+
+    // Outputs have to stay wires of their own, so one that became another
+    // wire is two INVs of it, and a constant one is the XOR of an encrypted
+    // input with itself, or its INV
+    const GatePtr x = free_inputs[0];
+    GatePtr zero;
+    for (auto g : outputs) {
+        const GatePtr src = resolve(g);
+        if (src != g) {
+            g->type = INV;
+            g->inputs.assign(1, make_gate(INV, vector<GatePtr>(1, src)));
+        } else if (g->val == 0) {
+            g->type = XOR;
+            g->inputs.assign(2, x);
+        } else if (g->val == 1) {
+            if (!zero) {
+                zero = make_gate(XOR, vector<GatePtr>(2, x));
+            }
+            g->type = INV;
+            g->inputs.assign(1, zero);
+        }
+        g->val = -1;
+    }
+
+    // Keep what the outputs read and link it up again
+    set<GatePtr> alive(free_inputs.begin(), free_inputs.end());
+    vector<GatePtr> live;
+    vector<GatePtr> stack(outputs.begin(), outputs.end());
+    for (auto g : free_inputs) {
+        g->outputs.clear();
+    }
+    while (!stack.empty()) {
+        const GatePtr g = stack.back();
+        stack.pop_back();
+        if (!alive.insert(g).second) {
+            continue;
+        }
+        live.push_back(g);
+        g->outputs.clear();
+        stack.insert(stack.end(), g->inputs.begin(), g->inputs.end());
+    }
+    for (auto g : live) {
+        for (size_t i = 0; i < g->inputs.size(); i++) {
+            if (find(g->inputs.begin(), g->inputs.begin() + i, g->inputs[i]) == g->inputs.begin() + i) {
+                g->inputs[i]->outputs.push_back(g);
+            }
+        }
+    }
+
+    inputs = free_inputs;
+    num_in1 = free_in1;
+    num_in2 = inputs.size() - free_in1;
+    num_wires = alive.size();
+    num_gates = num_wires - inputs.size();
+}
+
 void Circuit::nand_recode() {
     queue<shared_ptr<Gate<int8_t> > > q;
     for (auto g : inputs) {
@@ -149,6 +337,8 @@ void Circuit::nand_recode() {
             case AND: num_new_gates = and_to_nand(g); break;
             case XOR: num_new_gates = xor_to_nand(g); break;
             case INV: num_new_gates = inv_to_nand(g); break;
+            case MUX: num_new_gates = mux_to_nand(g); break;
+            case ADD: case CMUL: throw runtime_error("Integer gates have no NAND form");
             default: break;
         }
         num_wires += num_new_gates;
@@ -199,12 +389,13 @@ uint8_t Circuit::xor_to_nand(std::shared_ptr<Gate<int8_t> > end) {
     start->outputs.push_back(g2);
     replace_inputs(end, start);
 
-    g1->inputs.push_back(end->inputs[0]);
+    // start carries the noise of both inputs, so it goes on the left
     g1->inputs.push_back(start);
+    g1->inputs.push_back(end->inputs[0]);
     g1->outputs.push_back(end);
 
-    g2->inputs.push_back(end->inputs[1]);
     g2->inputs.push_back(start);
+    g2->inputs.push_back(end->inputs[1]);
     g2->outputs.push_back(end);
 
     end->inputs[0]->outputs.push_back(g1);
@@ -217,6 +408,273 @@ uint8_t Circuit::xor_to_nand(std::shared_ptr<Gate<int8_t> > end) {
     return 3;
 }
 
+uint8_t Circuit::mux_to_nand(std::shared_ptr<Gate<int8_t> > end) {
+    // c ? x : y = NAND(NAND(c, x), NAND(NAND(c, c), y))
+    const std::shared_ptr<Gate<int8_t> > c = end->inputs[0], x = end->inputs[1], y = end->inputs[2];
+    std::shared_ptr<Gate<int8_t> >
+        inv(new Gate<int8_t> ),
+        g1(new Gate<int8_t> ),
+        g2(new Gate<int8_t> );
+
+    inv->type = end->type = g1->type = g2->type = NAND;
+    inv->val = end->val = g1->val = g2->val = -1;
+
+    for (auto in_g : end->inputs) {
+        in_g->outputs.erase(remove(in_g->outputs.begin(), in_g->outputs.end(), end), in_g->outputs.end());
+    }
+
+    inv->inputs.push_back(c);
+    inv->inputs.push_back(c);
+    inv->outputs.push_back(g2);
+    c->outputs.push_back(inv);
+
+    g1->inputs.push_back(c);
+    g1->inputs.push_back(x);
+    g1->outputs.push_back(end);
+    c->outputs.push_back(g1);
+    if (x != c) {
+        x->outputs.push_back(g1);
+    }
+
+    g2->inputs.push_back(inv);
+    g2->inputs.push_back(y);
+    g2->outputs.push_back(end);
+    y->outputs.push_back(g2);
+
+    end->inputs.clear();
+    end->inputs.push_back(g1);
+    end->inputs.push_back(g2);
+
+    return 3;
+}
+
+uint64_t Circuit::find_muxes() {
+    typedef shared_ptr<Gate<int8_t> > GatePtr;
+    reset();
+
+    const set<GatePtr> is_output(outputs.begin(), outputs.end());
+    // a gate only the rewritten one reads goes with it
+    auto private_gate = [&is_output](const GatePtr& g, GateType type) {
+        return g->type == type && g->outputs.size() == 1 && !is_output.count(g);
+    };
+    auto inverse = [](const GatePtr& a, const GatePtr& b) {
+        return (a->type == INV && a->inputs[0] == b) ||
+               (a->type == NAND && a->inputs[0] == b && a->inputs[1] == b);
+    };
+
+    // Inputs of the MUX g spells out, if it is one of
+    //   y XOR (c AND (x XOR y))
+    //   (c AND x) XOR (NOT c AND y)
+    //   NAND(NAND(c, x), NAND(NOT c, y))
+    // with NOT c an INV or NAND(c, c), in any operand order
+    auto match = [&](const GatePtr& g, vector<GatePtr>& mux) {
+        if ((g->type != XOR && g->type != NAND) || g->inputs[0] == g->inputs[1]) {
+            return false;
+        }
+        const GateType term = g->type == XOR ? AND : NAND;
+        for (int i = 0; i < 2; i++) {
+            const GatePtr p = g->inputs[i], q = g->inputs[1 - i];
+            if (!private_gate(p, term)) {
+                continue;
+            }
+            for (int j = 0; j < 2; j++) {
+                const GatePtr c = p->inputs[j], other = p->inputs[1 - j];
+                if (g->type == XOR && other->type == XOR && (other->inputs[0] == q || other->inputs[1] == q)) {
+                    mux = {c, other->inputs[0] == q ? other->inputs[1] : other->inputs[0], q};
+                    return true;
+                }
+                if (!private_gate(q, term)) {
+                    continue;
+                }
+                for (int t = 0; t < 2; t++) {
+                    if (inverse(q->inputs[t], c)) {
+                        mux = {c, other, q->inputs[1 - t]};
+                        return true;
+                    }
+                }
+            }
+        }
+        return false;
+    };
+
+    // Unlinks a gate nothing reads any more, then its inputs
+    set<GatePtr> dropped;
+    function<void(const GatePtr&)> drop = [&](const GatePtr& g) {
+        if (g->type == VAL || !g->outputs.empty() || is_output.count(g) || !dropped.insert(g).second) {
+            return;
+        }
+        for (auto in_g : g->inputs) {
+            in_g->outputs.erase(remove(in_g->outputs.begin(), in_g->outputs.end(), g), in_g->outputs.end());
+            drop(in_g);
+        }
+    };
+
+    vector<GatePtr> gates;
+    set<GatePtr> seen;
+    for (auto g : inputs) {
+        for (auto out_g : g->outputs) {
+            if (seen.insert(out_g).second) gates.push_back(out_g);
+        }
+    }
+    for (size_t i = 0; i < gates.size(); i++) {
+        for (auto out_g : gates[i]->outputs) {
+            if (seen.insert(out_g).second) gates.push_back(out_g);
+        }
+    }
+
+    uint64_t found = 0;
+    for (auto g : gates) {
+        vector<GatePtr> mux;
+        if (dropped.count(g) || !match(g, mux)) {
+            continue;
+        }
+        const vector<GatePtr> old = g->inputs;
+        for (auto in_g : old) {
+            in_g->outputs.erase(remove(in_g->outputs.begin(), in_g->outputs.end(), g), in_g->outputs.end());
+        }
+        g->type = MUX;
+        g->inputs = mux;
+        for (size_t i = 0; i < mux.size(); i++) {
+            if (find(mux.begin(), mux.begin() + i, mux[i]) == mux.begin() + i) {
+                mux[i]->outputs.push_back(g);
+            }
+        }
+        for (auto in_g : old) {
+            drop(in_g);
+        }
+        found++;
+    }
+    num_gates -= dropped.size();
+    num_wires -= dropped.size();
+    return found;
+}
+
+uint64_t Circuit::order_products() {
+    typedef shared_ptr<Gate<int8_t> > GatePtr;
+    // log2 of the factor a product scales its right operand's noise by, a
+    // typical N. Only comparisons between wires depend on it.
+    const double AMPLIFICATION_BITS = 10;
+    reset();
+
+    const set<GatePtr> is_output(outputs.begin(), outputs.end());
+    // an AND whose only reader is another AND is part of that AND's tree
+    auto interior = [&is_output](const GatePtr& g) {
+        return g->type == AND && g->outputs.size() == 1 && g->outputs[0]->type == AND && !is_output.count(g);
+    };
+    auto unlink = [](const GatePtr& g) {
+        for (auto in_g : g->inputs) {
+            in_g->outputs.erase(remove(in_g->outputs.begin(), in_g->outputs.end(), g), in_g->outputs.end());
+        }
+    };
+    auto link = [](const GatePtr& g) {
+        for (size_t i = 0; i < g->inputs.size(); i++) {
+            if (find(g->inputs.begin(), g->inputs.begin() + i, g->inputs[i]) == g->inputs.begin() + i) {
+                g->inputs[i]->outputs.push_back(g);
+            }
+        }
+    };
+
+    // Estimated log2 noise of each wire, in units of a fresh ciphertext's
+    map<Gate<int8_t>*, double> noise;
+    auto sum = [](double a, double b) {
+        return max(a, b) + log2(1 + exp2(-fabs(a - b)));
+    };
+    auto product = [&](const GatePtr& left, const GatePtr& right) {
+        return sum(noise[left.get()], AMPLIFICATION_BITS + noise[right.get()]);
+    };
+
+    // Gates after the gates they read
+    vector<GatePtr> order(inputs.begin(), inputs.end());
+    map<Gate<int8_t>*, size_t> pending;
+    for (size_t i = 0; i < order.size(); i++) {
+        for (auto out_g : order[i]->outputs) {
+            auto it = pending.find(out_g.get());
+            if (it == pending.end()) {
+                const set<GatePtr> in(out_g->inputs.begin(), out_g->inputs.end());
+                it = pending.insert(make_pair(out_g.get(), in.size())).first;
+            }
+            if (--it->second == 0) {
+                order.push_back(out_g);
+            }
+        }
+    }
+
+    uint64_t rebuilt = 0, dropped = 0;
+    for (size_t i = inputs.size(); i < order.size(); i++) {
+        const GatePtr g = order[i];
+        if (interior(g)) {
+            continue;
+        }
+        if (g->type == AND) {
+            // leaves of the tree under g, each once, and its interior ANDs
+            vector<GatePtr> leaves, pool, stack(1, g);
+            set<GatePtr> seen;
+            while (!stack.empty()) {
+                const GatePtr t = stack.back();
+                stack.pop_back();
+                for (auto in_g : t->inputs) {
+                    if (!seen.insert(in_g).second) {
+                        continue;
+                    }
+                    if (interior(in_g)) {
+                        pool.push_back(in_g);
+                        stack.push_back(in_g);
+                    } else {
+                        leaves.push_back(in_g);
+                    }
+                }
+            }
+            if (!pool.empty() && leaves.size() >= 2) {
+                // the noisiest leaf starts the chain, where it is the left
+                // operand and not amplified, the others follow from the
+                // least noisy up, ties in gate order
+                stable_sort(leaves.begin(), leaves.end(), [&noise](const GatePtr& a, const GatePtr& b) {
+                    return noise[a.get()] < noise[b.get()];
+                });
+                rotate(leaves.begin(), leaves.end() - 1, leaves.end());
+                for (auto t : pool) {
+                    unlink(t);
+                }
+                unlink(g);
+                GatePtr acc = leaves[0];
+                for (size_t j = 1; j < leaves.size(); j++) {
+                    const GatePtr t = j + 1 == leaves.size() ? g : pool[j - 1];
+                    t->inputs.assign(1, acc);
+                    t->inputs.push_back(leaves[j]);
+                    if (t != g) {
+                        t->outputs.clear();
+                    }
+                    link(t);
+                    noise[t.get()] = product(acc, leaves[j]);
+                    acc = t;
+                }
+                rebuilt += pool.size() + 1;
+                dropped += pool.size() + 2 - leaves.size();
+                continue;
+            }
+        }
+
+        vector<GatePtr> &in = g->inputs;
+        double n = noise[in[0].get()];
+        switch (g->type) {
+            case AND: case NAND:
+                if (noise[in[0].get()] < noise[in[1].get()]) {
+                    swap(in[0], in[1]);
+                }
+                n = product(in[0], in[1]);
+                break;
+            case XOR: case ADD: n = sum(noise[in[0].get()], noise[in[1].get()]); break;
+            case CMUL: n += log2(max(1, abs(g->constant))); break;
+            case MUX: n = sum(sum(noise[in[1].get()], noise[in[2].get()]), AMPLIFICATION_BITS + noise[in[0].get()]); break;
+            default: break;
+        }
+        noise[g.get()] = n;
+    }
+    num_gates -= dropped;
+    num_wires -= dropped;
+    return rebuilt;
+}
+
 void Circuit::replace_inputs(std::shared_ptr<Gate<int8_t> > old, std::shared_ptr<Gate<int8_t> > new_g) {
     for (auto in_g : old->inputs) {
         for (uint8_t i = 0; i < in_g->outputs.size(); i++) {
@@ -11,7 +11,7 @@
 #include <stdexcept>
 #include <cstdint>
 
-typedef enum {AND, XOR, INV, NAND, VAL} GateType;
+#include "circuitFile.hpp"
 
 template <typename T>
 struct Gate {
@@ -20,6 +20,7 @@ struct Gate {
     std::vector<std::shared_ptr<Gate> > outputs;
     T val;
     intmax_t id;
+    int constant; // CMUL's multiplier
 };
 
 template <typename T>
@@ -31,61 +32,53 @@ public:
 
     CircuitBase() : CircuitBase(std::cin) {};
     CircuitBase(std::istream& fp) {
-        init(fp);
+        CircuitFile file(fp);
+        init(file);
     };
+    // Bristol text or compiled, see CircuitFile
     CircuitBase(std::string filename) {
-        std::ifstream fp(filename.c_str());
-        if(! fp.is_open()) {
-            throw std::runtime_error("Bad file: " + filename);
-        }
-        init(fp);
-        fp.close();
+        CircuitFile file(filename);
+        init(file);
     };
 
-    void init(std::istream& fp) {
-        using namespace std;
-        map<uintmax_t, shared_ptr<Gate<T> > > gate_map;
+    CircuitBase(const CircuitFile& file) {
+        init(file);
+    };
 
-        fp >> num_gates >> num_wires >> num_in1 >> num_in2 >> num_out;
+    void init(const CircuitFile& file) {
+        using namespace std;
+        num_gates = file.header.num_gates;
+        num_wires = file.header.num_wires;
+        num_in1 = file.header.num_in1;
+        num_in2 = file.header.num_in2;
+        num_out = file.header.num_out;
 
+        vector<shared_ptr<Gate<T> > > wires(num_wires);
         for (uintmax_t i = 0; i < num_wires; i++) {
-            shared_ptr<Gate<T> > g(new Gate<T> ); g->type = VAL; g->id = -1;
+            shared_ptr<Gate<T> > g(new Gate<T> ); g->type = VAL; g->id = -1; g->constant = 0;
             if (i < num_in1 + num_in2) {
                 inputs.push_back(g);
             } else if (i >= num_wires - num_out) {
                 outputs.push_back(g);
             }
-            gate_map[i] = g;
+            wires[i] = g;
         }
         for (uintmax_t i = 0; i < num_gates; i++) {
-            int num_inputs, num_outputs, in1, in2, out;
-            fp >> num_inputs >> num_outputs;
-            if (num_inputs == 2) {
-                fp >> in1 >> in2 >> out;
-            } else {
-                fp >> in1 >> out;
-                in2 = -1;
-            }
-            string type;
-            fp >> type;
-            shared_ptr<Gate<T> > g = gate_map.at(out); g->id = -1;
-            if (! type.compare("XOR")) {
-                g->type = XOR;
-            } else if (! type.compare("AND")) {
-                g->type = AND;
-            } else if (! type.compare("INV")) {
-                g->type = INV;
-            } else if (! type.compare("NAND")) {
-                g->type = NAND;
-            }
-
-            gate_map.at(in1)->outputs.push_back(g);
-            g->inputs.push_back(gate_map.at(in1));
-            if (in2 != -1) {
-                if (in1 != in2) {
-                    gate_map.at(in2)->outputs.push_back(g);
+            const CircuitGate &cg = file.gates[i];
+            shared_ptr<Gate<T> > g = wires[cg.out];
+            g->type = (GateType) cg.type;
+            g->constant = cg.constant;
+
+            const uint32_t in[] = {cg.in1, cg.in2, cg.in3};
+            for (auto w : in) {
+                if (w != NO_WIRE) {
+                    g->inputs.push_back(wires[w]);
                 }
-                g->inputs.push_back(gate_map.at(in2));
+            }
+            // a gate reading one wire twice is one of its outputs once
+            uint32_t distinct[3];
+            for (unsigned int j = 0, n = cg.inputs(distinct); j < n; j++) {
+                wires[distinct[j]]->outputs.push_back(g);
             }
         }
     };
@@ -137,6 +130,9 @@ public:
                 case XOR: fp << "XOR"; break;
                 case INV: fp << "INV"; break;
                 case NAND: fp << "NAND"; break;
+                case ADD: fp << "ADD"; break;
+                case CMUL: fp << "CMUL\t" << g->constant; break;
+                case MUX: fp << "MUX"; break;
                 default: throw runtime_error("Trying to print unknown gate");
             }
             fp << endl;
@@ -177,6 +173,7 @@ public:
         return depth;
     }
     virtual void reset()=0;
+    virtual ~CircuitBase() { }
 };
 
 class Circuit : public CircuitBase<int8_t> {
@@ -184,15 +181,29 @@ public:
     Circuit();
     Circuit(std::string);
     Circuit(std::istream&);
+    Circuit(const CircuitFile&);
 
     void reduce(std::vector<bool>, uint32_t);
+    // Folds public input values through the gates and drops the fixed inputs
+    // and the logic left dead. The pattern has a 0 or 1 for a fixed input and
+    // an x for one that stays encrypted, as do those past its end.
+    void specialise(const std::string& pattern);
     void nand_recode();
+    // Replaces the selections spelled out in other gates with MUX gates,
+    // returns how many
+    uint64_t find_muxes();
+    // Puts the noisier operand of every product first, where its noise is
+    // only scaled by the other's message, and rebuilds trees of ANDs as
+    // left-deep chains that multiply the noisiest leaf by one leaf at a time.
+    // Returns how many ANDs were rebuilt.
+    uint64_t order_products();
     void reset();
     void eval(std::vector<int8_t>);
 private:
     uint8_t and_to_nand(std::shared_ptr<Gate<int8_t> >);
     uint8_t xor_to_nand(std::shared_ptr<Gate<int8_t> >);
     uint8_t inv_to_nand(std::shared_ptr<Gate<int8_t> >);
+    uint8_t mux_to_nand(std::shared_ptr<Gate<int8_t> >);
 
     void replace_inputs(std::shared_ptr<Gate<int8_t> >, std::shared_ptr<Gate<int8_t> >);
 };
@@ -0,0 +1,326 @@
+#include <cstring>
+#include <stdexcept>
+#include <sstream>
+#include <algorithm>
+#include <cmath>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "circuitFile.hpp"
+
+using namespace std;
+
+CircuitFile::CircuitFile(const string& filename) : map(NULL), map_len(0) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0 || st.st_size == 0) {
+        if (fd >= 0) close(fd);
+        throw runtime_error("Bad file: " + filename);
+    }
+    map_len = st.st_size;
+    map = mmap(NULL, map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        map = NULL;
+        throw runtime_error("Bad file: " + filename);
+    }
+    madvise(map, map_len, MADV_SEQUENTIAL);
+
+    try {
+        load((const char *) map, map_len);
+    } catch (...) {
+        munmap(map, map_len);
+        throw;
+    }
+}
+
+// Streams can not be mapped, so they are read in whole first
+CircuitFile::CircuitFile(istream& fp) : map(NULL), map_len(0) {
+    stringstream ss;
+    ss << fp.rdbuf();
+    buffer = ss.str();
+    load(buffer.data(), buffer.size());
+}
+
+CircuitFile::~CircuitFile() {
+    if (map) {
+        munmap(map, map_len);
+    }
+}
+
+void CircuitFile::load(const char* data, size_t len) {
+    // version 1 headers lack the last three gate counts, version 2 the last
+    const size_t v1_header = sizeof(CircuitHeader) - 3 * sizeof(uint64_t);
+    const size_t v2_header = sizeof(CircuitHeader) - sizeof(uint64_t);
+    if (len >= v1_header && !memcmp(data, CIRCUIT_MAGIC_V1, 8)) {
+        memset(&header, 0, sizeof(CircuitHeader));
+        memcpy(&header, data, v1_header);
+        memcpy(header.magic, CIRCUIT_MAGIC, 8);
+        load_legacy_gates(data + v1_header, len - v1_header);
+    } else if (len >= v2_header && !memcmp(data, CIRCUIT_MAGIC_V2, 8)) {
+        memset(&header, 0, sizeof(CircuitHeader));
+        memcpy(&header, data, v2_header);
+        memcpy(header.magic, CIRCUIT_MAGIC, 8);
+        load_legacy_gates(data + v2_header, len - v2_header);
+    } else if (len >= sizeof(CircuitHeader) && !memcmp(data, CIRCUIT_MAGIC, 8)) {
+        memcpy(&header, data, sizeof(CircuitHeader));
+        load_gates(data + sizeof(CircuitHeader), len - sizeof(CircuitHeader));
+    } else {
+        parse_bristol(data, len);
+    }
+}
+
+void CircuitFile::load_gates(const char* data, size_t len) {
+    if (len < header.num_gates * sizeof(CircuitGate)) {
+        throw runtime_error("Truncated compiled circuit");
+    }
+    gates = (const CircuitGate *) data;
+    check_wires();
+}
+
+void CircuitFile::load_legacy_gates(const char* data, size_t len) {
+    // version 1 gates have a 32 bit type, which reads the same on little
+    // endian with a zero constant
+    struct LegacyGate {
+        uint32_t in1, in2, out;
+        uint16_t type;
+        int16_t constant;
+    };
+    if (len < header.num_gates * sizeof(LegacyGate)) {
+        throw runtime_error("Truncated compiled circuit");
+    }
+    parsed.resize(header.num_gates);
+    for (uint64_t i = 0; i < header.num_gates; i++) {
+        LegacyGate old;
+        memcpy(&old, data + i * sizeof(LegacyGate), sizeof(LegacyGate));
+        CircuitGate &g = parsed[i];
+        g.in1 = old.in1; g.in2 = old.in2; g.in3 = NO_WIRE; g.out = old.out;
+        g.type = old.type; g.constant = old.constant;
+        // MUX took the place of VAL
+        if (g.type == MUX) {
+            g.type = VAL;
+        }
+    }
+    gates = parsed.data();
+    check_wires();
+}
+
+void CircuitFile::check_wires() const {
+    if (header.num_wires >= NO_WIRE) {
+        throw runtime_error("Bad circuit: too many wires");
+    }
+    for (uint64_t i = 0; i < header.num_gates; i++) {
+        const CircuitGate &g = gates[i];
+        if (g.in1 >= header.num_wires || g.out >= header.num_wires ||
+                (g.in2 != NO_WIRE && g.in2 >= header.num_wires) ||
+                (g.in3 != NO_WIRE && g.in3 >= header.num_wires) || g.type >= VAL) {
+            throw runtime_error("Bad circuit: wire out of range");
+        }
+        if ((g.in2 == NO_WIRE) != (g.type == INV || g.type == CMUL) || (g.in3 == NO_WIRE) != (g.type != MUX)) {
+            throw runtime_error("Bad circuit: wrong number of gate inputs");
+        }
+    }
+}
+
+void CircuitFile::write_compiled(ostream& fp) const {
+    fp.write((const char *) &header, sizeof(CircuitHeader));
+    fp.write((const char *) gates, header.num_gates * sizeof(CircuitGate));
+}
+
+//////////////////////////////////////////////
+// Bristol format
+//////////////////////////////////////////////
+
+namespace {
+
+// Whitespace separated tokens of a buffer that is not null terminated
+struct Tokenizer {
+    const char *p, *end;
+
+    void skip_space() {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) p++;
+    }
+    uint64_t number() {
+        skip_space();
+        if (p == end || *p < '0' || *p > '9') {
+            throw runtime_error("Bad circuit: expected a number");
+        }
+        uint64_t x = 0;
+        while (p < end && *p >= '0' && *p <= '9') {
+            const unsigned int d = *p++ - '0';
+            if (x > (UINT64_MAX - d) / 10) {
+                throw runtime_error("Bad circuit: number out of range");
+            }
+            x = x * 10 + d;
+        }
+        return x;
+    }
+    // A wire or a count of wires or gates, which have to fit below NO_WIRE
+    uint32_t wire() {
+        const uint64_t x = number();
+        if (x >= NO_WIRE) {
+            throw runtime_error("Bad circuit: number out of range");
+        }
+        return x;
+    }
+    int64_t signed_number() {
+        skip_space();
+        if (p < end && *p == '-') {
+            p++;
+            return -(int64_t) number();
+        }
+        return number();
+    }
+    GateType gate_type() {
+        skip_space();
+        const char *start = p;
+        while (p < end && *p > ' ') p++;
+        const size_t len = p - start;
+        if (len == 3 && !memcmp(start, "AND", 3)) return AND;
+        if (len == 3 && !memcmp(start, "XOR", 3)) return XOR;
+        if (len == 3 && !memcmp(start, "INV", 3)) return INV;
+        if (len == 4 && !memcmp(start, "NAND", 4)) return NAND;
+        if (len == 3 && !memcmp(start, "ADD", 3)) return ADD;
+        if (len == 4 && !memcmp(start, "CMUL", 4)) return CMUL;
+        if (len == 3 && !memcmp(start, "MUX", 3)) return MUX;
+        throw runtime_error("Bad circuit: unknown gate " + string(start, len));
+    }
+};
+
+}
+
+void CircuitFile::parse_bristol(const char* data, size_t len) {
+    Tokenizer tok = {data, data + len};
+
+    memset(&header, 0, sizeof(CircuitHeader));
+    memcpy(header.magic, CIRCUIT_MAGIC, 8);
+    header.num_gates = tok.wire();
+    header.num_wires = tok.wire();
+    header.num_in1 = tok.wire();
+    header.num_in2 = tok.wire();
+    header.num_out = tok.wire();
+
+    parsed.resize(header.num_gates);
+    for (uint64_t i = 0; i < header.num_gates; i++) {
+        CircuitGate &g = parsed[i];
+        const uint64_t num_inputs = tok.number();
+        if (num_inputs < 1 || num_inputs > 3) {
+            throw runtime_error("Bad circuit: wrong number of gate inputs");
+        }
+        tok.number(); // num_outputs, always 1
+        g.in1 = tok.wire();
+        g.in2 = num_inputs >= 2 ? tok.wire() : NO_WIRE;
+        g.in3 = num_inputs == 3 ? tok.wire() : NO_WIRE;
+        g.out = tok.wire();
+        g.type = tok.gate_type();
+        g.constant = 0;
+        // a CMUL line ends in its constant
+        if (g.type == CMUL) {
+            const int64_t c = tok.signed_number();
+            if (c < INT16_MIN || c > INT16_MAX) {
+                throw runtime_error("Bad circuit: CMUL constant out of range");
+            }
+            g.constant = c;
+        }
+    }
+    gates = parsed.data();
+
+    check_wires();
+    compute_stats();
+}
+
+// Kahn's algorithm, Bristol files written by circuit-converter are not
+// always in topological order
+vector<uint32_t> CircuitFile::topological_order() const {
+    const uint64_t num_wires = header.num_wires, num_gates = header.num_gates;
+
+    // consumers of wire w are consumers[first[w] .. first[w + 1])
+    vector<bool> produced(num_wires, false);
+    vector<uint32_t> first(num_wires + 1, 0), consumers, pending(num_gates, 0);
+    uint32_t in[3];
+    for (uint64_t i = 0; i < num_gates; i++) {
+        const CircuitGate &g = gates[i];
+        produced[g.out] = true;
+        for (unsigned int j = 0, n = g.inputs(in); j < n; j++) {
+            first[in[j] + 1]++;
+        }
+    }
+    for (uint64_t w = 0; w < num_wires; w++) {
+        first[w + 1] += first[w];
+    }
+    consumers.resize(first[num_wires]);
+    vector<uint32_t> fill(first.begin(), first.end() - 1);
+    for (uint64_t i = 0; i < num_gates; i++) {
+        for (unsigned int j = 0, n = gates[i].inputs(in); j < n; j++) {
+            consumers[fill[in[j]]++] = i;
+            pending[i] += produced[in[j]];
+        }
+    }
+
+    vector<uint32_t> order;
+    order.reserve(num_gates);
+    for (uint64_t i = 0; i < num_gates; i++) {
+        if (!pending[i]) order.push_back(i);
+    }
+    // order doubles as the queue
+    for (uint64_t head = 0; head < order.size(); head++) {
+        const CircuitGate &g = gates[order[head]];
+        for (uint32_t c = first[g.out]; c < first[g.out + 1]; c++) {
+            if (--pending[consumers[c]] == 0) order.push_back(consumers[c]);
+        }
+    }
+    if (order.size() != num_gates) {
+        throw runtime_error("Bad circuit: gates form a cycle");
+    }
+    return order;
+}
+
+unsigned int CircuitFile::integer_noise_bits() const {
+    // log2 of a wire's noise over that of its product depth: ADDs sum it,
+    // CMULs scale it and products keep the larger operand's, their own
+    // growth being the depth's. XORs of bits stay within the bound's slack.
+    auto sum = [](double a, double b) { return max(a, b) + log2(1 + exp2(-fabs(a - b))); };
+    vector<double> bits(header.num_wires, 0);
+    double most = 0;
+    for (auto i : topological_order()) {
+        const CircuitGate &g = gates[i];
+        double b = bits[g.in1];
+        switch (g.type) {
+            case ADD: b = sum(bits[g.in1], bits[g.in2]); break;
+            case CMUL: b += log2(max(1, abs((int) g.constant))); break;
+            case AND: case NAND: case XOR: b = max(bits[g.in1], bits[g.in2]); break;
+            case MUX: b = max(bits[g.in1], sum(bits[g.in2], bits[g.in3])); break;
+            default: break;
+        }
+        bits[g.out] = b;
+        most = max(most, b);
+    }
+    return ceil(most);
+}
+
+void CircuitFile::compute_stats() {
+    // cost of a gate in AND depth and in NAND depth once recoded, integer
+    // gates have no NAND form. MUX is one product, and NAND(NAND(c, x),
+    // NAND(NAND(c, c), y)) recoded.
+    const uint64_t mult_cost[] = {1, 0, 0, 1, 0, 0, 1}, nand_cost[] = {2, 3, 1, 1, 0, 0, 3};
+
+    vector<uint64_t> mult_depth(header.num_wires, 0), nand_depth(header.num_wires, 0);
+    uint32_t in[3];
+    for (auto i : topological_order()) {
+        const CircuitGate &g = gates[i];
+        header.gate_count[g.type]++;
+
+        uint64_t md = 0, nd = 0;
+        for (unsigned int j = 0, n = g.inputs(in); j < n; j++) {
+            md = max(md, mult_depth[in[j]]);
+            nd = max(nd, nand_depth[in[j]]);
+        }
+        mult_depth[g.out] = md + mult_cost[g.type];
+        nand_depth[g.out] = nd + nand_cost[g.type];
+        header.mult_depth = max(header.mult_depth, mult_depth[g.out]);
+        header.nand_depth = max(header.nand_depth, nand_depth[g.out]);
+    }
+}
@@ -0,0 +1,89 @@
+/* Loading of Bristol format circuits and of their compiled binary form
+ */
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// ADD and CMUL are the integer gates: a sum, which is XOR on bits, and a
+// product with a public constant. MUX reads three wires, in1 ? in2 : in3.
+typedef enum {AND, XOR, INV, NAND, ADD, CMUL, MUX, VAL} GateType;
+
+#define CIRCUIT_MAGIC "GSWCIRC3"
+// Before MUX, with gates lacking in3 and counts for six gate types
+#define CIRCUIT_MAGIC_V2 "GSWCIRC2"
+// Before the integer gates, with counts for the first four gate types only
+#define CIRCUIT_MAGIC_V1 "GSWCIRC1"
+#define NO_WIRE UINT32_MAX
+
+// A gate as stored in a compiled circuit, in2 is NO_WIRE for INV and CMUL
+// and in3 for all but MUX. in1 is the left operand of AND and NAND
+// products, the one whose noise only grows by in2's message.
+struct CircuitGate {
+    uint32_t in1, in2, in3, out;
+    uint16_t type; // GateType
+    int16_t constant; // CMUL's multiplier
+
+    // The distinct wires read, in order, returns how many
+    unsigned int inputs(uint32_t in[3]) const {
+        const uint32_t all[] = {in1, in2, in3};
+        unsigned int n = 0;
+        for (auto w : all) {
+            bool seen = w == NO_WIRE;
+            for (unsigned int i = 0; i < n; i++) {
+                seen = seen || in[i] == w;
+            }
+            if (!seen) {
+                in[n++] = w;
+            }
+        }
+        return n;
+    }
+};
+
+struct CircuitHeader {
+    char magic[8];
+    uint64_t num_gates, num_wires, num_in1, num_in2, num_out;
+    uint64_t mult_depth; // AND and NAND gates on the longest path
+    uint64_t nand_depth; // depth once recoded to NANDs
+    uint64_t gate_count[7]; // by GateType
+};
+
+// A compiled circuit is the header followed by num_gates CircuitGates, so
+// loading one is a single mmap. Bristol text files are mmapped as well and
+// tokenized in place, older compiled versions are converted on load.
+class CircuitFile {
+public:
+    CircuitHeader header;
+    const CircuitGate *gates;
+
+    CircuitFile(const std::string& filename);
+    CircuitFile(std::istream&);
+    ~CircuitFile();
+
+    void write_compiled(std::ostream&) const;
+    // Gate indices, each after the gates driving its inputs
+    std::vector<uint32_t> topological_order() const;
+    // Bits noise grows by through ADD fan-in and CMUL constants on top of
+    // what the products of mult_depth account for
+    unsigned int integer_noise_bits() const;
+
+private:
+    void *map;
+    size_t map_len;
+    std::vector<CircuitGate> parsed; // gates of a Bristol text file or an older version
+    std::string buffer; // contents of a stream
+
+    void load(const char* data, size_t len);
+    void load_gates(const char* data, size_t len);
+    // Version 1 and 2 gates, which lack in3
+    void load_legacy_gates(const char* data, size_t len);
+    void parse_bristol(const char* data, size_t len);
+    void check_wires() const;
+    void compute_stats();
+
+    CircuitFile(const CircuitFile&);
+    CircuitFile& operator=(const CircuitFile&);
+};
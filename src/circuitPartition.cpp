@@ -0,0 +1,178 @@
+#include <algorithm>
+
+#include "circuitPartition.hpp"
+
+using namespace std;
+
+namespace {
+
+// Refinement stops earlier once a pass moves nothing
+const unsigned int PASSES = 8;
+// Parts may exceed an even share of the products by this much
+const double IMBALANCE = 0.05;
+
+}
+
+CircuitPartition::CircuitPartition(const CircuitFile& circuit, unsigned int parts)
+    : parts(parts), part(circuit.header.num_gates), load(parts, 0), cut(0), circuit(circuit) {
+    const uint64_t num_gates = circuit.header.num_gates;
+    producer.assign(circuit.header.num_wires, NO_WIRE);
+    readers.resize(circuit.header.num_wires);
+
+    double total = 0;
+    for (uint64_t i = 0; i < num_gates; i++) {
+        producer[circuit.gates[i].out] = i;
+        total += gate_weight(circuit.gates[i].type);
+    }
+
+    // equal chunks of the depth first order
+    double done = 0;
+    for (auto i : depth_first_order()) {
+        part[i] = min<uint32_t>(parts - 1, done * parts / total);
+        done += gate_weight(circuit.gates[i].type);
+        load[part[i]] += gate_weight(circuit.gates[i].type);
+    }
+    for (uint64_t i = 0; i < num_gates; i++) {
+        uint32_t in[3];
+        for (unsigned int j = 0, n = circuit.gates[i].inputs(in); j < n; j++) {
+            add_reader(in[j], part[i], 1);
+        }
+    }
+
+    // a part can always take one more product than its share
+    const double max_load = max(total / parts * (1 + IMBALANCE), total / parts + 1);
+    for (unsigned int pass = 0; pass < PASSES && refine(max_load); pass++) { }
+    count_cut();
+}
+
+// Postorder from the outputs, gates no output depends on last
+vector<uint32_t> CircuitPartition::depth_first_order() const {
+    const uint64_t num_gates = circuit.header.num_gates, num_wires = circuit.header.num_wires;
+    vector<uint32_t> order;
+    order.reserve(num_gates);
+    vector<bool> visited(num_gates, false);
+    // (gate, inputs already pushed)
+    vector<pair<uint32_t, bool> > stack;
+
+    vector<uint32_t> roots;
+    for (uint64_t w = num_wires - circuit.header.num_out; w < num_wires; w++) {
+        if (producer[w] != NO_WIRE) roots.push_back(producer[w]);
+    }
+    for (uint64_t i = 0; i < num_gates; i++) {
+        roots.push_back(i);
+    }
+
+    for (auto root : roots) {
+        if (visited[root]) continue;
+        stack.push_back(make_pair(root, false));
+        while (!stack.empty()) {
+            const uint32_t i = stack.back().first;
+            if (stack.back().second) {
+                stack.pop_back();
+                order.push_back(i);
+                continue;
+            }
+            if (visited[i]) {
+                stack.pop_back();
+                continue;
+            }
+            visited[i] = true;
+            stack.back().second = true;
+            const CircuitGate &g = circuit.gates[i];
+            const uint32_t in[] = {g.in3, g.in2, g.in1};
+            for (auto w : in) {
+                if (w != NO_WIRE && producer[w] != NO_WIRE && !visited[producer[w]]) {
+                    stack.push_back(make_pair(producer[w], false));
+                }
+            }
+        }
+    }
+    return order;
+}
+
+uint32_t CircuitPartition::reading(uint32_t wire, uint32_t p) const {
+    for (auto &r : readers[wire]) {
+        if (r.first == p) return r.second;
+    }
+    return 0;
+}
+
+void CircuitPartition::add_reader(uint32_t wire, uint32_t p, int delta) {
+    vector<pair<uint32_t, uint32_t> > &r = readers[wire];
+    for (size_t j = 0; j < r.size(); j++) {
+        if (r[j].first == p) {
+            r[j].second += delta;
+            if (!r[j].second) {
+                r.erase(r.begin() + j);
+            }
+            return;
+        }
+    }
+    r.push_back(make_pair(p, delta));
+}
+
+int64_t CircuitPartition::gain(uint32_t i, uint32_t b) const {
+    const CircuitGate &g = circuit.gates[i];
+    const uint32_t a = part[i];
+    // the output is shipped to a instead of b
+    int64_t delta = (reading(g.out, a) > 0) - (reading(g.out, b) > 0);
+    uint32_t in[3];
+    for (unsigned int j = 0, n = g.inputs(in); j < n; j++) {
+        const uint32_t w = in[j];
+        const uint32_t own = owner(w);
+        delta += (b != own && !reading(w, b)) - (a != own && reading(w, a) == 1);
+    }
+    return delta;
+}
+
+bool CircuitPartition::refine(double max_load) {
+    bool moved = false;
+    for (uint64_t i = 0; i < circuit.header.num_gates; i++) {
+        const CircuitGate &g = circuit.gates[i];
+        const double w = gate_weight(g.type);
+
+        // only the parts of neighbours can gain anything
+        vector<uint32_t> candidates;
+        for (auto &r : readers[g.out]) {
+            candidates.push_back(r.first);
+        }
+        uint32_t in[3];
+        const unsigned int num_in = g.inputs(in);
+        for (unsigned int j = 0; j < num_in; j++) {
+            if (producer[in[j]] != NO_WIRE) {
+                candidates.push_back(part[producer[in[j]]]);
+            }
+        }
+
+        uint32_t best = part[i];
+        int64_t best_gain = 0;
+        for (auto b : candidates) {
+            if (b == part[i] || load[b] + w > max_load) continue;
+            const int64_t d = gain(i, b);
+            if (d < best_gain) {
+                best = b;
+                best_gain = d;
+            }
+        }
+        if (best == part[i]) continue;
+
+        for (unsigned int j = 0; j < num_in; j++) {
+            add_reader(in[j], part[i], -1);
+            add_reader(in[j], best, 1);
+        }
+        load[part[i]] -= w;
+        load[best] += w;
+        part[i] = best;
+        moved = true;
+    }
+    return moved;
+}
+
+void CircuitPartition::count_cut() {
+    cut = 0;
+    for (uint64_t w = 0; w < circuit.header.num_wires; w++) {
+        for (auto &r : readers[w]) {
+            cut += r.first != owner(w);
+        }
+    }
+}
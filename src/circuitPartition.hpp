@@ -0,0 +1,43 @@
+/* Split of a circuit's gates over the workers of a distributed evaluation
+ */
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include "circuitFile.hpp"
+
+// Every gate goes to one part, parts are balanced by products and a wire
+// read in parts other than its own is shipped to each of them, so the
+// partition tries to keep wires in one part. Gates are first split into
+// equal chunks of a depth first order, which keeps output cones together,
+// then moved one by one to a neighbour's part while that cuts fewer wires
+// and the balance holds.
+class CircuitPartition {
+public:
+    unsigned int parts;
+    std::vector<uint32_t> part; // by gate
+    std::vector<double> load; // products by part, see gate_weight
+    uint64_t cut; // ciphertexts shipped between parts, circuit inputs count as shipped to every part reading them
+
+    CircuitPartition(const CircuitFile&, unsigned int parts);
+
+    // Additions are O(N^2) against a product's O(N^3), they only weigh
+    // enough to spread long runs of them
+    static double gate_weight(uint32_t type) { return type == AND || type == NAND || type == MUX ? 1 : 0.01; }
+
+private:
+    const CircuitFile &circuit;
+    std::vector<uint32_t> producer; // gate driving each wire, NO_WIRE for inputs
+    // (part, gates reading the wire there) for every wire
+    std::vector<std::vector<std::pair<uint32_t, uint32_t> > > readers;
+
+    std::vector<uint32_t> depth_first_order() const;
+    uint32_t owner(uint32_t wire) const { return producer[wire] == NO_WIRE ? parts : part[producer[wire]]; }
+    uint32_t reading(uint32_t wire, uint32_t p) const;
+    void add_reader(uint32_t wire, uint32_t p, int delta);
+    // change of the cut when gate g moves to part b
+    int64_t gain(uint32_t g, uint32_t b) const;
+    bool refine(double max_load);
+    void count_cut();
+};
@@ -0,0 +1,255 @@
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+
+#include "circuitProfile.hpp"
+
+using namespace std;
+
+namespace {
+
+// Slices of the run parallelism is reported for
+const int SLICES = 10;
+// Slowest levels listed
+const size_t LEVELS = 5;
+
+double clock_seconds() {
+    return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+const char* type_name(GateType type) {
+    switch (type) {
+        case AND: return "AND";
+        case XOR: return "XOR";
+        case INV: return "INV";
+        case NAND: return "NAND";
+        case ADD: return "ADD";
+        case CMUL: return "CMUL";
+        case MUX: return "MUX";
+        default: return "input";
+    }
+}
+
+}
+
+CircuitProfile::CircuitProfile() : origin(clock_seconds()) { }
+
+void CircuitProfile::start() {
+    events.clear();
+    origin = clock_seconds();
+}
+
+double CircuitProfile::now() const {
+    return clock_seconds() - origin;
+}
+
+uint64_t CircuitProfile::add(GateType type, double start, const vector<uint64_t>& inputs, uint64_t bytes, bool output) {
+    Event e;
+    e.type = type;
+    e.start = start;
+    e.end = now();
+    e.bytes = bytes;
+    e.output = output;
+    e.inputs = inputs;
+    {
+        lock_guard<mutex> lock(threads_mutex);
+        e.thread = threads.insert(make_pair(this_thread::get_id(), (uint32_t) threads.size())).first->second;
+    }
+    events.push_back(e);
+    return events.size() - 1;
+}
+
+double CircuitProfile::critical_path(vector<bool>& on_path) const {
+    // latest finish of a chain ending in each event, and its previous event
+    vector<double> finish(events.size(), 0);
+    vector<int64_t> previous(events.size(), -1);
+    int64_t last = -1;
+    for (uint64_t i = 0; i < events.size(); i++) {
+        double ready = 0;
+        for (auto in : events[i].inputs) {
+            if (finish[in] > ready || previous[i] < 0) {
+                ready = max(ready, finish[in]);
+                previous[i] = in;
+            }
+        }
+        finish[i] = ready + events[i].end - events[i].start;
+        if (last < 0 || finish[i] > finish[last]) {
+            last = i;
+        }
+    }
+    on_path.assign(events.size(), false);
+    for (int64_t i = last; i >= 0; i = previous[i]) {
+        on_path[i] = true;
+    }
+    return last < 0 ? 0 : finish[last];
+}
+
+vector<pair<double, int64_t> > CircuitProfile::live_bytes() const {
+    // a ciphertext lives from its gate's end to its last reader's end,
+    // outputs to the end of the run
+    vector<double> release(events.size(), -1);
+    double wall = 0;
+    for (uint64_t i = 0; i < events.size(); i++) {
+        for (auto in : events[i].inputs) {
+            release[in] = max(release[in], events[i].end);
+        }
+        wall = max(wall, events[i].end);
+    }
+    vector<pair<double, int64_t> > changes;
+    for (uint64_t i = 0; i < events.size(); i++) {
+        const double until = events[i].output || release[i] < 0 ? wall : release[i];
+        changes.push_back(make_pair(events[i].end, (int64_t) events[i].bytes));
+        changes.push_back(make_pair(until, -(int64_t) events[i].bytes));
+    }
+    sort(changes.begin(), changes.end());
+    return changes;
+}
+
+void CircuitProfile::print(ostream& fp) const {
+    uint64_t gates = 0;
+    double wall = 0, busy = 0, idle = 0, largest_gap = 0, covered = 0;
+    map<GateType, pair<uint64_t, double> > by_type; // gates and seconds
+    vector<pair<double, double> > intervals;
+    for (auto &e : events) {
+        wall = max(wall, e.end);
+        if (e.type == VAL) {
+            continue;
+        }
+        gates++;
+        busy += e.end - e.start;
+        by_type[e.type].first++;
+        by_type[e.type].second += e.end - e.start;
+        intervals.push_back(make_pair(e.start, e.end));
+    }
+    sort(intervals.begin(), intervals.end());
+    for (auto &in : intervals) {
+        if (in.first > covered) {
+            idle += in.first - covered;
+            largest_gap = max(largest_gap, in.first - covered);
+        }
+        covered = max(covered, in.second);
+    }
+
+    // most gates running at once, CryptoCircuit::eval runs them one after
+    // another and leaves the threads to the product
+    vector<pair<double, int> > edges;
+    for (auto &in : intervals) {
+        edges.push_back(make_pair(in.first, 1));
+        edges.push_back(make_pair(in.second, -1));
+    }
+    sort(edges.begin(), edges.end());
+    int running = 0, concurrent = 0;
+    for (auto &e : edges) {
+        running += e.second;
+        concurrent = max(concurrent, running);
+    }
+
+    vector<double> slices(SLICES, 0);
+    const double slice = wall / SLICES;
+    for (auto &in : intervals) {
+        for (int s = 0; slice > 0 && s < SLICES; s++) {
+            const double overlap = min(in.second, (s + 1) * slice) - max(in.first, s * slice);
+            slices[s] += max(0.0, overlap) / slice;
+        }
+    }
+
+    // levels count gates of any type on the longest path from the inputs
+    vector<uint64_t> level(events.size(), 0);
+    map<uint64_t, pair<uint64_t, double> > by_level;
+    for (uint64_t i = 0; i < events.size(); i++) {
+        for (auto in : events[i].inputs) {
+            level[i] = max(level[i], level[in] + 1);
+        }
+        if (events[i].type != VAL) {
+            by_level[level[i]].first++;
+            by_level[level[i]].second += events[i].end - events[i].start;
+        }
+    }
+    vector<pair<double, uint64_t> > slowest;
+    uint64_t widest = 0;
+    for (auto &l : by_level) {
+        slowest.push_back(make_pair(l.second.second, l.first));
+        widest = max(widest, l.second.first);
+    }
+    sort(slowest.rbegin(), slowest.rend());
+
+    vector<bool> on_path;
+    const double path = critical_path(on_path);
+    uint64_t path_gates = 0, path_products = 0;
+    for (uint64_t i = 0; i < events.size(); i++) {
+        if (on_path[i] && events[i].type != VAL) {
+            path_gates++;
+            path_products += events[i].type == AND || events[i].type == NAND || events[i].type == MUX;
+        }
+    }
+    int64_t live = 0, peak = 0;
+    for (auto &c : live_bytes()) {
+        live += c.second;
+        peak = max(peak, live);
+    }
+
+    const double available = path > 0 ? busy / path : 0;
+    const double realised = wall > 0 ? busy / wall : 0;
+    fp << fixed << setprecision(2);
+    fp << gates << " gates in " << wall << " s, " << (wall > 0 ? gates / wall : 0) << " gates/s on "
+       << threads.size() << " threads" << endl;
+    fp << "critical path " << path << " s through " << path_gates << " gates, " << path_products
+       << " of them products" << endl;
+    if (concurrent > 1) {
+        fp << "parallelism available " << available << ", realised " << realised << ", by tenth of the run:";
+        for (auto p : slices) {
+            fp << " " << p;
+        }
+        fp << endl;
+    } else {
+        fp << "parallelism available " << available << ", widest level " << widest
+           << " gates, gates ran one at a time" << endl;
+    }
+    fp << "idle " << idle << " s between gates, longest gap " << largest_gap << " s" << endl;
+    fp << "peak live ciphertexts " << peak / 1048576.0 << " MB" << endl;
+    for (auto &t : by_type) {
+        fp << setw(6) << type_name(t.first) << " " << setw(8) << t.second.first << " gates "
+           << setw(10) << t.second.second / t.second.first * 1000 << " ms each" << endl;
+    }
+    fp << "slowest levels:" << endl;
+    for (size_t i = 0; i < min(LEVELS, slowest.size()); i++) {
+        fp << setw(6) << slowest[i].second << " " << setw(8) << by_level[slowest[i].second].first
+           << " gates " << setw(10) << slowest[i].first << " s" << endl;
+    }
+    if (wall > 0 && idle > 0.1 * wall) {
+        fp << "bound by memory: " << setprecision(0) << 100 * idle / wall << "% of the run is spent between gates" << endl;
+    } else if (concurrent > 1 && available > 1.5 * realised) {
+        fp << "bound by width: more gates could run at once than did" << endl;
+    } else if (concurrent <= 1 && available > 1.5) {
+        fp << "bound by gate count: gates ran one at a time, the run is the sum of their times" << endl;
+    } else {
+        fp << "bound by depth: the critical path is most of the run" << endl;
+    }
+}
+
+void CircuitProfile::write_trace(ostream& fp) const {
+    vector<bool> on_path;
+    critical_path(on_path);
+
+    // timestamps are whole microseconds
+    fp << fixed << setprecision(0);
+    fp << "{\"traceEvents\":[" << endl;
+    fp << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,\"args\":{\"name\":\"gsw-fhe circuit\"}}";
+    for (uint64_t i = 0; i < events.size(); i++) {
+        const Event &e = events[i];
+        if (e.type == VAL) {
+            continue;
+        }
+        fp << "," << endl << "{\"name\":\"" << type_name(e.type) << "\",\"cat\":\""
+           << (on_path[i] ? "critical" : "gate") << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << e.thread
+           << ",\"ts\":" << e.start * 1e6 << ",\"dur\":" << (e.end - e.start) * 1e6
+           << ",\"args\":{\"event\":" << i << ",\"bytes\":" << e.bytes << "}}";
+    }
+    int64_t live = 0;
+    for (auto &c : live_bytes()) {
+        live += c.second;
+        fp << "," << endl << "{\"name\":\"live ciphertexts\",\"ph\":\"C\",\"pid\":0,\"ts\":" << c.first * 1e6
+           << ",\"args\":{\"bytes\":" << live << "}}";
+    }
+    fp << endl << "]}" << endl;
+}
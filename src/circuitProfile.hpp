@@ -0,0 +1,55 @@
+/* Per gate timings of a circuit evaluation, summarised and as a Chrome trace
+ */
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <cstdint>
+
+#include "circuitFile.hpp"
+
+// Filled in by CryptoCircuit::eval. Events are numbered in the order they are
+// added, which has every gate after the gates it reads, so the critical path,
+// the levels and the lifetime of every ciphertext follow from them alone.
+class CircuitProfile {
+public:
+    struct Event {
+        GateType type; // VAL for circuit inputs
+        double start, end; // seconds since start()
+        uint32_t thread;
+        uint64_t bytes; // of the gate's ciphertext
+        bool output;
+        std::vector<uint64_t> inputs; // events of the gates read
+    };
+    std::vector<Event> events;
+
+    CircuitProfile();
+
+    void start();
+    // Seconds since start()
+    double now() const;
+    // A gate that began at start and ends now, returns its event
+    uint64_t add(GateType, double start, const std::vector<uint64_t>& inputs, uint64_t bytes, bool output);
+
+    // Throughput, critical path, parallelism, idle gaps, live ciphertexts
+    // and the slowest levels
+    void print(std::ostream&) const;
+    // Trace Event Format JSON, which chrome://tracing and Perfetto open
+    void write_trace(std::ostream&) const;
+
+private:
+    double origin;
+    std::mutex threads_mutex;
+    std::map<std::thread::id, uint32_t> threads;
+
+    // Marks the events on the longest chain of gate times, returns its length
+    double critical_path(std::vector<bool>& on_path) const;
+    // Changes of the bytes of ciphertexts computed and still to be read
+    std::vector<std::pair<double, int64_t> > live_bytes() const;
+
+    CircuitProfile(const CircuitProfile&);
+    CircuitProfile& operator=(const CircuitProfile&);
+};
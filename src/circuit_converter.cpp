@@ -1,6 +1,7 @@
 #include <vector>
 #include <iostream>
 #include <string>
+#include <sstream>
 #include <argp.h>
 
 #include "circuit.hpp"
@@ -16,13 +17,17 @@ static char args_doc[] = "";
 static struct argp_option options[] = {
     {"simplify",      's', "<pattern>",                0,   "Simplify a circuit."},
     {"nand",          'n', 0,                          0,   "Convert to NAND based circuit"},
+    {"binary",        'b', 0,                          0,   "Output a compiled binary circuit, that gsw-fhe loads without parsing"},
+    {"fix",           'f', "<pattern>",                0,   "Fold public inputs into the circuit, 0 or 1 fixes an input and x keeps it"},
+    {"mux",           'm', 0,                          0,   "Replace selections written out in AND, XOR and NAND gates with MUX gates"},
+    {"left-deep",     'l', 0,                          0,   "Put the noisier operand of every product first and multiply AND trees as left-deep chains"},
     {0}
 };
 
 struct arguments_t {
-    char *simplification;
+    char *simplification, *fix;
     int in1;
-    bool simplify, nand;
+    bool simplify, nand, binary, mux, left_deep;
 
 };
 
@@ -31,6 +36,10 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
 
     switch(key) {
         case 'n': arguments->nand = true; break;
+        case 'b': arguments->binary = true; break;
+        case 'm': arguments->mux = true; break;
+        case 'l': arguments->left_deep = true; break;
+        case 'f': arguments->fix = arg; break;
         case 's': arguments->simplify = true; arguments->simplification = arg; break;
         case ARGP_KEY_ARG: 
             if (!arguments->simplify)
@@ -44,6 +53,8 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
         case ARGP_KEY_END:
             if (arguments->simplify && ! (arguments->in1))
                 argp_error(state, "Simplification requires num_in1");
+            if (arguments->mux && arguments->nand)
+                argp_error(state, "MUX gates would be recoded to NANDs again");
             
             break;
         default:
@@ -58,12 +69,25 @@ int main(int argc, char** argv) {
     arguments_t arguments = {0};
 
     argp_parse(&argp, argc, argv, 0, 0, &arguments);
+
+    // Plain compilation, no need to build the gate graph
+    if (arguments.binary && !arguments.nand && !arguments.simplify && !arguments.fix && !arguments.mux
+        && !arguments.left_deep) {
+        CircuitFile(std::cin).write_compiled(std::cout);
+        return 0;
+    }
     
     Circuit c = Circuit();
 
+    if (arguments.fix) {
+        c.specialise(arguments.fix);
+    }
+    if (arguments.mux) {
+        std::cerr << "Replaced " << c.find_muxes() << " selections with MUX gates" << std::endl;
+    }
     if (arguments.nand) {
         c.nand_recode();
-    } else {
+    } else if (arguments.simplify) {
         std::vector<bool> out(c.outputs.size(), false);
         std::string pattern = arguments.simplification;
         for (size_t i = 0; i < pattern.size(); i++) {
@@ -75,5 +99,14 @@ int main(int argc, char** argv) {
         }
         c.reduce(out, arguments.in1);
     }
-    c.output(std::cout);
+    if (arguments.left_deep) {
+        std::cerr << "Rebuilt " << c.order_products() << " ANDs as left-deep chains" << std::endl;
+    }
+    if (arguments.binary) {
+        std::stringstream text;
+        c.output(text);
+        CircuitFile(text).write_compiled(std::cout);
+    } else {
+        c.output(std::cout);
+    }
 }
@@ -1,64 +1,564 @@
+#include <algorithm>
 #include <map>
+#include <set>
 #include <queue>
+#include <unordered_map>
+#include <unordered_set>
+#include <cmath>
+#include <iomanip>
+
+#include <omp.h>
 
 #include "cryptoCircuit.hpp"
 
 using namespace std;
 
-CryptoCircuit::CryptoCircuit() : CircuitBase() { }
-CryptoCircuit::CryptoCircuit(string filename) : CircuitBase(filename) { }
-CryptoCircuit::CryptoCircuit(istream& fp) : CircuitBase(fp) { }
+CryptoCircuit::CryptoCircuit() : CircuitBase(), reused(0), recomputed(0), compact(false), complete(false) { }
+CryptoCircuit::CryptoCircuit(string filename) : CircuitBase(filename), reused(0), recomputed(0), compact(false), complete(false) { }
+CryptoCircuit::CryptoCircuit(istream& fp) : CircuitBase(fp), reused(0), recomputed(0), compact(false), complete(false) { }
+CryptoCircuit::CryptoCircuit(const CircuitFile& file) : CircuitBase(file), reused(0), recomputed(0), compact(false), complete(false) { }
 
 void CryptoCircuit::reset() {
-    queue<shared_ptr<Gate<BitMatrix> > > q;
+    queue<shared_ptr<Gate<Ciphertext> > > q;
+    unordered_set<Gate<Ciphertext>*> seen;
     for (auto g : inputs) {
-        g->id = -1; g->val.clear();
+        g->id = -1; g->val.reset();
         for (auto out_g : g->outputs) {
             q.push(out_g);
         }
     }
     while (!q.empty()) {
-        shared_ptr<Gate<BitMatrix> > g = q.front();
+        shared_ptr<Gate<Ciphertext> > g = q.front();
         q.pop();
-        g->id = -1; g->val.clear();
+        if (!seen.insert(g.get()).second) {
+            continue;
+        }
+        g->id = -1; g->val.reset();
         for (auto out_g : g->outputs) {
             q.push(out_g);
         }
     }
 }
 
-void CryptoCircuit::eval(vector<BitMatrix>& in, GSW& gsw) {
-    reset();
-    queue<shared_ptr<Gate<BitMatrix> > > q;
-    for (uintmax_t i = 0; i < inputs.size(); i++) {
-        inputs[i]->val = in[i];
-        for (auto out_g : inputs[i]->outputs) {
+// Same breadth first walk as the evaluation always did
+vector<shared_ptr<Gate<Ciphertext> > > CryptoCircuit::schedule() {
+    vector<shared_ptr<Gate<Ciphertext> > > order;
+    unordered_set<Gate<Ciphertext>*> done;
+    queue<shared_ptr<Gate<Ciphertext> > > q;
+    for (auto g : inputs) {
+        done.insert(g.get());
+        for (auto out_g : g->outputs) {
             q.push(out_g);
         }
     }
     while (!q.empty()) {
-        shared_ptr<Gate<BitMatrix> > g = q.front();
+        shared_ptr<Gate<Ciphertext> > g = q.front();
         q.pop();
 
+        // Queued once per input, so it may be done already
+        if (done.count(g.get())) {
+            continue;
+        }
         bool ready = true;
         for (auto in_g : g->inputs) {
-            ready = ready && ! in_g->val.empty();
+            ready = ready && done.count(in_g.get());
         }
-        // Not all input values propagated yet
+        // Not all inputs scheduled yet
         if (!ready) {
             continue;
         }
+        done.insert(g.get());
+        order.push_back(g);
+
+        for (auto out_g : g->outputs) {
+            q.push(out_g);
+        }
+    }
+    return order;
+}
+
+void CryptoCircuit::select_outputs(const vector<bool>& outputs_wanted) {
+    if (outputs_wanted.size() > outputs.size()) {
+        throw runtime_error("CryptoCircuit: circuit has " + to_string(outputs.size()) + " outputs");
+    }
+    selected = outputs_wanted;
+    selected.resize(outputs.size(), outputs_wanted.empty());
+    if (find(selected.begin(), selected.end(), false) == selected.end()) {
+        selected.clear();
+    }
+}
+
+vector<shared_ptr<Gate<Ciphertext> > > CryptoCircuit::selected_outputs() const {
+    vector<shared_ptr<Gate<Ciphertext> > > wanted;
+    for (uintmax_t i = 0; i < outputs.size(); i++) {
+        if (selected.empty() || selected[i]) {
+            wanted.push_back(outputs[i]);
+        }
+    }
+    return wanted;
+}
+
+unordered_set<Gate<Ciphertext>*> CryptoCircuit::unread_outputs(const vector<shared_ptr<Gate<Ciphertext> > >& order) const {
+    unordered_set<Gate<Ciphertext>*> read, result;
+    for (auto g : order) {
+        for (auto in_g : g->inputs) {
+            read.insert(in_g.get());
+        }
+    }
+    for (auto g : order) {
+        if (!read.count(g.get())) {
+            result.insert(g.get());
+        }
+    }
+    return result;
+}
+
+vector<shared_ptr<Gate<Ciphertext> > > CryptoCircuit::selected_schedule() {
+    vector<shared_ptr<Gate<Ciphertext> > > order = schedule();
+    if (!selected.empty()) {
+        const unordered_set<Gate<Ciphertext>*> needed = cone();
+        order.erase(remove_if(order.begin(), order.end(),
+                              [&needed](shared_ptr<Gate<Ciphertext> > g) { return !needed.count(g.get()); }),
+                    order.end());
+    }
+    return order;
+}
+
+unordered_set<Gate<Ciphertext>*> CryptoCircuit::cone() const {
+    unordered_set<Gate<Ciphertext>*> needed;
+    vector<Gate<Ciphertext>*> stack;
+    for (auto g : selected_outputs()) {
+        stack.push_back(g.get());
+    }
+    while (!stack.empty()) {
+        Gate<Ciphertext> *g = stack.back();
+        stack.pop_back();
+        if (!needed.insert(g).second) {
+            continue;
+        }
+        for (auto in_g : g->inputs) {
+            stack.push_back(in_g.get());
+        }
+    }
+    return needed;
+}
+
+namespace {
+
+const uint64_t NEVER = UINT64_MAX;
+// Gates ahead whose spilled inputs are prefetched
+const uint64_t PREFETCH_DEPTH = 2;
+
+// Keeps at most capacity values in memory. Over it the value read furthest
+// in the future is spilled (Belady's rule, the schedule is known), values
+// nothing reads any more are dropped and circuit outputs go first. Outputs
+// computed as a single row are N times smaller than the ciphertexts the
+// slots hold, they stay in memory outside the budget.
+class Residency {
+public:
+    Residency(const vector<shared_ptr<Gate<Ciphertext> > >& order,
+              const vector<shared_ptr<Gate<Ciphertext> > >& outputs,
+              const unordered_set<Gate<Ciphertext>*>& row_only, SpillStore& store, uint64_t capacity)
+        : order(order), outputs(outputs), row_only(row_only), store(store), capacity(capacity) {
+        for (auto g : outputs) {
+            values[g.get()].output = true;
+        }
+        for (uint64_t s = 0; s < order.size(); s++) {
+            const auto &in = order[s]->inputs;
+            for (size_t i = 0; i < in.size(); i++) {
+                // a gate reading one wire twice uses it once
+                if (find(in.begin(), in.begin() + i, in[i]) == in.begin() + i) {
+                    values[in[i].get()].uses.push_back(s);
+                }
+            }
+        }
+    }
+
+    void admit_input(Gate<Ciphertext> *g, const Ciphertext& C) {
+        make_room(1, 0);
+        g->val = C;
+        admit(g);
+    }
+
+    // Loads the inputs of step s and makes room for its output
+    void before(uint64_t s) {
+        for (auto in_g : order[s]->inputs) {
+            Value &v = values[in_g.get()];
+            if (v.spilled) {
+                make_room(1, s);
+                reload(in_g.get(), v);
+                resident.insert(make_pair(next_use(v), in_g.get()));
+            }
+        }
+        make_room(1, s);
+        for (uint64_t t = s + 1; t < min<uint64_t>(s + 1 + PREFETCH_DEPTH, order.size()); t++) {
+            for (auto in_g : order[t]->inputs) {
+                const Value &v = values[in_g.get()];
+                if (v.spilled) {
+                    store.prefetch(v.slot);
+                }
+            }
+        }
+    }
+
+    // Moves the inputs of step s on to their next use and admits its output
+    void after(uint64_t s) {
+        Gate<Ciphertext> *g = order[s].get();
+        for (size_t i = 0; i < g->inputs.size(); i++) {
+            Gate<Ciphertext> *in_g = g->inputs[i].get();
+            if (find(g->inputs.begin(), g->inputs.begin() + i, g->inputs[i]) != g->inputs.begin() + i) {
+                continue;
+            }
+            Value &v = values[in_g];
+            resident.erase(make_pair(next_use(v), in_g));
+            v.next++;
+            admit(in_g);
+        }
+        admit(g);
+    }
+
+    // Circuit outputs back in memory
+    void finish() {
+        for (auto g : outputs) {
+            Value &v = values[g.get()];
+            if (v.spilled) {
+                reload(g.get(), v);
+            }
+        }
+    }
+
+private:
+    struct Value {
+        vector<uint64_t> uses; // steps reading the value
+        size_t next; // index of the next of them
+        uint64_t slot;
+        bool spilled, output;
+        Value() : next(0), slot(0), spilled(false), output(false) { }
+    };
+
+    const vector<shared_ptr<Gate<Ciphertext> > > &order, &outputs;
+    const unordered_set<Gate<Ciphertext>*> &row_only;
+    SpillStore &store;
+    const uint64_t capacity;
+    unordered_map<Gate<Ciphertext>*, Value> values;
+    set<pair<uint64_t, Gate<Ciphertext>*> > resident; // by next use
+
+    static uint64_t next_use(const Value& v) {
+        return v.next < v.uses.size() ? v.uses[v.next] : NEVER;
+    }
+
+    // Keeps a resident value, or drops it when nothing needs it any more
+    void admit(Gate<Ciphertext> *g) {
+        const Value &v = values[g];
+        if (v.next == v.uses.size() && !v.output) {
+            g->val.reset();
+            return;
+        }
+        if (row_only.count(g)) {
+            return;
+        }
+        resident.insert(make_pair(next_use(v), g));
+        store.peak_resident = max<uint64_t>(store.peak_resident, resident.size());
+    }
 
-        if (g->type != NAND) {
-            throw runtime_error("CryptoCircuit can only NAND");
+    void reload(Gate<Ciphertext> *g, Value& v) {
+        BitMatrix C;
+        store.reload(v.slot, C);
+        g->val = Ciphertext(std::move(C));
+        v.spilled = false;
+    }
+
+    // Spills until n more values fit. Those step now reads sort first and
+    // are never spilled, the capacity leaves room for them and the output.
+    void make_room(uint64_t n, uint64_t now) {
+        while (resident.size() + n > capacity) {
+            auto last = prev(resident.end());
+            if (last->first <= now) {
+                break;
+            }
+            Gate<Ciphertext> *g = last->second;
+            Value &v = values[g];
+            v.slot = store.spill(*g->val);
+            v.spilled = true;
+            g->val.reset();
+            resident.erase(last);
+        }
+    }
+};
+
+}
+
+BitMatrix CryptoCircuit::eval_gate_row(GSWBase& gsw, GateType type, const BitMatrix& a, const BitMatrix& b,
+                                       const BitMatrix& c, int constant, unsigned int row) {
+    switch (type) {
+        case NAND: return gsw.nand_row(a, b, row);
+        case AND: return gsw.mult_row(a, b, row);
+        case MUX: return gsw.cmux_row(a, b, c, row);
+        // the rest cost O(N^2) anyway
+        default: return gsw.row(eval_gate(gsw, type, a, b, c, constant), row);
+    }
+}
+
+BitMatrix CryptoCircuit::eval_gate(GSWBase& gsw, GateType type, const BitMatrix& a, const BitMatrix& b,
+                                   const BitMatrix& c, int constant) {
+    switch (type) {
+        case NAND: return gsw.nand(a, b);
+        case AND: return gsw.mult(a, b);
+        case MUX: return gsw.cmux(a, b, c);
+        case XOR: case ADD: return gsw.add(a, b);
+        case INV: return gsw.negate(a);
+        case CMUL: return gsw.mult_const(a, constant);
+        default: throw runtime_error("CryptoCircuit: unknown gate");
+    }
+}
+
+void CryptoCircuit::check_inputs(const vector<Ciphertext>& in, const GSWBase& gsw) const {
+    if (in.size() != inputs.size()) {
+        throw ex("Circuit takes " + to_string(inputs.size()) + " inputs, got " + to_string(in.size()));
+    }
+    for (auto &c : in) {
+        if (c->size() != gsw.ciphertext_bits()) {
+            throw ex("Ciphertext of other parameters than the key");
+        }
+    }
+}
+
+void CryptoCircuit::eval(const vector<Ciphertext>& in, GSWBase& gsw, NoiseReport *report, SpillStore *spill,
+                         CircuitProfile *profile) {
+    check_inputs(in, gsw);
+    reset();
+    complete = false;
+    const vector<shared_ptr<Gate<Ciphertext> > > order = selected_schedule();
+    const vector<shared_ptr<Gate<Ciphertext> > > wanted = selected_outputs();
+    // indices among the outputs of each output gate
+    unordered_map<Gate<Ciphertext>*, vector<uint64_t> > output_index;
+    if (output_ready) {
+        for (uint64_t i = 0; i < wanted.size(); i++) {
+            output_index[wanted[i].get()].push_back(i);
+        }
+    }
+    const unordered_set<Gate<Ciphertext>*> row_only = compact ? unread_outputs(order) : unordered_set<Gate<Ciphertext>*>();
+    const unsigned int row = gsw.output_row();
+    Residency *residency = NULL;
+    if (spill && !in.empty()) {
+        residency = new Residency(order, wanted, row_only, *spill, spill->capacity(in[0]->size()));
+    }
+
+    // multiplicative depth of each gate, only kept for the report
+    map<shared_ptr<Gate<Ciphertext> >, uint64_t> depth;
+    // profile event of each gate, and which are outputs
+    unordered_map<Gate<Ciphertext>*, uint64_t> event;
+    unordered_set<Gate<Ciphertext>*> is_output;
+    if (profile) {
+        profile->start();
+        for (auto g : wanted) {
+            is_output.insert(g.get());
+        }
+    }
+    for (uintmax_t i = 0; i < inputs.size(); i++) {
+        if (report) {
+            report->add(0, gsw.noise(report->secret_key, *in[i]));
+        }
+        if (profile) {
+            event[inputs[i].get()] = profile->add(VAL, profile->now(), vector<uint64_t>(), (in[i]->size() + 7) / 8, false);
+        }
+        if (residency) {
+            residency->admit_input(inputs[i].get(), in[i]);
         } else {
-            auto nand_result = gsw.nand(g->inputs[0]->val, g->inputs[1]->val);
-            g->val.swap(nand_result);
+            inputs[i]->val = in[i];
+        }
+    }
+    for (uint64_t s = 0; s < order.size(); s++) {
+        shared_ptr<Gate<Ciphertext> > g = order[s];
+        if (residency) {
+            residency->before(s);
         }
 
-        for (auto out_g : g->outputs) {
-            q.push(out_g);
+        const double start = profile ? profile->now() : 0;
+        const BitMatrix &a = *operand(*g, 0)->val, &b = *operand(*g, 1)->val, &c = *operand(*g, 2)->val;
+        g->val = Ciphertext(row_only.count(g.get()) ? eval_gate_row(gsw, g->type, a, b, c, g->constant, row)
+                                                    : eval_gate(gsw, g->type, a, b, c, g->constant));
+        if (output_ready && output_index.count(g.get())) {
+            for (auto i : output_index[g.get()]) {
+                output_ready(i, compact ? Ciphertext(gsw.row(*g->val, row)) : g->val);
+            }
+            output_index.erase(g.get());
+        }
+        if (profile) {
+            vector<uint64_t> read;
+            for (auto in_g : g->inputs) {
+                read.push_back(event[in_g.get()]);
+            }
+            event[g.get()] = profile->add(g->type, start, read, (g->val->size() + 7) / 8, is_output.count(g.get()));
+        }
+
+        if (report) {
+            uint64_t d = 0;
+            for (auto in_g : g->inputs) {
+                d = max(d, depth[in_g]);
+            }
+            depth[g] = d + (g->type == AND || g->type == NAND || g->type == MUX);
+            report->add(depth[g], gsw.noise(report->secret_key, *g->val));
+        }
+        if (residency) {
+            residency->after(s);
+        }
+    }
+    complete = !residency && !compact;
+    reused = 0;
+    recomputed = order.size();
+    if (residency) {
+        residency->finish();
+        delete residency;
+    }
+    // outputs no gate computed, circuit inputs read straight out
+    for (auto &o : output_index) {
+        for (auto i : o.second) {
+            output_ready(i, compact ? Ciphertext(gsw.row(*o.first->val, row)) : o.first->val);
+        }
+    }
+    // and those other gates read as well
+    for (auto g : wanted) {
+        if (compact && !row_only.count(g.get())) {
+            g->val = Ciphertext(gsw.row(*g->val, row));
         }
     }
 }
 
+void CryptoCircuit::update(const vector<Ciphertext>& in, GSWBase& gsw) {
+    check_inputs(in, gsw);
+    if (!complete) {
+        eval(in, gsw);
+        return;
+    }
+    complete = false;
+
+    unordered_set<Gate<Ciphertext>*> changed;
+    for (uintmax_t i = 0; i < inputs.size(); i++) {
+        if (inputs[i]->val != in[i]) {
+            inputs[i]->val = in[i];
+            changed.insert(inputs[i].get());
+        }
+    }
+    // in schedule order the change has reached a gate's inputs before it
+    const unordered_set<Gate<Ciphertext>*> needed = cone();
+    reused = recomputed = 0;
+    for (auto g : schedule()) {
+        // gates outside the selection of the last run have no ciphertext
+        bool stale = g->val.empty();
+        for (auto in_g : g->inputs) {
+            stale = stale || changed.count(in_g.get());
+        }
+        if (!stale) {
+            reused += needed.count(g.get());
+            continue;
+        }
+        if (!needed.count(g.get())) {
+            // out of date, computed again once an output needs it
+            g->val.reset();
+            changed.insert(g.get());
+            continue;
+        }
+        g->val = Ciphertext(eval_gate(gsw, g->type, *operand(*g, 0)->val, *operand(*g, 1)->val, *operand(*g, 2)->val,
+                                      g->constant));
+        changed.insert(g.get());
+        recomputed++;
+    }
+    complete = true;
+}
+
+
+NoiseReport::NoiseReport(const BIVector& secret_key, const GSWBase& gsw)
+    : secret_key(secret_key), limit_bits(gsw.noise_limit_bits()) { }
+
+void NoiseReport::add(uint64_t depth, const BigInt& noise) {
+    bits_by_depth[depth].push_back(noise > 0 ? NTL::log(noise)/log(2) : 0);
+}
+
+void NoiseReport::print(ostream& fp) const {
+    double worst = 0;
+    fp << fixed << setprecision(1);
+    fp << "log2 noise per gate, decryption fails at " << limit_bits << " bits" << endl;
+    for (auto &level : bits_by_depth) {
+        map<int, uint64_t> histogram;
+        double level_worst = 0;
+        for (auto bits : level.second) {
+            histogram[(int) bits]++;
+            level_worst = max(level_worst, bits);
+        }
+        worst = max(worst, level_worst);
+
+        fp << "depth " << level.first << ": " << level.second.size()
+           << " gates, worst " << level_worst << " bits" << endl;
+        for (auto &bin : histogram) {
+            fp << setw(6) << bin.first << " bits " << setw(8) << bin.second << " ";
+            fp << string(max<uint64_t>(1, 40 * bin.second / level.second.size()), '#') << endl;
+        }
+    }
+    fp << "worst margin " << limit_bits - worst << " bits" << endl;
+}
+
+vector<vector<Ciphertext> > CryptoCircuit::eval_batch(const vector<vector<Ciphertext> >& in, GSWBase& gsw) {
+    for (auto &set : in) {
+        check_inputs(set, gsw);
+    }
+    reset();
+    complete = false;
+    const vector<shared_ptr<Gate<Ciphertext> > > order = selected_schedule();
+    const vector<shared_ptr<Gate<Ciphertext> > > wanted = selected_outputs();
+    const unordered_set<Gate<Ciphertext>*> row_only = compact ? unread_outputs(order) : unordered_set<Gate<Ciphertext>*>();
+    const unsigned int row = gsw.output_row();
+    const size_t count = in.size();
+
+    // ciphertexts of every set by gate, and the reads left of each, outputs
+    // counting as one
+    unordered_map<Gate<Ciphertext>*, vector<Ciphertext> > vals;
+    unordered_map<Gate<Ciphertext>*, uint64_t> reads;
+    for (auto g : order) {
+        for (auto in_g : g->inputs) {
+            reads[in_g.get()]++;
+        }
+    }
+    for (auto g : wanted) {
+        reads[g.get()]++;
+    }
+    for (uintmax_t i = 0; i < inputs.size(); i++) {
+        vector<Ciphertext> &val = vals[inputs[i].get()];
+        val.resize(count);
+        for (size_t s = 0; s < count; s++) {
+            val[s] = in[s][i];
+        }
+    }
+
+    // Products of different sets share no operand, so rather than fusing
+    // them the sets of a gate run one per thread, each product on one. Small
+    // batches leave the threads to the product instead.
+    const bool across = count >= (size_t) omp_get_max_threads();
+    for (auto g : order) {
+        const vector<Ciphertext> &a = vals[operand(*g, 0)], &b = vals[operand(*g, 1)], &c = vals[operand(*g, 2)];
+        vector<Ciphertext> &result = vals[g.get()];
+        result.resize(count);
+# pragma omp parallel for shared (a, b, c, result) schedule(dynamic) if (across)
+        for (size_t s = 0; s < count; s++) {
+            result[s] = Ciphertext(row_only.count(g.get())
+                ? eval_gate_row(gsw, g->type, *a[s], *b[s], *c[s], g->constant, row)
+                : eval_gate(gsw, g->type, *a[s], *b[s], *c[s], g->constant));
+        }
+        for (auto in_g : g->inputs) {
+            if (--reads[in_g.get()] == 0) {
+                vals.erase(in_g.get());
+            }
+        }
+    }
+
+    vector<vector<Ciphertext> > out(count, vector<Ciphertext>(wanted.size()));
+    for (uint64_t o = 0; o < wanted.size(); o++) {
+        const vector<Ciphertext> &val = vals[wanted[o].get()];
+        for (size_t s = 0; s < count; s++) {
+            out[s][o] = compact && !row_only.count(wanted[o].get()) ? Ciphertext(gsw.row(*val[s], row)) : val[s];
+        }
+    }
+    reused = 0;
+    recomputed = order.size() * count;
+    return out;
+}
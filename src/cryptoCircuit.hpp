@@ -1,16 +1,95 @@
 #pragma once
 
+#include <unordered_set>
+#include <algorithm>
+#include <functional>
+
 #include "circuit.hpp"
 
 #include "utils.hpp"
 #include "gsw.hpp"
+#include "spillStore.hpp"
+#include "circuitProfile.hpp"
+
+// Measured noise of every evaluated gate, filled in by CryptoCircuit::eval
+// when it is given the secret key
+class NoiseReport {
+public:
+    const BIVector &secret_key;
+    double limit_bits; // log2 of the noise decryption fails at
+    // log2 noise of each gate by multiplicative depth, inputs are depth 0
+    std::map<uint64_t, std::vector<double> > bits_by_depth;
+
+    NoiseReport(const BIVector& secret_key, const GSWBase&);
+
+    void add(uint64_t depth, const BigInt& noise);
+    // Per depth histograms in whole bits and the worst margin
+    void print(std::ostream&) const;
+};
 
-class CryptoCircuit : public CircuitBase<BitMatrix> {
+class CryptoCircuit : public CircuitBase<Ciphertext> {
 public:
+    uint64_t reused, recomputed; // gates of the last eval or update
+    // Outputs eval and update compute, every one when empty
+    std::vector<bool> selected;
+    // Called by eval as soon as each selected output is computed, with its
+    // index among them
+    std::function<void(uint64_t, const Ciphertext&)> output_ready;
+    // eval and eval_batch leave compact outputs, see GSWBase::output_row.
+    // Outputs no other gate reads compute their row alone.
+    bool compact;
+
     CryptoCircuit();
     CryptoCircuit(std::string);
     CryptoCircuit(std::istream&);
+    CryptoCircuit(const CircuitFile&);
 
     void reset();
-    void eval(std::vector<BitMatrix>&, GSW&);
+    // Only the gates the outputs with a true read, directly or not, are
+    // evaluated from now on. Missing ones count as false, an empty vector
+    // selects them all.
+    void select_outputs(const std::vector<bool>&);
+    std::vector<std::shared_ptr<Gate<Ciphertext> > > selected_outputs() const;
+    // The gates share the input ciphertexts, and the outputs they hold are
+    // what output_ready and selected_outputs hand out. With a SpillStore at
+    // most its budget of ciphertexts stays in memory. A CircuitProfile gets
+    // the timing of every gate, reloads fall between them.
+    void eval(const std::vector<Ciphertext>&, GSWBase&, NoiseReport *report = NULL, SpillStore *spill = NULL,
+              CircuitProfile *profile = NULL);
+    // Evaluates again keeping the ciphertexts of the last run, only the gates
+    // reading inputs that differ from its inputs, directly or not, are
+    // recomputed, and those the last selection skipped. Falls back to eval
+    // when there is no complete last run, as after one with a SpillStore.
+    void update(const std::vector<Ciphertext>&, GSWBase&);
+    // Evaluates every input set of the batch, walking the schedule once and
+    // running all sets of a gate together. Ciphertexts are dropped after
+    // their last read. Returns the selected outputs of each set, the gates
+    // keep no ciphertexts.
+    std::vector<std::vector<Ciphertext> > eval_batch(const std::vector<std::vector<Ciphertext> >&, GSWBase&);
+    // One gate on ciphertexts of its inputs, b is unused for INV and CMUL,
+    // c for all but MUX (a ? b : c), constant for all but CMUL
+    static BitMatrix eval_gate(GSWBase&, GateType, const BitMatrix& a, const BitMatrix& b, const BitMatrix& c,
+                               int constant);
+    // Row row of the gate's ciphertext, as a compact one
+    static BitMatrix eval_gate_row(GSWBase&, GateType, const BitMatrix& a, const BitMatrix& b, const BitMatrix& c,
+                                   int constant, unsigned int row);
+
+private:
+    bool complete; // every gate holds its ciphertext of the last run
+
+    // Input i of a gate for eval_gate, the last one past its inputs
+    static Gate<Ciphertext>* operand(const Gate<Ciphertext>& g, size_t i) {
+        return g.inputs[std::min(i, g.inputs.size() - 1)].get();
+    }
+
+    // Throws unless in is a ciphertext of gsw for every input
+    void check_inputs(const std::vector<Ciphertext>& in, const GSWBase& gsw) const;
+    // Gates in the order eval runs them, each after its inputs
+    std::vector<std::shared_ptr<Gate<Ciphertext> > > schedule();
+    // Those of them the selected outputs need
+    std::vector<std::shared_ptr<Gate<Ciphertext> > > selected_schedule();
+    // Gates the selected outputs read, directly or not, and themselves
+    std::unordered_set<Gate<Ciphertext>*> cone() const;
+    // Gates of the order no gate of it reads
+    std::unordered_set<Gate<Ciphertext>*> unread_outputs(const std::vector<std::shared_ptr<Gate<Ciphertext> > >&) const;
 };
@@ -0,0 +1,646 @@
+#include <sstream>
+#include <iomanip>
+#include <thread>
+#include <chrono>
+#include <random>
+#include <unordered_map>
+#include <map>
+#include <algorithm>
+#include <cstring>
+
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "distributed.hpp"
+#include "circuitPartition.hpp"
+#include "cryptoCircuit.hpp"
+#include "net.hpp"
+
+using namespace std;
+
+namespace {
+
+// Largest SETUP a worker accepts, a compiled circuit of a few billion gates
+const uint64_t MAX_SETUP = 1ull << 37;
+const uint64_t MAX_ERROR = 4096;
+
+double now() {
+    return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+uint64_t padded_words(uint64_t bytes) {
+    return (bytes + 7) / 8;
+}
+
+bool write_message(int fd, uint32_t type, uint32_t part, const void *payload, uint64_t length) {
+    const DistHeader header = {type, part, length};
+    return write_all(fd, &header, sizeof(header)) && write_all(fd, payload, length);
+}
+
+bool write_value(int fd, uint32_t part, uint32_t wire, const vector<uint64_t>& ciphertext) {
+    // header and wire in one segment
+    struct { DistHeader header; uint64_t wire; } head = {{DIST_VALUE, part, 8 + ciphertext.size() * 8}, wire};
+    return write_all(fd, &head, sizeof(head)) && write_all(fd, ciphertext.data(), ciphertext.size() * 8);
+}
+
+vector<string> split_addresses(const string& joined) {
+    vector<string> addresses;
+    stringstream ss(joined);
+    string address;
+    while (getline(ss, address, ',')) {
+        addresses.push_back(address);
+    }
+    return addresses;
+}
+
+// Ships wires to one destination from its own thread, the connection
+// belongs to the caller
+class Sender {
+public:
+    uint64_t bytes;
+
+    Sender(int fd, uint32_t from) : bytes(0), fd(fd), from(from), closed(false), failed(false) {
+        t = thread(&Sender::loop, this);
+    }
+    ~Sender() {
+        finish();
+    }
+
+    void send(uint32_t wire, const shared_ptr<const vector<uint64_t> >& ciphertext) {
+        {
+            lock_guard<mutex> lock(m);
+            queue.push_back(make_pair(wire, ciphertext));
+        }
+        cv.notify_one();
+    }
+
+    // Waits for the queue to drain, false if the connection failed
+    bool finish() {
+        {
+            lock_guard<mutex> lock(m);
+            closed = true;
+        }
+        cv.notify_one();
+        if (t.joinable()) {
+            t.join();
+        }
+        return !failed;
+    }
+
+private:
+    int fd;
+    uint32_t from;
+    mutex m;
+    condition_variable cv;
+    deque<pair<uint32_t, shared_ptr<const vector<uint64_t> > > > queue;
+    bool closed, failed;
+    thread t;
+
+    void loop() {
+        while (true) {
+            pair<uint32_t, shared_ptr<const vector<uint64_t> > > item;
+            {
+                unique_lock<mutex> lock(m);
+                cv.wait(lock, [this] { return closed || !queue.empty(); });
+                if (queue.empty()) {
+                    return;
+                }
+                item = queue.front();
+                queue.pop_front();
+            }
+            // after a failure the queue is only drained
+            if (!failed && !write_value(fd, from, item.first, *item.second)) {
+                failed = true;
+            }
+            bytes += item.second->size() * 8;
+        }
+    }
+};
+
+}
+
+struct DistWorker::Connection {
+    int fd;
+    Connection(int fd) : fd(fd) { }
+    ~Connection() { close(fd); }
+};
+
+// One job's share of the circuit: its gates, where their outputs go and the
+// ciphertexts still to be read
+class DistWorker::Job {
+public:
+    DistStats stats;
+
+    Job(DistWorker&);
+    ~Job();
+
+    // Throws ex on errors, the coordinator is told by the caller
+    void run(const Message& setup);
+    void send_done();
+
+private:
+    DistWorker &worker;
+    uint64_t id;
+    uint32_t me, parts;
+    shared_ptr<Connection> coordinator;
+    CircuitFile *circuit;
+    vector<uint32_t> part; // by gate
+    // gates of this part reading wire w are readers[first[w] .. first[w + 1])
+    vector<uint32_t> first, readers;
+    vector<vector<uint32_t> > ship_to; // by wire, parts and parts for the coordinator
+    vector<uint32_t> pending; // inputs a gate still waits for
+    vector<uint32_t> uses; // gates of this part yet to read a wire
+    uint64_t local_gates;
+    unordered_map<uint32_t, BitMatrix> values;
+    deque<uint32_t> ready;
+    vector<int> peer_fds;
+    map<uint32_t, Sender*> senders; // by destination part
+
+    void parse(const Message& setup, vector<string>& addresses);
+    void build(const vector<string>& addresses);
+    void deliver(uint32_t wire, BitMatrix& value);
+    bool finish_senders();
+};
+
+DistWorker::Job::Job(DistWorker& worker) : worker(worker), circuit(NULL), local_gates(0) {
+    memset(&stats, 0, sizeof(stats));
+    stats.wall = now();
+}
+
+// Gates of this part, wire fan out and connections to the parts wires go to
+void DistWorker::Job::build(const vector<string>& addresses) {
+    const uint64_t num_gates = circuit->header.num_gates, num_wires = circuit->header.num_wires;
+    const uint64_t first_output = num_wires - circuit->header.num_out;
+
+    vector<uint32_t> producer(num_wires, NO_WIRE);
+    for (uint64_t i = 0; i < num_gates; i++) {
+        producer[circuit->gates[i].out] = i;
+    }
+    first.assign(num_wires + 1, 0);
+    uses.assign(num_wires, 0);
+    pending.assign(num_gates, 0);
+    ship_to.resize(num_wires);
+    for (uint64_t i = 0; i < num_gates; i++) {
+        const CircuitGate &g = circuit->gates[i];
+        uint32_t in[3];
+        for (unsigned int j = 0, n = g.inputs(in); j < n; j++) {
+            const uint32_t w = in[j];
+            if (part[i] == me) {
+                first[w + 1]++;
+                uses[w]++;
+                pending[i]++;
+            } else if (producer[w] != NO_WIRE && part[producer[w]] == me) {
+                vector<uint32_t> &to = ship_to[w];
+                if (find(to.begin(), to.end(), part[i]) == to.end()) {
+                    to.push_back(part[i]);
+                }
+            }
+        }
+        if (part[i] == me) {
+            local_gates++;
+            if (g.out >= first_output) {
+                ship_to[g.out].push_back(parts);
+            }
+        }
+    }
+    for (uint64_t w = 0; w < num_wires; w++) {
+        first[w + 1] += first[w];
+    }
+    readers.resize(first[num_wires]);
+    vector<uint32_t> fill(first.begin(), first.end() - 1);
+    for (uint64_t i = 0; i < num_gates; i++) {
+        if (part[i] != me) continue;
+        uint32_t in[3];
+        for (unsigned int j = 0, n = circuit->gates[i].inputs(in); j < n; j++) {
+            readers[fill[in[j]]++] = i;
+        }
+    }
+
+    senders[parts] = new Sender(coordinator->fd, me);
+    for (uint64_t w = 0; w < num_wires; w++) {
+        for (auto p : ship_to[w]) {
+            if (senders.count(p)) continue;
+            const int fd = connect_tcp(addresses[p]);
+            peer_fds.push_back(fd);
+            if (!write_message(fd, DIST_PEER, me, &id, 8)) {
+                throw ex("Lost worker " + addresses[p]);
+            }
+            senders[p] = new Sender(fd, me);
+        }
+    }
+}
+
+DistWorker::Job::~Job() {
+    for (auto &s : senders) {
+        delete s.second;
+    }
+    for (int fd : peer_fds) {
+        close(fd);
+    }
+    delete circuit;
+}
+
+void DistWorker::Job::parse(const Message& m, vector<string>& addresses) {
+    const DistSetup &setup = *(const DistSetup *) m.payload.data();
+    const uint64_t *data = m.payload.data() + sizeof(DistSetup) / 8;
+    const uint64_t *end = m.payload.data() + m.payload.size();
+    id = setup.job;
+    me = m.header.part;
+    coordinator = m.from;
+    parts = setup.parts;
+
+    if (setup.ciphertext_bits != worker.gsw.ciphertext_bits()) {
+        throw ex("Worker has a key with other parameters");
+    }
+    if (setup.circuit_bytes > (uint64_t) (end - data) * 8) {
+        throw ex("Malformed setup");
+    }
+    istringstream compiled(string((const char *) data, setup.circuit_bytes));
+    circuit = new CircuitFile(compiled);
+    data += padded_words(setup.circuit_bytes);
+
+    const uint64_t num_gates = circuit->header.num_gates;
+    if (data + padded_words(num_gates * 4) + padded_words(setup.addresses_bytes) != end) {
+        throw ex("Malformed setup");
+    }
+    const uint32_t *parts_of = (const uint32_t *) data;
+    part.assign(parts_of, parts_of + num_gates);
+    data += padded_words(num_gates * 4);
+    addresses = split_addresses(string((const char *) data, setup.addresses_bytes));
+
+    if (me >= parts || addresses.size() != parts) {
+        throw ex("Malformed setup");
+    }
+    for (auto p : part) {
+        if (p >= parts) throw ex("Malformed setup");
+    }
+}
+
+void DistWorker::Job::deliver(uint32_t wire, BitMatrix& value) {
+    if (!ship_to[wire].empty()) {
+        // packed once for every destination
+        shared_ptr<vector<uint64_t> > packed(new vector<uint64_t>(worker.ciphertext_words));
+        pack_bits(value, packed->data());
+        for (auto p : ship_to[wire]) {
+            senders[p]->send(wire, packed);
+        }
+    }
+    if (!uses[wire]) {
+        return;
+    }
+    values[wire].swap(value);
+    for (uint32_t r = first[wire]; r < first[wire + 1]; r++) {
+        if (--pending[readers[r]] == 0) {
+            ready.push_back(readers[r]);
+        }
+    }
+}
+
+void DistWorker::Job::run(const Message& setup) {
+    vector<string> addresses;
+    parse(setup, addresses);
+    build(addresses);
+
+    const uint64_t bits = worker.gsw.ciphertext_bits();
+    while (stats.gates < local_gates) {
+        if (ready.empty()) {
+            Message m = worker.next(id);
+            if (m.header.type == DIST_ERROR) {
+                throw ex(string((const char *) m.payload.data(), m.header.length));
+            }
+            if (m.header.type != DIST_VALUE || m.payload[0] >= circuit->header.num_wires) {
+                continue;
+            }
+            BitMatrix value;
+            unpack_bits(&m.payload[1], bits, value);
+            stats.bytes_received += m.header.length - 8;
+            deliver(m.payload[0], value);
+            continue;
+        }
+
+        const uint32_t i = ready.front();
+        ready.pop_front();
+        const CircuitGate &g = circuit->gates[i];
+        const uint32_t in2 = g.in2 == NO_WIRE ? g.in1 : g.in2, in3 = g.in3 == NO_WIRE ? in2 : g.in3;
+
+        const double start = now();
+        BitMatrix result = CryptoCircuit::eval_gate(worker.gsw, (GateType) g.type, values[g.in1], values[in2],
+                                                    values[in3], g.constant);
+        stats.busy += now() - start;
+        stats.gates++;
+
+        uint32_t in[3];
+        for (unsigned int j = 0, n = g.inputs(in); j < n; j++) {
+            if (--uses[in[j]] == 0) values.erase(in[j]);
+        }
+        deliver(g.out, result);
+    }
+    if (!finish_senders()) {
+        throw ex("Lost a connection while shipping wires");
+    }
+}
+
+bool DistWorker::Job::finish_senders() {
+    bool ok = true;
+    for (auto &s : senders) {
+        ok = s.second->finish() && ok;
+        stats.bytes_sent += s.second->bytes;
+    }
+    return ok;
+}
+
+void DistWorker::Job::send_done() {
+    stats.wall = now() - stats.wall;
+    write_message(coordinator->fd, DIST_DONE, me, &stats, sizeof(stats));
+}
+
+
+DistWorker::DistWorker(GSWBase& gsw) : gsw(gsw) {
+    ciphertext_words = (gsw.ciphertext_bits() + 63) / 64;
+}
+
+void DistWorker::read_loop(shared_ptr<Connection> conn) {
+    uint64_t job = 0;
+    bool from_coordinator = false;
+    while (true) {
+        Message m;
+        m.from = conn;
+        if (!read_all(conn->fd, &m.header, sizeof(m.header))) {
+            break;
+        }
+        const uint64_t len = m.header.length;
+        bool valid;
+        switch (m.header.type) {
+            case DIST_SETUP: valid = len >= sizeof(DistSetup) && len <= MAX_SETUP; break;
+            case DIST_PEER: valid = len == 8; break;
+            case DIST_VALUE: valid = job && len == 8 + ciphertext_words * 8; break;
+            case DIST_ERROR: valid = job && len <= MAX_ERROR; break;
+            default: valid = false;
+        }
+        // the rest of a malformed message can not be told from the next one
+        if (!valid) {
+            break;
+        }
+        m.payload.resize(padded_words(len));
+        if (!read_all(conn->fd, m.payload.data(), len)) {
+            break;
+        }
+        if (m.header.type == DIST_SETUP || m.header.type == DIST_PEER) {
+            job = m.payload[0];
+            from_coordinator = m.header.type == DIST_SETUP;
+            if (m.header.type == DIST_PEER) {
+                continue;
+            }
+        }
+        m.job = job;
+        {
+            lock_guard<mutex> lock(inbox_mutex);
+            inbox.push_back(m);
+        }
+        inbox_cv.notify_one();
+    }
+
+    // peers hang up once they shipped everything, a coordinator never does
+    // before its job is over
+    if (from_coordinator) {
+        const string error = "Coordinator went away";
+        Message m;
+        m.job = job;
+        m.header.type = DIST_ERROR;
+        m.header.length = error.size();
+        m.payload.resize(padded_words(error.size()));
+        memcpy(m.payload.data(), error.data(), error.size());
+        {
+            lock_guard<mutex> lock(inbox_mutex);
+            inbox.push_back(m);
+        }
+        inbox_cv.notify_one();
+    }
+}
+
+void DistWorker::accept_loop(int listen_fd) {
+    while (true) {
+        const int fd = accept_tcp(listen_fd);
+        if (fd >= 0) {
+            thread(&DistWorker::read_loop, this, make_shared<Connection>(fd)).detach();
+        }
+    }
+}
+
+DistWorker::Message DistWorker::next(uint64_t job) {
+    for (auto it = early.begin(); it != early.end(); ++it) {
+        if (job ? it->job == job && it->header.type != DIST_SETUP : it->header.type == DIST_SETUP) {
+            Message m = *it;
+            early.erase(it);
+            return m;
+        }
+    }
+    while (true) {
+        Message m;
+        {
+            unique_lock<mutex> lock(inbox_mutex);
+            inbox_cv.wait(lock, [this] { return !inbox.empty(); });
+            m = inbox.front();
+            inbox.pop_front();
+        }
+        if (finished.count(m.job)) {
+            continue;
+        }
+        if (job ? m.job == job && m.header.type != DIST_SETUP : m.header.type == DIST_SETUP) {
+            return m;
+        }
+        early.push_back(m);
+    }
+}
+
+void DistWorker::run(unsigned int port) {
+    const int listen_fd = listen_tcp(port);
+    thread(&DistWorker::accept_loop, this, listen_fd).detach();
+    cerr << "Worker listening on port " << port << endl;
+
+    while (true) {
+        const Message setup = next(0);
+        const uint64_t id = setup.payload[0];
+        const double start = now();
+        try {
+            Job job(*this);
+            job.run(setup);
+            job.send_done();
+            cerr << "Job " << hex << id << dec << ": " << job.stats.gates << " gates in "
+                 << fixed << setprecision(1) << now() - start << " s" << endl;
+        } catch (exception &e) {
+            const string error = e.what();
+            write_message(setup.from->fd, DIST_ERROR, setup.header.part, error.data(), error.size());
+            cerr << "Job " << hex << id << dec << " failed: " << error << endl;
+        }
+        finished.insert(id);
+        // whatever else arrived for it is stale
+        for (auto it = early.begin(); it != early.end(); ) {
+            it = it->job == id ? early.erase(it) : it + 1;
+        }
+    }
+}
+
+
+DistCoordinator::DistCoordinator(const vector<string>& workers)
+    : workers(workers), cut(0), bytes_sent(0), bytes_received(0) {
+    if (workers.empty()) {
+        throw ex("No workers given");
+    }
+}
+
+vector<BitMatrix> DistCoordinator::eval(const CircuitFile& circuit, const vector<BitMatrix>& inputs, const GSWBase& gsw) {
+    const uint64_t num_gates = circuit.header.num_gates, num_wires = circuit.header.num_wires;
+    const uint64_t num_in = circuit.header.num_in1 + circuit.header.num_in2;
+    const uint64_t first_output = num_wires - circuit.header.num_out;
+    const uint64_t bits = gsw.ciphertext_bits(), words = (bits + 63) / 64;
+    const uint32_t parts = workers.size();
+    if (inputs.size() != num_in) {
+        throw ex("Circuit takes " + to_string(num_in) + " inputs");
+    }
+
+    CircuitPartition partition(circuit, parts);
+    cut = partition.cut;
+    load = partition.load;
+    stats.assign(parts, DistStats());
+    bytes_sent = bytes_received = 0;
+
+    ostringstream compiled;
+    circuit.write_compiled(compiled);
+    const string compiled_str = compiled.str();
+    string addresses;
+    for (auto &w : workers) {
+        addresses += (addresses.empty() ? "" : ",") + w;
+    }
+
+    random_device rd;
+    DistSetup setup = {0, parts, bits, compiled_str.size(), addresses.size()};
+    while (!setup.job) {
+        setup.job = (uint64_t) rd() << 32 | rd();
+    }
+    vector<uint64_t> payload(sizeof(setup) / 8 + padded_words(compiled_str.size()) +
+                             padded_words(num_gates * 4) + padded_words(addresses.size()), 0);
+    char *p = (char *) payload.data();
+    memcpy(p, &setup, sizeof(setup));
+    p += sizeof(setup);
+    memcpy(p, compiled_str.data(), compiled_str.size());
+    p += padded_words(compiled_str.size()) * 8;
+    memcpy(p, partition.part.data(), num_gates * 4);
+    p += padded_words(num_gates * 4) * 8;
+    memcpy(p, addresses.data(), addresses.size());
+
+    vector<int> fds;
+    vector<BitMatrix> outputs(circuit.header.num_out);
+    try {
+        for (uint32_t w = 0; w < parts; w++) {
+            fds.push_back(connect_tcp(workers[w]));
+            if (!write_message(fds[w], DIST_SETUP, w, payload.data(), payload.size() * 8)) {
+                throw ex("Lost worker " + workers[w]);
+            }
+        }
+
+        // every input goes to each part reading it
+        vector<vector<uint32_t> > input_parts(num_in);
+        for (uint64_t i = 0; i < num_gates; i++) {
+            uint32_t in[3];
+            for (unsigned int j = 0, n = circuit.gates[i].inputs(in); j < n; j++) {
+                const uint32_t w = in[j];
+                if (w >= num_in) continue;
+                vector<uint32_t> &to = input_parts[w];
+                if (find(to.begin(), to.end(), partition.part[i]) == to.end()) {
+                    to.push_back(partition.part[i]);
+                }
+            }
+        }
+        vector<uint64_t> packed(words);
+        for (uint64_t w = 0; w < num_in; w++) {
+            if (w >= first_output) {
+                outputs[w - first_output] = inputs[w];
+            }
+            if (input_parts[w].empty()) continue;
+            if (inputs[w].size() != bits) {
+                throw ex("Ciphertext " + to_string(w) + " does not match the key");
+            }
+            pack_bits(inputs[w], packed.data());
+            for (auto part : input_parts[w]) {
+                if (!write_value(fds[part], parts, w, packed)) {
+                    throw ex("Lost worker " + workers[part]);
+                }
+                bytes_sent += words * 8;
+            }
+        }
+
+        vector<bool> done(parts, false);
+        for (uint32_t remaining = parts; remaining; ) {
+            vector<pollfd> pfds;
+            for (uint32_t w = 0; w < parts; w++) {
+                pfds.push_back({fds[w], (short) (done[w] ? 0 : POLLIN), 0});
+            }
+            if (poll(pfds.data(), pfds.size(), -1) < 0) {
+                continue;
+            }
+            for (uint32_t w = 0; w < parts; w++) {
+                if (!pfds[w].revents) continue;
+                DistHeader header;
+                vector<uint64_t> message;
+                bool valid = read_all(fds[w], &header, sizeof(header));
+                if (valid) {
+                    switch (header.type) {
+                        case DIST_VALUE: valid = header.length == 8 + words * 8; break;
+                        case DIST_DONE: valid = header.length == sizeof(DistStats); break;
+                        case DIST_ERROR: valid = header.length <= MAX_ERROR; break;
+                        default: valid = false;
+                    }
+                }
+                if (valid) {
+                    message.resize(padded_words(header.length));
+                    valid = read_all(fds[w], message.data(), header.length);
+                }
+                if (!valid) {
+                    throw ex("Lost worker " + workers[w]);
+                }
+
+                if (header.type == DIST_ERROR) {
+                    throw ex(workers[w] + ": " + string((const char *) message.data(), header.length));
+                } else if (header.type == DIST_DONE) {
+                    memcpy(&stats[w], message.data(), sizeof(DistStats));
+                    done[w] = true;
+                    remaining--;
+                } else {
+                    const uint64_t wire = message[0];
+                    if (wire < first_output || wire >= num_wires) {
+                        throw ex("Worker " + workers[w] + " sent a wire that is not an output");
+                    }
+                    unpack_bits(&message[1], bits, outputs[wire - first_output]);
+                    bytes_received += words * 8;
+                }
+            }
+        }
+    } catch (...) {
+        // workers drop the job once the coordinator hangs up
+        for (int fd : fds) close(fd);
+        throw;
+    }
+    for (int fd : fds) close(fd);
+    return outputs;
+}
+
+void DistCoordinator::print(ostream& fp) const {
+    const double mb = 1048576.0;
+    fp << fixed << setprecision(1);
+    fp << "partition: " << workers.size() << " workers, " << cut << " ciphertexts cut"
+       << ", products per worker";
+    for (auto l : load) {
+        fp << " " << l;
+    }
+    fp << endl;
+    for (size_t w = 0; w < stats.size(); w++) {
+        const DistStats &s = stats[w];
+        fp << "worker " << w << " " << workers[w] << ": " << s.gates << " gates, busy " << s.busy
+           << " of " << s.wall << " s (" << (s.wall > 0 ? 100 * s.busy / s.wall : 0) << "%), sent "
+           << s.bytes_sent / mb << " MB, received " << s.bytes_received / mb << " MB" << endl;
+    }
+    fp << "coordinator: sent " << bytes_sent / mb << " MB of inputs, received "
+       << bytes_received / mb << " MB of outputs" << endl;
+}
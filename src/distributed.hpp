@@ -0,0 +1,107 @@
+/* Evaluation of one circuit by several gsw-fhe worker processes, on one
+ * machine or many
+ */
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <set>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+
+#include "utils.hpp"
+#include "gsw.hpp"
+#include "circuitFile.hpp"
+
+// Workers and the coordinator talk over TCP in messages of a DistHeader and
+// length bytes of payload, in host byte order, so every machine has to share
+// it. A job goes:
+//   coordinator -> each worker  SETUP, DistSetup and its data
+//   worker -> workers it ships wires to  PEER, the job as one word
+//   anyone -> worker  VALUE, the wire as one word and the pack_bits ciphertext
+//   worker -> coordinator  VALUE for circuit outputs, then DONE, a DistStats
+// ERROR carries a message instead and ends the job.
+enum DistMessage { DIST_SETUP, DIST_PEER, DIST_VALUE, DIST_DONE, DIST_ERROR };
+
+struct DistHeader {
+    uint32_t type; // DistMessage
+    uint32_t part; // the sender's, the receiver's for SETUP
+    uint64_t length;
+};
+
+// Followed by the compiled circuit and a uint32 part for every gate (see
+// CircuitPartition), each padded to a word, and the worker addresses joined
+// by commas
+struct DistSetup {
+    uint64_t job;
+    uint64_t parts;
+    uint64_t ciphertext_bits;
+    uint64_t circuit_bytes;
+    uint64_t addresses_bytes;
+};
+
+struct DistStats {
+    uint64_t gates;
+    uint64_t bytes_sent, bytes_received; // ciphertexts only
+    double busy, wall; // seconds evaluating gates and from SETUP to DONE
+};
+
+// Runs jobs one at a time, evaluating each gate of its part as soon as its
+// inputs are in. Every connection has a reader thread feeding one inbox, and
+// every destination a sender thread, so shipping wires overlaps evaluation.
+class DistWorker {
+public:
+    DistWorker(GSWBase&);
+
+    // Serves jobs until killed
+    void run(unsigned int port);
+
+private:
+    struct Connection;
+    struct Message {
+        uint64_t job;
+        DistHeader header;
+        std::vector<uint64_t> payload;
+        std::shared_ptr<Connection> from;
+    };
+    class Job;
+
+    GSWBase &gsw;
+    uint64_t ciphertext_words;
+
+    std::mutex inbox_mutex;
+    std::condition_variable inbox_cv;
+    std::deque<Message> inbox;
+    std::deque<Message> early; // for jobs whose SETUP is not in yet
+    std::set<uint64_t> finished;
+
+    void accept_loop(int listen_fd);
+    void read_loop(std::shared_ptr<Connection>);
+    // Next message of job, or any SETUP when job is 0
+    Message next(uint64_t job);
+
+    DistWorker(const DistWorker&);
+    DistWorker& operator=(const DistWorker&);
+};
+
+// Splits a circuit over the workers at the given "host:port" addresses,
+// hands them the inputs and collects the outputs
+class DistCoordinator {
+public:
+    std::vector<std::string> workers;
+    std::vector<DistStats> stats; // by worker, of the last eval
+    uint64_t cut; // ciphertexts shipped to workers, see CircuitPartition
+    std::vector<double> load; // products by worker
+    uint64_t bytes_sent, bytes_received; // inputs and outputs
+
+    DistCoordinator(const std::vector<std::string>& workers);
+
+    std::vector<BitMatrix> eval(const CircuitFile&, const std::vector<BitMatrix>& inputs, const GSWBase&);
+
+    // Per worker utilisation and traffic
+    void print(std::ostream&) const;
+};
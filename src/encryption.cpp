@@ -1,16 +1,22 @@
 #include <iostream>
 #include <fstream>
 #include <sstream>
-#include <regex>
 #include <vector>
 #include <string>
 #include <cstdlib>
 #include <argp.h>
+#include <sys/stat.h>
 
 #include "utils.hpp"
 #include "gsw.hpp"
+#include "ringGsw.hpp"
+#include "keyFile.hpp"
 #include "circuit.hpp"
 #include "cryptoCircuit.hpp"
+#include "paramTuner.hpp"
+#include "server.hpp"
+#include "distributed.hpp"
+#include "pipeline.hpp"
 
 
 using namespace std;
@@ -27,10 +33,27 @@ static char args_doc[] = "";
 static struct argp_option options[] = {
     {"keygen",        'k', "int",     OPTION_ARG_OPTIONAL, "Generate a public and secret key pair. Set optional kappa value. Default 80"},
     {"circuit_depth", 'L', "int",     0,                   "Circuit depth. Required with -k"},
-    {"encrypt",       'e', 0,         0,                   "Encrypt using public key"},
+    {"ring",          'r', 0,         0,                   "Generate Ring-GSW keys. Only with -k"},
+    {"rns",           'M', 0,         0,                   "Pick q as a product of word sized primes and use RNS arithmetic. Only with -k"},
+    {"gadget",        'g', "int",     0,                   "Decompose ciphertexts in base 2^int. Default 1. Only with -k"},
+    {"plaintext",     'P', "int",     0,                   "Encrypt integers mod 2^int rather than bits. Default 1. Only with -k"},
+    {"tune",          'T', "int",     OPTION_ARG_OPTIONAL, "With -k and -c, size parameters from the circuit's own noise growth, failing with probability 2^-int. Default 40"},
+    {"noise",         'N', 0,         0,                   "With -c and -s, report the measured noise of every gate to STDERR"},
+    {"memory",        'm', "MB",      0,                   "With -c, keep at most MB of ciphertexts in memory and spill the rest to $TMPDIR"},
+    {"outputs",       'O', "PATTERN", 0,                   "With -c, evaluate only what the outputs with a 1 in PATTERN need, and write those"},
+    {"compact",       'C', 0,         0,                   "With -c, write only the row of each output that decryption reads, and compute no more of it"},
+    {"batch",         'B', 0,         0,                   "With -c, the input holds any number of input sets one after another, evaluated together"},
+    {"profile",       'R', "FILE",    0,                   "With -c, time every gate, write a Chrome trace to FILE and a summary to STDERR"},
+    {"serve",         'S', "SOCKET",  0,                   "Load the keys once and serve encrypt, NAND, circuit and decrypt jobs on a Unix socket"},
+    {"workers",       'w', "int",     0,                   "Jobs run at once by -S. Default a quarter of the cores"},
+    {"worker",        'W', "PORT",    0,                   "Evaluate parts of distributed circuit jobs sent to a TCP port"},
+    {"distribute",    'D', "HOSTS",   0,                   "With -c, split the circuit over the comma separated host:port workers started with -W"},
+    {"backend",       'b', "NAME",    0,                   "Ciphertext product backend for GSW keys, eigen (default) or reference"},
+    {"encrypt",       'e', 0,         0,                   "Encrypt using the secret key if given, else the public key"},
     {"decrypt",       'd', 0,         0,                   "Decrypt using secret key"},
-    {"nand",          'n', 0,         0,                   "NAND two ciphertexts together"},
+    {"nand",          'n', 0,         0,                   "NAND each consecutive pair of ciphertexts together"},
     {"circuit",       'c', "FILE",    0,                   "A NAND circuit description file"},
+    {"fix",           'f', "PATTERN", 0,                   "With -c, fold public inputs into the circuit first: 0 or 1 fixes an input, x keeps it encrypted"},
     {"public_key",    'p', "FILE",    0,                   "Public key file"},
     {"secret_key",    's', "FILE",    0,                   "Secret key file"},
     {"output",        'o', "FILE",    0,                   "Output to file instead of STDOUT"},
@@ -39,9 +62,9 @@ static struct argp_option options[] = {
 };
 
 struct arguments_t {
-    char *input_file, *output_file, *public_key, *secret_key, *circuit;
-    bool keygen, encrypt, decrypt, nand;
-    int kappa, circuit_depth;
+    char *input_file, *output_file, *public_key, *secret_key, *circuit, *fix, *outputs, *profile, *backend, *socket, *distribute;
+    bool keygen, encrypt, decrypt, nand, ring, rns, noise, batch, compact;
+    int kappa, circuit_depth, gadget, plaintext_bits, tune, memory, workers, port;
 };
 
 static error_t parse_opt(int key, char *arg, struct argp_state *state) {
@@ -50,10 +73,27 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
     switch(key) {
         case 'k': arguments->keygen = true; arguments->kappa = arg ? atoi(arg) : 80; break;
         case 'L': arguments->circuit_depth = atoi(arg); break; 
+        case 'r': arguments->ring = true; break;
+        case 'M': arguments->rns = true; break;
+        case 'g': arguments->gadget = atoi(arg); break;
+        case 'P': arguments->plaintext_bits = atoi(arg); break;
+        case 'b': arguments->backend = arg; break;
+        case 'N': arguments->noise = true; break;
+        case 'm': arguments->memory = atoi(arg); break;
+        case 'O': arguments->outputs = arg; break;
+        case 'B': arguments->batch = true; break;
+        case 'C': arguments->compact = true; break;
+        case 'R': arguments->profile = arg; break;
+        case 'S': arguments->socket = arg; break;
+        case 'w': arguments->workers = atoi(arg); break;
+        case 'W': arguments->port = atoi(arg); break;
+        case 'D': arguments->distribute = arg; break;
+        case 'T': arguments->tune = arg ? atoi(arg) : 40; break;
         case 'e': arguments->encrypt = true; break;
         case 'd': arguments->decrypt = true; break;
         case 'n': arguments->nand = true; break;
         case 'c': arguments->circuit = arg; break;
+        case 'f': arguments->fix = arg; break;
         case 'p': arguments->public_key = arg; break;
         case 's': arguments->secret_key = arg; break;
         case 'o': arguments->output_file = arg; break;
@@ -62,8 +102,8 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
         case ARGP_KEY_END:
             if (arguments->encrypt && arguments->decrypt)
                 argp_error(state, "Cannot both encrypt and decrypt");
-            if (arguments->encrypt && arguments->public_key == NULL)
-                argp_error(state, "Must provide public_key");
+            if (arguments->encrypt && arguments->public_key == NULL && arguments->secret_key == NULL)
+                argp_error(state, "Must provide public_key or secret_key");
             if (arguments->decrypt && arguments->secret_key == NULL)
                 argp_error(state, "Must provide secret_key");
             if (arguments->keygen && (
@@ -71,7 +111,39 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
                         ! arguments->public_key ||
                         ! arguments->secret_key))
                 argp_error(state, "Must provide circuit_depth/circuit, public_key and private_key arguments");
-            if (! (arguments->encrypt || arguments->decrypt || arguments->keygen || arguments->nand || arguments->circuit)) 
+            if ((arguments->ring || arguments->rns || arguments->gadget || arguments->plaintext_bits) && ! arguments->keygen)
+                argp_error(state, "The scheme is picked at key generation, the other modes follow the key");
+            if (arguments->ring && arguments->rns)
+                argp_error(state, "Ring-GSW uses a single word sized quotient already");
+            if (arguments->tune && ! (arguments->keygen && arguments->circuit))
+                argp_error(state, "Tuning needs a circuit to generate keys for");
+            if (arguments->tune && arguments->rns)
+                argp_error(state, "The tuner picks a single prime quotient");
+            if (arguments->noise && ! (arguments->circuit && arguments->secret_key))
+                argp_error(state, "Noise reports need a circuit and the secret key");
+            if (arguments->fix && ! arguments->circuit)
+                argp_error(state, "Fixed inputs belong to a circuit");
+            if (arguments->memory && ! arguments->circuit)
+                argp_error(state, "The memory budget applies to circuit evaluation");
+            if (arguments->outputs && (! arguments->circuit || arguments->keygen || arguments->distribute))
+                argp_error(state, "Outputs are selected for local circuit evaluation");
+            if (arguments->profile && ! arguments->circuit)
+                argp_error(state, "Profiles are of circuit evaluation");
+            if (arguments->compact && (! arguments->circuit || arguments->keygen || arguments->distribute))
+                argp_error(state, "Compact outputs are of local circuit evaluation");
+            if (arguments->batch && (! arguments->circuit || arguments->keygen || arguments->distribute))
+                argp_error(state, "Batches are of local circuit evaluation");
+            if (arguments->batch && (arguments->noise || arguments->memory || arguments->profile))
+                argp_error(state, "Noise reports, memory budgets and profiles are of single runs");
+            if (arguments->socket && ! (arguments->public_key || arguments->secret_key))
+                argp_error(state, "The server needs a public or secret key");
+            if (arguments->port && ! (arguments->public_key || arguments->secret_key))
+                argp_error(state, "Workers take their parameters from a public or secret key");
+            if (arguments->distribute && ! arguments->circuit)
+                argp_error(state, "Only circuits are distributed");
+            if (arguments->distribute && (arguments->noise || arguments->memory || arguments->profile))
+                argp_error(state, "Noise reports, memory budgets and profiles are local to one process");
+            if (! (arguments->encrypt || arguments->decrypt || arguments->keygen || arguments->nand || arguments->circuit || arguments->socket || arguments->port)) 
                 argp_error(state, "Invalid input");
             break;
         default:
@@ -82,188 +154,274 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
 
 static struct argp argp = { options, parse_opt, args_doc, doc };
 
-void write_keys(const arguments_t &arguments, const GSW &gsw) {
-    const char *sk_output = 
-        "-----BEGIN GSW SECRET KEY-----\n"
-        "%i\n" // n
-        "%i\n" // m
-        "%s\n" // q
-        "%s\n" // sk
-        "-----END GSW SECRET KEY-----\n"
-        ;
-    const char *pk_output = 
-        "-----BEGIN GSW PUBLIC KEY-----\n"
-        "%i\n" // n
-        "%i\n" // m
-        "%s\n" // q
-        "%s\n" // pk
-        "-----END GSW PUBLIC KEY-----\n"
-        ;
-    FILE *fpk, *fsk;
-    std::stringstream ssk, spk, q;
+void write_keys(const arguments_t &arguments, const GSWBase &gsw) {
     BIVector sk = gsw.secret_key_gen();
     BIMatrix pk = gsw.public_key_gen(sk);
+    write_key(arguments.secret_key, gsw, sk, true);
+    write_key(arguments.public_key, gsw, pk, false);
+}
 
-    ssk << sk;
-    spk << pk;
-    q << gsw.quotient;
-
-    fsk = fopen(arguments.secret_key, "w");
-    fpk = fopen(arguments.public_key, "w");
-
-    fprintf(fsk, sk_output, gsw.n, gsw.m, q.str().c_str(), ssk.str().c_str());
-    fprintf(fpk, pk_output, gsw.n, gsw.m, q.str().c_str(), spk.str().c_str());
-
-    fclose(fpk);
-    fclose(fsk);
+// Worst case parameters of the constructors, to compare with the tuner's
+void print_bound_params(const arguments_t &arguments, unsigned int gadget, unsigned int plaintext_bits,
+                        unsigned int noise_bits) {
+    try {
+        GSWBase *bound;
+        if (arguments.ring) {
+            bound = new RingGSW(arguments.kappa, arguments.circuit_depth, gadget, plaintext_bits, noise_bits);
+        } else {
+            bound = new GSW(arguments.kappa, arguments.circuit_depth, gadget, false, plaintext_bits, noise_bits);
+        }
+        cerr << "bound: q " << NumBits(bound->quotient) << " bits, n " << bound->n
+             << ", m " << bound->m << ", N " << bound->N << ", "
+             << ParamTuner::product_cost(bound->N, bound->n, arguments.ring)
+             << " multiply-adds per product" << endl;
+        delete bound;
+    } catch (ex &e) {
+        cerr << "bound: " << e.what() << endl;
+    }
 }
 
-BIMatrix read_key(const char* file_path, GSW &gsw) {
-    BIMatrix key;
-    BigInt q;
-    string tmp, skey;
-    unsigned int n, m;
-    std::ifstream file(file_path);
+// The -c circuit, with the inputs -f fixes folded in
+CircuitFile* load_circuit(const arguments_t &arguments) {
+    CircuitFile *file = new CircuitFile(arguments.circuit);
+    if (!arguments.fix) {
+        return file;
+    }
+    Circuit circuit(*file);
+    circuit.specialise(arguments.fix);
+    stringstream text;
+    circuit.output(text);
+    CircuitFile *specialised = new CircuitFile(text);
+    cerr << "Specialised to " << specialised->header.num_gates << " of " << file->header.num_gates
+         << " gates, multiplicative depth " << specialised->header.mult_depth << " of " << file->header.mult_depth << endl;
+    delete file;
+    return specialised;
+}
 
-    if (!file.good()) {
-        throw ex("Key file not found");
+std::istream& open_input(const char* input, std::ifstream& fin) {
+    if (!input) {
+        return std::cin;
     }
+    fin.open(input);
+    return fin;
+}
 
-    std::getline(file, tmp);
-    if (!std::regex_match(tmp, std::regex("-----BEGIN GSW (SECRET|PUBLIC) KEY-----"))) {
-        throw ex("Invalid key file");
+// Input of a stream. Opening the output would truncate an input in the same
+// file before it is read, such an input is read whole into buffer first.
+std::istream& open_stream_input(const char* input, const char* output, std::ifstream& fin,
+                                std::stringstream& buffer) {
+    struct stat in_st, out_st;
+    if (input && output && stat(input, &in_st) == 0 && stat(output, &out_st) == 0
+        && in_st.st_dev == out_st.st_dev && in_st.st_ino == out_st.st_ino) {
+        fin.open(input);
+        buffer << fin.rdbuf();
+        return buffer;
     }
+    return open_input(input, fin);
+}
 
-    file >> n >> m >> q;
+std::ostream& open_output(const char* output, std::ofstream& fout) {
+    if (!output) {
+        return std::cout;
+    }
+    fout.open(output);
+    return fout;
+}
 
-    getline(file, tmp); // flush endline character
-    getline(file, skey);
-    getline(file, tmp);
-    if (!std::regex_match(tmp, std::regex("-----END GSW (SECRET|PUBLIC) KEY-----"))) {
-        throw ex("Invalid key file");
+// One ciphertext of 0 and 1 characters, false at the end of the stream.
+// Compact ones are prefixed with their row and a colon, which only
+// decryption, passing row, accepts.
+bool read_ciphertext(std::istream& fp, BitMatrix& ciphertext, unsigned int *row = NULL) {
+    string val;
+    if (!(fp >> val)) {
+        return false;
+    }
+    size_t start = 0;
+    const size_t colon = val.find(':');
+    if (colon != string::npos) {
+        if (!row) {
+            throw ex("Compact ciphertexts can only be decrypted");
+        }
+        *row = atoi(val.substr(0, colon).c_str());
+        start = colon + 1;
     }
-    file.close();
-
-    // use extracted params
-    gsw.n = n;
-    gsw.n_1 = n + 1;
-    gsw.m = m;
-    gsw.quotient = q;
-    gsw.l = floor(log(q)/log(2)) + 1;
-    gsw.N = (n + 1) * gsw.l;
-
-    stringstream sskey(skey);
-    string key_bit;
-    while(sskey >> key_bit) {
-        key.push_back(NTL::conv<NTL::ZZ>(key_bit.c_str()));
+    ciphertext.assign(val.size() - start, false);
+    for (size_t i = start; i < val.size(); i++) {
+        ciphertext[i - start] = val[i] == '1';
     }
-    return key;
+    return true;
 }
 
-vector<bool> read_plaintexts(const char* input) {
-    vector<bool> plaintexts;
-    std::istream* fp = &std::cin;
-    std::ifstream fin;
-    if (input) {
-        fin.open(input);
-        fp = &fin;
+void write_ciphertext(std::ostream& fp, const BitMatrix& ciphertext, const GSWBase &gsw) {
+    if (ciphertext.size() == gsw.row_bits()) {
+        fp << gsw.output_row() << ":";
     }
-    bool val;
-    while(*fp >> val) {
-        plaintexts.push_back(val);
-    }
-    return plaintexts;
+    fp << ciphertext << "\n";
 }
 
 vector<BitMatrix> read_ciphertexts(const char* input) {
     vector<BitMatrix> ciphertexts;
-    std::istream* fp = &std::cin;
     std::ifstream fin;
-    if (input) {
-        fin.open(input);
-        fp = &fin;
-    }
-    string val;
-    while(*fp >> val) {
-        BitMatrix ciphertext;
-        for (unsigned int i = 0; i < val.size(); i++) {
-            ciphertext.push_back(val[i] == '1');
-        }
-        ciphertexts.push_back(ciphertext);
+    std::istream &fp = open_input(input, fin);
+    BitMatrix ciphertext;
+    while (read_ciphertext(fp, ciphertext)) {
+        ciphertexts.push_back(BitMatrix());
+        ciphertexts.back().swap(ciphertext);
     }
     return ciphertexts;
 }
 
-void write_plaintexts(const char* output, const vector<bool> plaintexts) {
-    std::ostream* fp = &std::cout;
-    std::ofstream fout;
-    if (output) {
-        fout.open(output);
-        fp = &fout;
-    }
-    for(auto it = plaintexts.begin(); it != plaintexts.end(); ++it) {
-        *fp << *it << "\n";
+// Moves the ciphertexts into handles the gates of a circuit share
+vector<Ciphertext> share_ciphertexts(vector<BitMatrix>& ciphertexts) {
+    vector<Ciphertext> shared;
+    for (auto &c : ciphertexts) {
+        shared.push_back(Ciphertext(std::move(c)));
     }
+    ciphertexts.clear();
+    return shared;
 }
 
-void write_ciphertexts(const char* output, const vector<BitMatrix> ciphertexts) {
-    std::ostream* fp = &std::cout;
+void write_ciphertexts(const char* output, const vector<BitMatrix>& ciphertexts, const GSWBase &gsw) {
     std::ofstream fout;
-    if (output) {
-        fout.open(output);
-        fp = &fout;
-    }
+    std::ostream &fp = open_output(output, fout);
     for(auto it = ciphertexts.begin(); it != ciphertexts.end(); ++it) {
-        *fp << *it << "\n";
+        write_ciphertext(fp, *it, gsw);
     }
 }
 
-vector<BitMatrix> encrypt_plaintexts(const vector<bool> plaintexts, const BIVector key, const GSW &gsw) {
-    BigInt val;
-    vector<BitMatrix> ciphertexts;
-    for (auto it = plaintexts.begin(); it != plaintexts.end(); ++it) {
-        val = *it;
-        BitMatrix ciphertext = gsw.encrypt(key, val);
-        ciphertexts.push_back(ciphertext);
+// -O, a 1 for every output wanted
+void select_outputs(CryptoCircuit& circuit, const char* pattern) {
+    if (!pattern) {
+        return;
     }
-    return ciphertexts;
+    vector<bool> wanted;
+    for (const char *c = pattern; *c; c++) {
+        if (*c != '0' && *c != '1') {
+            throw ex("Output patterns can only have 0 or 1");
+        }
+        wanted.push_back(*c == '1');
+    }
+    circuit.select_outputs(wanted);
 }
 
-vector<bool> decrypt_ciphertexts(const vector<BitMatrix> ciphertexts, const BIVector key, const GSW &gsw) {
-    BitMatrix val;
-    vector<bool> plaintexts;
-    for (auto it = ciphertexts.begin(); it != ciphertexts.end(); ++it) {
-        val = *it;
-        bool plaintext = gsw.decrypt_bit(key, val);
-        plaintexts.push_back(plaintext);
-    }
-    return plaintexts;
+// The -e, -d and -n modes stream: reading, the scheme and writing run
+// concurrently, and only a few values are in flight whatever the input size.
+
+// Bits, or integers for keys with more plaintext bits. A secret key skips
+// the public key product.
+void encrypt_stream(const char* input, const char* output, const BIVector& key, bool secret, const GSWBase &gsw) {
+    std::ifstream fin;
+    std::ofstream fout;
+    std::stringstream buffer;
+    std::istream &in = open_stream_input(input, output, fin, buffer);
+    std::ostream &out = open_output(output, fout);
+    pipeline<uint64_t, BitMatrix>(
+        [&in](uint64_t& plaintext) { return (bool) (in >> plaintext); },
+        [&key, secret, &gsw](uint64_t& plaintext, BitMatrix& ciphertext) {
+            BigInt val;
+            val = (long) (plaintext & ((1ull << gsw.plaintext_bits) - 1));
+            ciphertext = secret ? gsw.encrypt_secret(key, val) : gsw.encrypt(key, val);
+        },
+        [&out](BitMatrix& ciphertext) { out << ciphertext << "\n"; });
+}
+
+void decrypt_stream(const char* input, const char* output, const BIVector& key, const GSWBase &gsw) {
+    std::ifstream fin;
+    std::ofstream fout;
+    std::stringstream buffer;
+    std::istream &in = open_stream_input(input, output, fin, buffer);
+    std::ostream &out = open_output(output, fout);
+    pipeline<BitMatrix, uint64_t>(
+        [&in, &gsw](BitMatrix& ciphertext) {
+            unsigned int row = gsw.output_row();
+            if (!read_ciphertext(in, ciphertext, &row)) {
+                return false;
+            }
+            if (row != gsw.output_row()) {
+                throw ex("Compact ciphertext of a row the key does not decrypt");
+            }
+            return true;
+        },
+        [&key, &gsw](BitMatrix& ciphertext, uint64_t& plaintext) {
+            plaintext = gsw.plaintext_bits > 1 ? gsw.decrypt_int(key, ciphertext) : gsw.decrypt_bit(key, ciphertext);
+        },
+        [&out](uint64_t& plaintext) { out << plaintext << "\n"; });
 }
 
-vector<BitMatrix> nand_ciphertexts(vector<BitMatrix> ciphertexts, const GSW &gsw) {
-    vector<BitMatrix> res;
-    res.push_back(gsw.nand(ciphertexts[0], ciphertexts[1]));
-    return res;
+// NANDs consecutive pairs
+void nand_stream(const char* input, const char* output, const GSWBase &gsw) {
+    std::ifstream fin;
+    std::ofstream fout;
+    std::stringstream buffer;
+    std::istream &in = open_stream_input(input, output, fin, buffer);
+    std::ostream &out = open_output(output, fout);
+    pipeline<pair<BitMatrix, BitMatrix>, BitMatrix>(
+        [&in](pair<BitMatrix, BitMatrix>& pair) {
+            if (!read_ciphertext(in, pair.first)) {
+                return false;
+            }
+            if (!read_ciphertext(in, pair.second)) {
+                throw ex("NAND takes pairs of ciphertexts");
+            }
+            return true;
+        },
+        [&gsw](pair<BitMatrix, BitMatrix>& pair, BitMatrix& result) { result = gsw.nand(pair.first, pair.second); },
+        [&out](BitMatrix& result) { out << result << "\n"; });
 }
 
 int main(int argc, char **argv) {
     arguments_t arguments = {0};
     BIMatrix key;
-    vector<bool> plaintexts;
     vector<BitMatrix> ciphertexts;
 
     argp_parse(&argp, argc, argv, 0, 0, &arguments);
 
     utils_init();
 
-
+    CircuitFile *circuit_file = arguments.circuit ? load_circuit(arguments) : NULL;
     if(!arguments.circuit_depth && arguments.circuit) {
-    	Circuit circuit(arguments.circuit);
-    	circuit.nand_recode();
-    	arguments.circuit_depth = circuit.depth();
+    	// Depths come from the compiled header or a single parsing pass,
+    	// RNS keys evaluate XOR through NANDs
+    	const CircuitFile &circuit = *circuit_file;
+    	const uint64_t depth = arguments.rns ? circuit.header.nand_depth : circuit.header.mult_depth;
+    	// A lone addition still needs some noise room, which one product's
+    	// worth easily covers
+    	arguments.circuit_depth = max<uint64_t>(depth, 1);
     }
 
-    GSW gsw = GSW(arguments.kappa, arguments.circuit_depth);
+    // Keygen picks the scheme, everything else follows the key it is given
+    const char *key_file = arguments.secret_key ? arguments.secret_key : arguments.public_key;
+    const unsigned int gadget = arguments.gadget ? arguments.gadget : 1;
+    const unsigned int plaintext_bits = arguments.plaintext_bits ? arguments.plaintext_bits : 1;
+    // ADD and CMUL gates grow noise without adding to the depth
+    const unsigned int noise_bits = arguments.keygen && circuit_file ? circuit_file->integer_noise_bits() : 0;
+    GSWBase *gsw;
+    if (arguments.keygen && arguments.tune) {
+        ParamTuner tuner(*circuit_file, arguments.kappa, gadget, arguments.ring, arguments.tune, plaintext_bits);
+        tuner.print(cerr);
+        print_bound_params(arguments, gadget, plaintext_bits, noise_bits);
+
+        if (arguments.ring) {
+            gsw = new RingGSW();
+        } else {
+            gsw = new GSW();
+        }
+        gsw->set_params(tuner.n, tuner.m, tuner.q, gadget);
+        gsw->set_plaintext_bits(plaintext_bits);
+    } else if (arguments.keygen && arguments.ring) {
+        gsw = new RingGSW(arguments.kappa, arguments.circuit_depth, gadget, plaintext_bits, noise_bits);
+    } else if (!arguments.keygen && key_file && read_key_scheme(key_file) == "RGSW") {
+        gsw = new RingGSW();
+    } else {
+        gsw = new GSW(arguments.kappa, arguments.circuit_depth, gadget, arguments.rns, plaintext_bits, noise_bits);
+    }
+    if (arguments.backend) {
+        GSW *plain_gsw = dynamic_cast<GSW*>(gsw);
+        if (!plain_gsw) {
+            throw ex("Matrix product backends only apply to GSW keys");
+        }
+        plain_gsw->set_backend(arguments.backend);
+    }
 
 //    BigInt message;
 //    message = 6;
@@ -284,42 +442,124 @@ int main(int argc, char **argv) {
 
 
     if (arguments.keygen) {
-        write_keys(arguments, gsw);
+        write_keys(arguments, *gsw);
+        delete circuit_file;
+        delete gsw;
+        return 0;
+    }
+
+    if (arguments.socket) {
+        BIMatrix public_key;
+        BIVector secret_key;
+        if (arguments.public_key) {
+            public_key = read_key(arguments.public_key, *gsw);
+        }
+        if (arguments.secret_key) {
+            secret_key = read_key(arguments.secret_key, *gsw);
+        }
+        Server server(*gsw, public_key, secret_key, arguments.workers);
+        server.run(arguments.socket);
+        delete gsw;
+        return 0;
+    }
+
+    if (arguments.port) {
+        read_key(key_file, *gsw);
+        DistWorker worker(*gsw);
+        worker.run(arguments.port);
+        delete gsw;
         return 0;
     }
 
     if (arguments.secret_key) {
-        key = read_key(arguments.secret_key, gsw);
+        key = read_key(arguments.secret_key, *gsw);
     }
     else if (arguments.public_key) {
-        key = read_key(arguments.public_key, gsw);
+        key = read_key(arguments.public_key, *gsw);
     }
 
     if (arguments.encrypt) {
-        plaintexts = read_plaintexts(arguments.input_file);
-        ciphertexts = encrypt_plaintexts(plaintexts, key, gsw);
-        write_ciphertexts(arguments.output_file, ciphertexts);
+        encrypt_stream(arguments.input_file, arguments.output_file, key, arguments.secret_key, *gsw);
     } 
     else if (arguments.decrypt) {
-        ciphertexts = read_ciphertexts(arguments.input_file);
-        plaintexts = decrypt_ciphertexts(ciphertexts, key, gsw);
-        write_plaintexts(arguments.output_file, plaintexts);
+        decrypt_stream(arguments.input_file, arguments.output_file, key, *gsw);
     } 
     else if (arguments.nand) {
+        nand_stream(arguments.input_file, arguments.output_file, *gsw);
+    } else if (arguments.circuit && arguments.distribute) {
+        vector<string> workers;
+        stringstream hosts(arguments.distribute);
+        string host;
+        while (getline(hosts, host, ',')) {
+            workers.push_back(host);
+        }
+        DistCoordinator coordinator(workers);
         ciphertexts = read_ciphertexts(arguments.input_file);
-        ciphertexts = nand_ciphertexts(ciphertexts, gsw);
-        write_ciphertexts(arguments.output_file, ciphertexts);
-    } else if (arguments.circuit) {
-        CryptoCircuit circuit(arguments.circuit);
+        ciphertexts = coordinator.eval(*circuit_file, ciphertexts, *gsw);
+        coordinator.print(cerr);
+        write_ciphertexts(arguments.output_file, ciphertexts, *gsw);
+    } else if (arguments.circuit && arguments.batch) {
+        CryptoCircuit circuit(*circuit_file);
+        select_outputs(circuit, arguments.outputs);
+        circuit.compact = arguments.compact;
         ciphertexts = read_ciphertexts(arguments.input_file);
-        circuit.eval(ciphertexts, gsw);
+        const size_t width = circuit.inputs.size();
+        if (width == 0 || ciphertexts.size() % width) {
+            throw ex("A batch takes whole input sets of the circuit");
+        }
+        vector<vector<Ciphertext> > sets(ciphertexts.size() / width, vector<Ciphertext>(width));
+        for (size_t i = 0; i < ciphertexts.size(); i++) {
+            sets[i / width][i % width] = Ciphertext(std::move(ciphertexts[i]));
+        }
         ciphertexts.clear();
-        for (auto g : circuit.outputs) {
-            ciphertexts.push_back(g->val);
+        std::ofstream fout;
+        std::ostream &out = open_output(arguments.output_file, fout);
+        for (auto &outputs : circuit.eval_batch(sets, *gsw)) {
+            for (auto &c : outputs) {
+                write_ciphertext(out, *c, *gsw);
+            }
+        }
+    } else if (arguments.circuit) {
+        CryptoCircuit circuit(*circuit_file);
+        select_outputs(circuit, arguments.outputs);
+        circuit.compact = arguments.compact;
+        ciphertexts = read_ciphertexts(arguments.input_file);
+        vector<Ciphertext> inputs = share_ciphertexts(ciphertexts);
+        if (arguments.noise && gsw->plaintext_bits > 1) {
+            throw ex("Noise reports measure against bit decryption");
+        }
+        NoiseReport *report = arguments.noise ? new NoiseReport(key, *gsw) : NULL;
+        SpillStore *spill = arguments.memory ? new SpillStore((uint64_t) arguments.memory << 20) : NULL;
+        CircuitProfile *profile = arguments.profile ? new CircuitProfile() : NULL;
+        // outputs are written as soon as they and those before them are done
+        std::ofstream fout;
+        std::ostream &out = open_output(arguments.output_file, fout);
+        OrderedWriter<Ciphertext> writer([&out, gsw](const Ciphertext& ciphertext) { write_ciphertext(out, *ciphertext, *gsw); });
+        circuit.output_ready = [&writer](uint64_t index, const Ciphertext& ciphertext) {
+            // the writer shares the gate's ciphertext until it is written
+            Ciphertext shared(ciphertext);
+            writer.push(index, std::move(shared));
+        };
+        circuit.eval(inputs, *gsw, report, spill, profile);
+        writer.finish();
+        if (report) {
+            report->print(cerr);
+            delete report;
+        }
+        if (spill) {
+            spill->print(cerr);
+            delete spill;
+        }
+        if (profile) {
+            profile->print(cerr);
+            ofstream trace(arguments.profile);
+            profile->write_trace(trace);
+            delete profile;
         }
-        write_ciphertexts(arguments.output_file, ciphertexts);
     }
 
+    delete circuit_file;
+    delete gsw;
 
     return 0;
 }
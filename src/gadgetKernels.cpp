@@ -0,0 +1,162 @@
+#include "gadgetKernels.hpp"
+
+using namespace std;
+
+namespace {
+
+// Entries go in blocks of 64 through a word buffer on the stack. The bits of
+// a block fill whole words of the vector<bool>, so blocks can go to
+// different threads.
+const size_t BLOCK = 64;
+
+template <unsigned int LK>
+inline void put_block(const uint64_t *x, size_t count, BitMatrix::iterator out) {
+    for (size_t i = 0; i < count; i++) {
+        for (unsigned int b = 0; b < LK; b++) {
+            *out++ = (x[i] >> b) & 1;
+        }
+    }
+}
+
+template <unsigned int K, unsigned int L>
+void flatten(const vector<int64_t>& a, uint64_t q, BitMatrix& result) {
+    static_assert(K * L <= 64, "decomposed entries have to fit a word");
+    const size_t entries = a.size() / L;
+    const size_t blocks = (entries + BLOCK - 1) / BLOCK;
+
+    result.resize(entries * L * K);
+# pragma omp parallel for shared (a, result) schedule(static)
+    for (size_t block = 0; block < blocks; block++) {
+        alignas(64) uint64_t x[BLOCK];
+        const size_t first = block * BLOCK;
+        const size_t count = min(BLOCK, entries - first);
+        for (size_t i = 0; i < count; i++) {
+            const int64_t *d = &a[(first + i)*L];
+            __int128 sum = 0;
+            for (unsigned int j = 0; j < L; j++) {
+                sum += (__int128) d[j] << (K*j);
+            }
+            sum %= (__int128) q;
+            x[i] = sum < 0 ? (uint64_t) (sum + q) : (uint64_t) sum;
+        }
+        put_block<K * L>(x, count, result.begin() + first * L * K);
+    }
+}
+
+template <unsigned int LK>
+void bit_decomp(const BIVector& a, BitMatrix& result) {
+    const size_t blocks = (a.size() + BLOCK - 1) / BLOCK;
+
+    result.resize(a.size() * LK);
+# pragma omp parallel for shared (a, result) schedule(static)
+    for (size_t block = 0; block < blocks; block++) {
+        alignas(64) uint64_t x[BLOCK];
+        const size_t first = block * BLOCK;
+        const size_t count = min(BLOCK, a.size() - first);
+        for (size_t i = 0; i < count; i++) {
+            x[i] = to_long(a[first + i]);
+        }
+        put_block<LK>(x, count, result.begin() + first * LK);
+    }
+}
+
+template <unsigned int LK>
+void inverse_bit_decomp(const BitMatrix& a, uint64_t q, BIVector& result) {
+    result.resize(a.size() / LK);
+    const size_t blocks = (result.size() + BLOCK - 1) / BLOCK;
+
+# pragma omp parallel for shared (a, result) schedule(static)
+    for (size_t block = 0; block < blocks; block++) {
+        alignas(64) uint64_t x[BLOCK];
+        const size_t first = block * BLOCK;
+        const size_t count = min(BLOCK, result.size() - first);
+        BitMatrix::const_iterator in = a.begin() + first * LK;
+        for (size_t i = 0; i < count; i++) {
+            uint64_t v = 0;
+            for (unsigned int b = 0; b < LK; b++) {
+                v |= (uint64_t) *in++ << b;
+            }
+            x[i] = v % q;
+        }
+        for (size_t i = 0; i < count; i++) {
+            result[first + i] = (long) x[i];
+        }
+    }
+}
+
+template <unsigned int K>
+void digits(const BitMatrix& a, vector<uint16_t>& result) {
+    result.resize(a.size() / K);
+    BitMatrix::const_iterator in = a.begin();
+    for (size_t i = 0; i < result.size(); i++) {
+        uint16_t d = 0;
+        for (unsigned int b = 0; b < K; b++) {
+            d |= *in++ << b;
+        }
+        result[i] = d;
+    }
+}
+
+// The kernel of every digit count from L down to 1, so that no word sized
+// quotient the parameter search may pick is left out
+template <unsigned int K, unsigned int L>
+struct FlattenKernels {
+    static FlattenKernel get(unsigned int l) {
+        return l == L ? &flatten<K, L> : FlattenKernels<K, L - 1>::get(l);
+    }
+};
+
+template <unsigned int K>
+struct FlattenKernels<K, 0> {
+    static FlattenKernel get(unsigned int) { return NULL; }
+};
+
+// Decomposition only depends on the bits per entry, l * k
+template <unsigned int LK>
+struct BitDecompKernels {
+    static BitDecompKernel bit_decomp(unsigned int lk) {
+        return lk == LK ? &::bit_decomp<LK> : BitDecompKernels<LK - 1>::bit_decomp(lk);
+    }
+    static InverseBitDecompKernel inverse_bit_decomp(unsigned int lk) {
+        return lk == LK ? &::inverse_bit_decomp<LK> : BitDecompKernels<LK - 1>::inverse_bit_decomp(lk);
+    }
+};
+
+template <>
+struct BitDecompKernels<0> {
+    static BitDecompKernel bit_decomp(unsigned int) { return NULL; }
+    static InverseBitDecompKernel inverse_bit_decomp(unsigned int) { return NULL; }
+};
+
+bool preset_gadget(unsigned int k, unsigned int l) {
+    return (k == 1 || k == 2 || k == 4) && l * k <= 64;
+}
+
+}
+
+FlattenKernel flatten_kernel(unsigned int k, unsigned int l) {
+    // a quotient below 2^62 has l <= ceil(62 / k)
+    switch (k) {
+        case 1: return FlattenKernels<1, 62>::get(l);
+        case 2: return FlattenKernels<2, 31>::get(l);
+        case 4: return FlattenKernels<4, 16>::get(l);
+        default: return NULL;
+    }
+}
+
+BitDecompKernel bit_decomp_kernel(unsigned int k, unsigned int l) {
+    return preset_gadget(k, l) ? BitDecompKernels<64>::bit_decomp(l * k) : NULL;
+}
+
+InverseBitDecompKernel inverse_bit_decomp_kernel(unsigned int k, unsigned int l) {
+    return preset_gadget(k, l) ? BitDecompKernels<64>::inverse_bit_decomp(l * k) : NULL;
+}
+
+DigitsKernel digits_kernel(unsigned int k) {
+    switch (k) {
+        case 1: return &digits<1>;
+        case 2: return &digits<2>;
+        case 4: return &digits<4>;
+        default: return NULL;
+    }
+}
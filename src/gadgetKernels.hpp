@@ -0,0 +1,29 @@
+/* Gadget decomposition loops specialised at compile time for the gadgets
+ * 2, 4 and 16 with a word sized quotient
+ */
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "utils.hpp"
+
+// Flattens a matrix of small integers, l base 2^k digits per entry, for a
+// quotient below 2^62: every entry is recomposed mod q in a machine word
+// and decomposed again to l * k bits, with k and l template constants.
+typedef void (*FlattenKernel)(const std::vector<int64_t>& digits, uint64_t q, BitMatrix& result);
+// Decomposes entries reduced mod q to l * k bits each
+typedef void (*BitDecompKernel)(const BIVector&, BitMatrix& result);
+// Recomposes every l * k bits to an entry mod q
+typedef void (*InverseBitDecompKernel)(const BitMatrix&, uint64_t q, BIVector& result);
+// Unpacks the base 2^k digits of a flattened matrix
+typedef void (*DigitsKernel)(const BitMatrix&, std::vector<uint16_t>& result);
+
+// NULL when k is not a preset or l * k exceeds a word, the caller keeps its
+// generic path. The presets are keyed on the gadget alone: n only sets how
+// many entries a matrix has, no loop over the bits of an entry depends on
+// it, so one kernel per (k, l) serves every n.
+FlattenKernel flatten_kernel(unsigned int k, unsigned int l);
+BitDecompKernel bit_decomp_kernel(unsigned int k, unsigned int l);
+InverseBitDecompKernel inverse_bit_decomp_kernel(unsigned int k, unsigned int l);
+DigitsKernel digits_kernel(unsigned int k);
@@ -46,17 +46,20 @@ GaussSampler::GaussSampler(long double sigma)
     }
 }
 
-// sample from the distribution with binary search
+// sample from the distribution with binary search, the table only
+// covers x >= 0 (with half the weight at 0) so the sign is drawn apart
 
 int32_t GaussSampler::sample()
 {
     int a;
     uint64_t x;
+    uint8_t sign;
 
     cymric_random(&rng, &x, 8);
     a = binsearch(x, cdf, GAUSS_CDF_SIZE, GAUSS_CDF_STEP);
+    cymric_random(&rng, &sign, 1);
 
-    return a;
+    return (sign & 1) ? -a : a;
 }
 
 
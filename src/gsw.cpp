@@ -12,34 +12,63 @@
 using namespace std;
 using namespace NTL;
 
-GSW::GSW() {
-    GSW(80, 1);
-}
+GSW::GSW() : GSW(80, 1) { }
 
-GSW::GSW(const int kappa, const int L) {
+GSW::GSW(const int kappa, const int L, const unsigned int k, const bool use_rns, const unsigned int plaintext_bits,
+         const unsigned int noise_bits)
+    : rns(NULL), backend(new EigenBackend()), flatten_preset(NULL), bit_decomp_preset(NULL),
+      inverse_bit_decomp_preset(NULL), digits_preset(NULL) {
     // Search for suitable parameters:
-    // n >= log(q/sigma)(k+110)/7.2
-    // q/sigma6 > 8(N + 1)^L
-    BigInt lower_bound;
+    // n >= log(q/sigma)(kappa+110)/7.2
+    // q/sigma6 > 8((B - 1)N + 1)^L, B = 2^k
+    // A product multiplies noise by at most (B - 1)N + 1, an addition only
+    // adds it up. Decryption reads the parity of the message off the row
+    // with gadget entry B^j, so q is the next prime after 2B^j, which
+    // makes 2B^j = -(q - 2B^j) small mod q.
+    // With use_rns, q is the product of the fewest word sized primes
+    // exceeding the bound rather than the next prime. Its decryption row
+    // can then be as low as q/2B, which costs another B/2 factor.
+    // Integer messages of p bits are read off a row 2^(p - 1) times lower,
+    // see message_row, so they need as much more room, and the noise_bits
+    // that additions and scalar products grow noise by outside of products.
+    if (k < 1 || k > 16) {
+        throw ex("GSW: gadget base must be 2^k with 1 <= k <= 16");
+    }
+    if (use_rns && plaintext_bits > 1) {
+        throw ex("GSW: RNS keys only encrypt bits");
+    }
+    BigInt lower_bound, g;
+    this->k = k;
     n = (kappa+110)/7.2;
     quotient = 4;
-    l = floor(log(quotient)/log(2)) + 1;
+    l = (NumBits(quotient) + k - 1) / k;
     N = (n + 1) * l;
     while (true) {
-        power(lower_bound, N+1,L);
+        power(lower_bound, ((1 << k) - 1) * N + 1, L);
         lower_bound *= 8 * sigma6;
+        lower_bound <<= plaintext_bits - 1 + noise_bits;
         if (quotient <= lower_bound) {
-            NextPrime(quotient, lower_bound);
+            if (use_rns) {
+                quotient = RNS(RNS::basis_for(lower_bound << (k - 1))).modulus;
+            } else {
+                // smallest power of B with 2B^j > lower_bound
+                g = 1;
+                while (2 * g <= lower_bound) {
+                    g <<= k;
+                }
+                NextPrime(quotient, 2 * g);
+            }
         } else {
             break;
         }
         n = log(quotient/ceil(sigma))*(kappa+110)/(7.2*log(2));
-        l = floor(log(quotient)/log(2)) + 1;
+        l = (NumBits(quotient) + k - 1) / k;
         N = (n + 1) * l;
     }
 
-    n_1 = n+1;
     m = ceil(n * log(quotient)/log(2));
+    set_params(n, m, quotient, k);
+    set_plaintext_bits(plaintext_bits);
 
     gaussSampler = new GaussSampler(sigma);
 
@@ -48,6 +77,50 @@ GSW::GSW(const int kappa, const int L) {
 
 GSW::~GSW() {
     delete gaussSampler;
+    delete rns;
+    delete backend;
+}
+
+void GSW::set_backend(const string& name) {
+    MatrixBackend *b = MatrixBackend::create(name);
+    delete backend;
+    backend = b;
+    pick_presets();
+}
+
+void GSW::pick_presets() {
+    // the reference backend keeps the generic loops as well, so comparing
+    // it against another backend covers the presets too
+    const bool reference = backend->name() == "reference";
+    const bool word = !reference && !rns && NumBits(quotient) <= 62;
+    flatten_preset = word ? flatten_kernel(k, l) : NULL;
+    bit_decomp_preset = word ? bit_decomp_kernel(k, l) : NULL;
+    inverse_bit_decomp_preset = word ? inverse_bit_decomp_kernel(k, l) : NULL;
+    digits_preset = reference ? NULL : digits_kernel(k);
+}
+
+string GSW::name() const {
+    return "GSW";
+}
+
+uint64_t GSW::ciphertext_bits() const {
+    return (uint64_t) N * N * k;
+}
+
+void GSW::set_params(unsigned int n, unsigned int m, const BigInt& q, unsigned int k) {
+    this->n = n;
+    this->n_1 = n + 1;
+    this->m = m;
+    this->k = k;
+    quotient = q;
+    l = (NumBits(q) + k - 1) / k;
+    N = (n + 1) * l;
+
+    delete rns;
+    vector<uint64_t> basis = RNS::basis_of(q);
+    rns = basis.empty() ? NULL : new RNS(basis);
+
+    pick_presets();
 }
 
 
@@ -62,6 +135,10 @@ BIVector GSW::secret_key_gen() const {
 }
 
 BIMatrix GSW::public_key_gen(const BIVector& sk) const {
+    if (rns) {
+        return rns_public_key_gen(sk);
+    }
+
     // recovering t from sk, defined as t = (-s_2,...,-s_n) in Z_q
     BIVector t(n);
     for (unsigned int i = 0; i < n; i++) {
@@ -87,6 +164,7 @@ BIMatrix GSW::public_key_gen(const BIVector& sk) const {
         int bit = gaussSampler->sample() % sigma6;
         //e[i] = bit;
         b[i] += bit;
+        if (b[i] < 0) b[i] += quotient;
     }
 
     // Observe that pk * sk = e
@@ -122,47 +200,72 @@ BitMatrix GSW::encrypt(const BIMatrix& public_key, const BigInt& message) const
     for (size_t i = 0; i < R.size(); i++) {
         R[i] = bernoulli(generator);
     }
-    BIMatrix RA(N * n_1);
-    BigInt temp;
+    BIMatrix RA;
+    if (rns) {
+        RA = rns_encrypt_RA(R, public_key);
+    } else {
+        RA.resize(N * n_1);
 # pragma omp parallel for shared (R, public_key, RA) schedule(guided)
-    for (unsigned int i = 0; i < N; i++) { 
-        if (omp_get_thread_num() == 0)
-            cerr << "Calc RA matrix " << i << " out of " << N << "\r";
-        for (unsigned int j = 0; j < n_1; j++) {
-            RA[i*n_1 + j] = 0;
-            for (unsigned int k = 0; k < m; k++) {
-                MulMod(temp, R[i*m + k], public_key[k*n_1 + j], quotient);
-                AddMod(RA[i*n_1 + j], RA[i*n_1 + j], temp, quotient);
-                //RA[i*n_1 + j] += R[i*m + k] * public_key[k*n_1 + j];
-                //RA[i*n_1 + j] = RA[i*n_1 + j] % quotient;
+        for (unsigned int i = 0; i < N; i++) { 
+            if (omp_get_thread_num() == 0)
+                cerr << "Calc RA matrix " << i << " out of " << N << "\r";
+            BigInt temp;
+            for (unsigned int j = 0; j < n_1; j++) {
+                RA[i*n_1 + j] = 0;
+                for (unsigned int k = 0; k < m; k++) {
+                    MulMod(temp, R[i*m + k], public_key[k*n_1 + j], quotient);
+                    AddMod(RA[i*n_1 + j], RA[i*n_1 + j], temp, quotient);
+                    //RA[i*n_1 + j] += R[i*m + k] * public_key[k*n_1 + j];
+                    //RA[i*n_1 + j] = RA[i*n_1 + j] % quotient;
+                }
             }
         }
+        cerr << endl;
     }
-    cerr << endl;
-    const BitMatrix RAbits = bit_decomp(RA);
-    BIMatrix C(N * N);
-# pragma omp parallel for shared (C, message) schedule(guided)
+
+    return add_message(RA, message);
+}
+
+BitMatrix GSW::encrypt_secret(const BIVector& sk, const BigInt& message) const {
+    // N fresh samples (b, a) with b + <a, s> = e, where the rows of R * A
+    // are sums of m public key ones, so the noise is smaller as well
+    BIMatrix C(N * n_1);
+    BigInt as, temp;
     for (unsigned int i = 0; i < N; i++) {
-        if (omp_get_thread_num() == 0)
-            cerr << "Calc ciphertext matrix " << i << " out of " << N << "\r";
-        for (unsigned int j = 0; j < N; j++) {
-            C[i*N + j] = RAbits[i*N + j];
-            // message * identity 
-            if (i == j) {
-                C[i*N + j] += message;
-            }
-            //C[i*N + j] = C[i*N + j] % quotient;
+        as = 0;
+        for (unsigned int j = 1; j < n_1; j++) {
+            C[i*n_1 + j] = RandomBnd(quotient);
+            MulMod(temp, C[i*n_1 + j], sk[j], quotient);
+            AddMod(as, as, temp, quotient);
         }
+        int e = gaussSampler->sample() % sigma6;
+        BigInt &b = C[i*n_1];
+        b = quotient - as + e;
+        if (b < 0) b += quotient;
+        if (b >= quotient) b -= quotient;
     }
 
-    cerr << endl << "Now to flatten" << endl;
+    return add_message(C, message);
+}
+
+BitMatrix GSW::add_message(BIMatrix& C, const BigInt& message) const {
+    // flatten(message * identity + BitDecomp(C)) = BitDecomp(C + message * G)
+    // where row i of G holds B^(i % l) in column i / l
+    BigInt temp;
+    for (unsigned int i = 0; i < N; i++) {
+        MulMod(temp, message, power2_ZZ(k * (i % l)), quotient);
+        AddMod(C[i*n_1 + i/l], C[i*n_1 + i/l], temp, quotient);
+    }
 
-    return flatten(C);
+    return bit_decomp(C);
 }
 
 BigInt GSW::decrypt(const BIVector& sk, const BitMatrix& C) const {
+    if (k != 1) {
+        throw ex("GSW: multi bit decryption needs a base 2 gadget");
+    }
     BigInt m, it, fract;
-    const auto v = powers_of_2(sk);
+    const auto v = powers_of_base(sk);
     BIVector powered_m_bits(l-1);
     for (unsigned int i = 0; i < l-1; i++) {
         powered_m_bits[i] = 0;
@@ -184,62 +287,154 @@ BigInt GSW::decrypt(const BIVector& sk, const BitMatrix& C) const {
 }
 
 bool GSW::decrypt_bit(const BIVector& sk, const BitMatrix& C) const {
-    unsigned int i;
-    const auto v = powers_of_2(sk);
-    BigInt q_4, q_2; q_4 = quotient/4; q_2 = quotient/2;
-    
-    for(i = 0; i < l; i++) {
-        if(v[i] > q_4 && v[i] <= q_2) break;
-    }
+    return decode_bit(phase(sk, C, row_index(C, decryption_row())), power2_ZZ(k*decryption_row()));
+}
 
-    BigInt xi, temp;
-    xi = 0;
-    for (unsigned int j = 0; j < N; j++) {
-        MulMod(temp, C[i*N + j], v[j], quotient);
-        AddMod(xi, xi, temp, quotient);
-        //xi += (C[i*N + j] * v[j]);
-        //xi = xi % quotient;
+BigInt GSW::noise(const BIVector& sk, const BitMatrix& C) const {
+    const BigInt xi = phase(sk, C, row_index(C, decryption_row())), v = power2_ZZ(k*decryption_row());
+    BigInt dist_0, dist_v;
+    dist_0 = xi < quotient - xi ? xi : quotient - xi;
+    dist_v = xi > v ? xi - v : v - xi;
+    if (quotient - dist_v < dist_v) {
+        dist_v = quotient - dist_v;
     }
-
-    return xi >= v[i]/2; 
+    return dist_0 < dist_v ? dist_0 : dist_v;
 }
 
 BitMatrix GSW::nand(const BitMatrix& a, const BitMatrix& b) const {
-    BIMatrix res(a.size());
+    const vector<int64_t> AB = product(a, b);
 
+    // identity - A * B, flattened
+    vector<int64_t> res((size_t) N * N);
+# pragma omp parallel for shared (AB, res) schedule(static)
     for (unsigned int i = 0; i < N; i++) {
-        res[i*N + i] = 1;
+        for (unsigned int j = 0; j < N; j++) {
+            res[(size_t) i*N + j] = (i == j) - AB[(size_t) i*N + j];
+        }
     }
 
-    BigInt temp;
-# pragma omp parallel for shared (a, b, res) schedule(guided)
+    return flatten(res);
+}
+
+BitMatrix GSW::add(const BitMatrix& a, const BitMatrix& b) const {
+    // Parity decoding needs q close to twice the decryption row entry,
+    // which an RNS quotient is not, so go through NANDs there
+    if (rns) {
+        const BitMatrix t = nand(a, b);
+        return nand(nand(a, t), nand(b, t));
+    }
+
+    // A + B, flattened
+    const vector<uint16_t> A = digits(a), B = digits(b);
+    vector<int64_t> res(A.size());
+# pragma omp parallel for shared (A, B, res) schedule(static)
+    for (size_t i = 0; i < A.size(); i++) {
+        res[i] = A[i] + B[i];
+    }
+
+    return flatten(res);
+}
+
+BitMatrix GSW::negate(const BitMatrix& a) const {
+    const vector<uint16_t> A = digits(a);
+
+    // identity - A, flattened
+    vector<int64_t> res((size_t) N * N);
+# pragma omp parallel for shared (A, res) schedule(static)
     for (unsigned int i = 0; i < N; i++) {
-        if (omp_get_thread_num() == 0)
-            cerr << "Performing a NAND, hold on " << i << " out of " << N << "\r";
         for (unsigned int j = 0; j < N; j++) {
-            for (unsigned int k = 0; k < N; k++) {
-                res[i*N + j] = res[i*N + j] + (a[i*N + k] & b[k*N + j]);
-            }
-            res[i*N + j] = res[i*N + j] % quotient;
+            res[(size_t) i*N + j] = (i == j) - A[(size_t) i*N + j];
         }
     }
-    cerr << endl;
 
     return flatten(res);
 }
 
+BitMatrix GSW::mult(const BitMatrix& a, const BitMatrix& b) const {
+    return flatten(product(a, b));
+}
+
+BitMatrix GSW::nand_row(const BitMatrix& a, const BitMatrix& b, unsigned int i) const {
+    const vector<int64_t> AB = product_row(a, b, i);
+
+    // row i of identity - A * B, flattened
+    vector<int64_t> res(N);
+    for (unsigned int j = 0; j < N; j++) {
+        res[j] = (i == j) - AB[j];
+    }
+
+    return flatten(res);
+}
+
+BitMatrix GSW::mult_row(const BitMatrix& a, const BitMatrix& b, unsigned int i) const {
+    return flatten(product_row(a, b, i));
+}
+
+BitMatrix GSW::cmux(const BitMatrix& c, const BitMatrix& x, const BitMatrix& y) const {
+    const vector<uint16_t> X = digits(x), Y = digits(y);
+
+    // X - Y, flattened
+    vector<int64_t> diff(X.size());
+# pragma omp parallel for shared (X, Y, diff) schedule(static)
+    for (size_t i = 0; i < X.size(); i++) {
+        diff[i] = (int64_t) X[i] - Y[i];
+    }
+
+    // D * C + Y, flattened
+    vector<int64_t> res = product(flatten(diff), c);
+# pragma omp parallel for shared (Y, res) schedule(static)
+    for (size_t i = 0; i < res.size(); i++) {
+        res[i] += Y[i];
+    }
+
+    return flatten(res);
+}
+
+BitMatrix GSW::cmux_row(const BitMatrix& c, const BitMatrix& x, const BitMatrix& y, unsigned int i) const {
+    const size_t offset = (size_t) i * N;
+
+    // row i of X - Y, flattened, is all of D the row needs
+    vector<int64_t> diff(N);
+    for (unsigned int j = 0; j < N; j++) {
+        diff[j] = (int64_t) digit(x, offset + j) - digit(y, offset + j);
+    }
+
+    vector<int64_t> res = product_row(flatten(diff), c, i);
+    for (unsigned int j = 0; j < N; j++) {
+        res[j] += digit(y, offset + j);
+    }
+
+    return flatten(res);
+}
+
+BitMatrix GSW::mult_const(const BitMatrix& a, int64_t c) const {
+    const vector<uint16_t> A = digits(a);
+
+    // c * A, flattened
+    vector<int64_t> res(A.size());
+# pragma omp parallel for shared (A, res) schedule(static)
+    for (size_t i = 0; i < A.size(); i++) {
+        res[i] = A[i] * c;
+    }
+
+    return flatten(res);
+}
+
+uint64_t GSW::decrypt_int(const BIVector& sk, const BitMatrix& C) const {
+    return decode_message(phase(sk, C, row_index(C, message_row())));
+}
+
 //////////////////////////////////////////////
 // Utility Functions
 //////////////////////////////////////////////
 
 
-BIVector GSW::powers_of_2(const BIVector& a) const {
+BIVector GSW::powers_of_base(const BIVector& a) const {
     BIVector result(N);
 # pragma omp parallel for shared (result, a) schedule(guided)
     for (unsigned int i = 0; i < n+1; i++) {
         for (unsigned int j = 0; j < l; j++) {
-            MulMod(result[i*l + j], power2_ZZ(j), a[i], quotient);
-            //result[i*l + j] = (BigInt) pow(2, j)*a[i] % quotient;
+            MulMod(result[i*l + j], power2_ZZ(k*j), a[i], quotient);
         }
     }
     
@@ -247,54 +442,74 @@ BIVector GSW::powers_of_2(const BIVector& a) const {
 }
 
 BitVector GSW::bit_decomp(const BIVector& a) const {
-    unsigned int num_rows = a.size() / n_1;
-    BitVector result(n_1*l*num_rows);
-    BigInt mask;
-    mask = 1;
-# pragma omp parallel for shared (result, a) schedule(guided)
-    for (unsigned int j = 0; j < l; j++) {
-        for (unsigned int k = 0; k < num_rows; k++) {
-            for (unsigned int i = 0; i < n_1; i++) {
-                result[k*l*n_1 + i*l + j] = (a[k*n_1 + i] & mask) > 0;
-            }
+    if (bit_decomp_preset) {
+        BitVector result;
+        bit_decomp_preset(a, result);
+        return result;
+    }
+
+    const unsigned int lk = l * k;
+    BitVector result(a.size() * lk);
+    // vector<bool> packs bits into words, so threads can not share it
+    for (size_t i = 0; i < a.size(); i++) {
+        for (unsigned int j = 0; j < lk; j++) {
+            result[i*lk + j] = bit(a[i], j);
         }
-        mask <<= 1;
     }
 
     return result;
 }
 
 BIVector GSW::inverse_bit_decomp(const BitVector& a) const {
-    BIVector result(n_1 * N);
-    BigInt multiplier;
-    multiplier = 1;
+    if (rns) {
+        return rns_inverse_bit_decomp(a);
+    }
+    if (inverse_bit_decomp_preset) {
+        BIVector result;
+        inverse_bit_decomp_preset(a, to_long(quotient), result);
+        return result;
+    }
 
-# pragma omp parallel for shared (result, a) schedule(guided)
-    for (unsigned int j = 0; j < l; j++) {
-        for (unsigned int row = 0; row < N; row++) {
-            for (unsigned int i = 0; i < n_1; i++) {
-                result[row * n_1 + i] += a[row*n_1*l + i*l + j] * multiplier;
+    const unsigned int lk = l * k;
+    BIVector result(a.size() / lk);
+    BIVector multiplier(lk);
+    for (unsigned int j = 0; j < lk; j++) {
+        multiplier[j] = power2_ZZ(j);
+    }
+
+# pragma omp parallel for shared (result, a, multiplier) schedule(guided)
+    for (size_t i = 0; i < result.size(); i++) {
+        BigInt &x = result[i];
+        for (unsigned int j = 0; j < lk; j++) {
+            if (a[i*lk + j]) {
+                x += multiplier[j];
             }
         }
-        multiplier <<= 1;
+        x %= quotient;
     }
 
     return result; 
 }
 
+// a is an N x N matrix of (not necessarily reduced) digits
 BIVector GSW::inverse_bit_decomp(const BIVector& a) const {
-    BIVector result(n_1 * N);
-    BigInt multiplier;
-    multiplier = 1;
+    if (rns) {
+        return rns_inverse_bit_decomp(a);
+    }
 
-# pragma omp parallel for shared (result, a) schedule(guided)
+    BIVector result(a.size() / l);
+    BIVector multiplier(l);
     for (unsigned int j = 0; j < l; j++) {
-        for (unsigned int row = 0; row < N; row++) {
-            for (unsigned int i = 0; i < n_1; i++) {
-                result[row * n_1 + i] += a[row*n_1*l + i*l + j] * multiplier;
-            }
+        multiplier[j] = power2_ZZ(k*j);
+    }
+
+# pragma omp parallel for shared (result, a, multiplier) schedule(guided)
+    for (size_t i = 0; i < result.size(); i++) {
+        BigInt &x = result[i];
+        for (unsigned int j = 0; j < l; j++) {
+            x += a[i*l + j] * multiplier[j];
         }
-        multiplier <<= 1;
+        x %= quotient;
     }
 
     return result; 
@@ -307,3 +522,274 @@ BitVector GSW::flatten(const BitVector& a) const {
 BitVector GSW::flatten(const BIVector& a) const {
     return bit_decomp(inverse_bit_decomp(a));
 }
+
+BitVector GSW::flatten(const vector<int64_t>& a) const {
+    if (flatten_preset) {
+        BitVector result;
+        flatten_preset(a, to_long(quotient), result);
+        return result;
+    }
+    BIVector big(a.size());
+# pragma omp parallel for shared (a, big) schedule(static)
+    for (size_t i = 0; i < a.size(); i++) {
+        big[i] = a[i];
+    }
+    return flatten(big);
+}
+
+vector<int64_t> GSW::product(const BitMatrix& a, const BitMatrix& b) const {
+    vector<int64_t> AB;
+    backend->product(digits(a), digits(b), N, k, AB);
+    return AB;
+}
+
+vector<int64_t> GSW::product_row(const BitMatrix& a, const BitMatrix& b, unsigned int i) const {
+    const size_t offset = (size_t) row_index(a, i) * N;
+    const vector<uint16_t> B = digits(b);
+
+    // skipping zero digits of the row, as the reference backend does
+    vector<int64_t> AB(N, 0);
+    for (unsigned int t = 0; t < N; t++) {
+        const int64_t d = digit(a, offset + t);
+        if (!d) {
+            continue;
+        }
+        const uint16_t *B_t = &B[(size_t) t*N];
+        for (unsigned int j = 0; j < N; j++) {
+            AB[j] += d * B_t[j];
+        }
+    }
+    return AB;
+}
+
+BigInt GSW::phase(const BIVector& sk, const BitMatrix& C, unsigned int i) const {
+    if (rns) {
+        return rns_phase(sk, C, i);
+    }
+
+    const auto v = powers_of_base(sk);
+
+    BigInt xi, temp;
+    xi = 0;
+    for (unsigned int j = 0; j < N; j++) {
+        MulMod(temp, v[j], digit(C, (size_t) i*N + j), quotient);
+        AddMod(xi, xi, temp, quotient);
+    }
+    return xi;
+}
+
+vector<uint16_t> GSW::digits(const BitMatrix& a) const {
+    if (digits_preset) {
+        vector<uint16_t> result;
+        digits_preset(a, result);
+        return result;
+    }
+    vector<uint16_t> result(a.size() / k);
+    for (size_t i = 0; i < result.size(); i++) {
+        result[i] = digit(a, i);
+    }
+    return result;
+}
+
+unsigned int GSWBase::decryption_row() const {
+    unsigned int i = 0;
+    while (i + 1 < l && power2_ZZ(k*(i + 1)) <= quotient/2) {
+        i++;
+    }
+    return i;
+}
+
+unsigned int GSWBase::message_row() const {
+    return decryption_row() - (plaintext_bits - 1) / k;
+}
+
+unsigned int GSWBase::output_row() const {
+    return plaintext_bits > 1 ? message_row() : decryption_row();
+}
+
+uint64_t GSWBase::row_bits() const {
+    return ciphertext_bits() / N;
+}
+
+BitMatrix GSWBase::row(const BitMatrix& C, unsigned int i) const {
+    const uint64_t bits = row_bits();
+    const size_t start = (size_t) row_index(C, i) * bits;
+    return BitMatrix(C.begin() + start, C.begin() + start + bits);
+}
+
+unsigned int GSWBase::row_index(const BitMatrix& C, unsigned int i) const {
+    return C.size() == row_bits() ? 0 : i;
+}
+
+void GSWBase::set_plaintext_bits(unsigned int bits) {
+    // the plaintext modulus times a power of B has to land on 2B^j
+    if (bits < 1 || bits > 16 || (bits - 1) % k) {
+        throw ex("Plaintext bits must be 1 plus a multiple of k, at most 16");
+    }
+    if ((bits - 1) / k > decryption_row()) {
+        throw ex("Quotient too small for the plaintext bits");
+    }
+    plaintext_bits = bits;
+}
+
+uint64_t GSWBase::decode_message(const BigInt& xi) const {
+    BigInt v, m;
+    v = power2_ZZ(k*message_row());
+    // nearest multiple of v, q itself is just above 2^plaintext_bits v
+    m = (xi + v/2) / v;
+    return to_long(m) & ((1ull << plaintext_bits) - 1);
+}
+
+// Decryption picks the nearer of 0 and v, so it fails once the error
+// reaches half of the smaller gap between them
+double GSWBase::noise_limit_bits() const {
+    BigInt v, gap;
+    v = power2_ZZ(k*decryption_row());
+    gap = quotient - v < v ? quotient - v : v;
+    return log(gap)/log(2) - 1;
+}
+
+bool GSW::decode_bit(const BigInt& xi, const BigInt& v) const {
+    BigInt dist_0, dist_v;
+    dist_0 = xi < quotient - xi ? xi : quotient - xi;
+    dist_v = xi > v ? xi - v : v - xi;
+    if (quotient - dist_v < dist_v) {
+        dist_v = quotient - dist_v;
+    }
+    return dist_v < dist_0;
+}
+
+//////////////////////////////////////////////
+// Residue Number System
+//////////////////////////////////////////////
+
+BIMatrix GSW::rns_public_key_gen(const BIVector& sk) const {
+    const size_t num_primes = rns->size(), len = m * n_1;
+
+    // t = (-s_2,...,-s_n) as in public_key_gen
+    BIVector t(n);
+    for (unsigned int i = 0; i < n; i++) {
+        t[i] = quotient - sk[i+1];
+    }
+    const vector<uint64_t> t_r = rns->to_rns(t);
+
+    vector<int> e(m);
+    for (unsigned int i = 0; i < m; i++) {
+        e[i] = gaussSampler->sample() % sigma6;
+    }
+
+    // B uniform mod q is uniform mod every p_i, so it is sampled per residue.
+    // First column b = B*t + e, the rest is B
+    vector<uint64_t> pk(num_primes * len);
+    for (size_t p = 0; p < num_primes; p++) {
+        const uint64_t prime = rns->primes[p];
+        for (unsigned int i = 0; i < m; i++) {
+            uint64_t *row = &pk[p*len + i*n_1];
+            uint64_t b = e[i] < 0 ? prime + e[i] : e[i];
+            for (unsigned int j = 0; j < n; j++) {
+                row[1 + j] = RandomBnd((long) prime);
+                b = RNS::add_mod(b, RNS::mul_mod(row[1 + j], t_r[p*n + j], prime), prime);
+            }
+            row[0] = b;
+        }
+    }
+
+    return rns->from_rns(pk);
+}
+
+BIMatrix GSW::rns_encrypt_RA(const BitMatrix& R, const BIMatrix& public_key) const {
+    const size_t num_primes = rns->size(), len = m * n_1;
+    const vector<uint64_t> A = rns->to_rns(public_key);
+
+    // R is binary, so R * A only adds up rows of A
+    vector<uint64_t> RA(num_primes * N * n_1, 0);
+# pragma omp parallel for shared (R, A, RA) schedule(guided)
+    for (unsigned int i = 0; i < N; i++) {
+        if (omp_get_thread_num() == 0)
+            cerr << "Calc RA matrix " << i << " out of " << N << "\r";
+        for (size_t p = 0; p < num_primes; p++) {
+            const uint64_t prime = rns->primes[p];
+            const uint64_t *A_p = &A[p*len];
+            uint64_t *RA_i = &RA[p*N*n_1 + i*n_1];
+            for (unsigned int t = 0; t < m; t++) {
+                if (!R[i*m + t]) continue;
+                for (unsigned int j = 0; j < n_1; j++) {
+                    RA_i[j] = RNS::add_mod(RA_i[j], A_p[t*n_1 + j], prime);
+                }
+            }
+        }
+    }
+    cerr << endl;
+
+    return rns->from_rns(RA);
+}
+
+BigInt GSW::rns_phase(const BIVector& sk, const BitMatrix& C, unsigned int i) const {
+    const size_t num_primes = rns->size();
+
+    // xi = <C_i, powers_of_base(sk)> in every residue
+    const vector<uint64_t> s = rns->to_rns(sk);
+    vector<uint64_t> xi(num_primes);
+    for (size_t p = 0; p < num_primes; p++) {
+        const uint64_t prime = rns->primes[p];
+        const uint64_t base = (1ull << k) % prime;
+        uint64_t x = 0;
+        for (unsigned int a = 0; a < n_1; a++) {
+            uint64_t v = s[p*n_1 + a];
+            for (unsigned int b = 0; b < l; b++) {
+                const uint64_t d = digit(C, (size_t) i*N + a*l + b);
+                x = RNS::add_mod(x, RNS::mul_mod(d, v, prime), prime);
+                v = RNS::mul_mod(v, base, prime);
+            }
+        }
+        xi[p] = x;
+    }
+
+    return rns->from_rns(xi, 1, 0);
+}
+
+BIVector GSW::rns_inverse_bit_decomp(const BitVector& a) const {
+    const size_t num_primes = rns->size();
+    const unsigned int lk = l * k;
+    const size_t len = a.size() / lk;
+    vector<uint64_t> result(num_primes * len);
+
+# pragma omp parallel for shared (result, a) schedule(guided)
+    for (size_t i = 0; i < len; i++) {
+        for (size_t p = 0; p < num_primes; p++) {
+            const uint64_t prime = rns->primes[p];
+            uint64_t x = 0, v = 1;
+            for (unsigned int j = 0; j < lk; j++) {
+                if (a[i*lk + j]) {
+                    x = RNS::add_mod(x, v, prime);
+                }
+                v = RNS::add_mod(v, v, prime);
+            }
+            result[p*len + i] = x;
+        }
+    }
+
+    return rns->from_rns(result);
+}
+
+BIVector GSW::rns_inverse_bit_decomp(const BIVector& a) const {
+    const size_t num_primes = rns->size(), len = a.size() / l;
+    vector<uint64_t> result(num_primes * len);
+
+# pragma omp parallel for shared (result, a) schedule(guided)
+    for (size_t i = 0; i < len; i++) {
+        for (size_t p = 0; p < num_primes; p++) {
+            const uint64_t prime = rns->primes[p];
+            const uint64_t base = (1ull << k) % prime;
+            uint64_t x = 0, v = 1;
+            for (unsigned int j = 0; j < l; j++) {
+                const uint64_t a_j = rem(a[i*l + j], (long) prime);
+                x = RNS::add_mod(x, RNS::mul_mod(a_j, v, prime), prime);
+                v = RNS::mul_mod(v, base, prime);
+            }
+            result[p*len + i] = x;
+        }
+    }
+
+    return rns->from_rns(result);
+}
@@ -2,40 +2,168 @@
 
 #include "utils.hpp"
 #include "gaussSampler.hpp"
+#include "rns.hpp"
+#include "matrixBackend.hpp"
+#include "gadgetKernels.hpp"
 
 #define sigma 3.8
 #define sigma6 (int)(sigma*6)
 
-class GSW {
+// Interface shared by the GSW flavours, so that CryptoCircuit and gsw-fhe
+// can work with whichever scheme a key was generated for.
+// Ciphertexts are always kept in their flattened (gadget decomposed) form,
+// an N x N matrix of base 2^k digits packed as k bits each.
+class GSWBase {
+
+public:
+    BigInt quotient;
+    unsigned int n;
+    unsigned int m;
+    unsigned int k; // gadget base is 2^k
+    unsigned int l; // l = ceil((floor(log q) + 1) / k), digits per entry
+    unsigned int N; // ciphertexts are N x N digit matrices (of ring elements)
+    unsigned int plaintext_bits; // integer messages are mod 2^plaintext_bits, 1 for bits
+
+    GSWBase() : plaintext_bits(1) {};
+    virtual ~GSWBase() {};
+
+    // Key file tag, as in -----BEGIN <name> SECRET KEY-----
+    virtual std::string name() const = 0;
+    // Restore the parameters stored in a key file
+    virtual void set_params(unsigned int n, unsigned int m, const BigInt& q, unsigned int k) = 0;
+    // Size of every ciphertext
+    virtual uint64_t ciphertext_bits() const = 0;
+
+    virtual BIVector secret_key_gen() const = 0;
+    virtual BIMatrix public_key_gen(const BIVector& secret_key) const = 0;
+
+    virtual BitMatrix encrypt(const BIMatrix& public_key, const BigInt& message) const = 0;
+    // Same ciphertexts from the secret key, out of fresh samples instead of
+    // the public key, which is faster and leaves less noise
+    virtual BitMatrix encrypt_secret(const BIVector& secret_key, const BigInt& message) const = 0;
+    virtual bool decrypt_bit(const BIVector& private_key, const BitMatrix& cyphertext) const = 0;
+
+    // Homomorphic operations. Decryption only looks at the parity of the
+    // message, so on bits add is XOR, negate is NOT and mult is AND.
+    // add and negate cost O(N^2), mult and nand a full product.
+    virtual BitMatrix nand(const BitMatrix&, const BitMatrix&) const = 0;
+    virtual BitMatrix add(const BitMatrix&, const BitMatrix&) const = 0;
+    virtual BitMatrix negate(const BitMatrix&) const = 0;
+    virtual BitMatrix mult(const BitMatrix&, const BitMatrix&) const = 0;
+    // Times a public constant, the noise grows by |c|. O(N^2) like add.
+    virtual BitMatrix mult_const(const BitMatrix&, int64_t c) const = 0;
+
+    // Message mod 2^plaintext_bits, which add and mult_const keep as
+    // integers instead of bits
+    virtual uint64_t decrypt_int(const BIVector& private_key, const BitMatrix& cyphertext) const = 0;
+    // Checked against the gadget base, see message_row
+    void set_plaintext_bits(unsigned int bits);
+
+    // Error of a ciphertext, the distance of its decryption row inner
+    // product from the nearest of 0 and the gadget entry
+    virtual BigInt noise(const BIVector& private_key, const BitMatrix& cyphertext) const = 0;
+    // log2 of the noise past which decryption fails
+    double noise_limit_bits() const;
+
+    // Row of the ciphertext read by decryption, its gadget entry is the
+    // largest power of 2^k that is at most q/2
+    unsigned int decryption_row() const;
+    // Row integer messages are read from, its gadget entry v has
+    // v 2^plaintext_bits = 2B^j, so that wrapping past the plaintext modulus
+    // costs q - 2B^j like wrapping past the parity does
+    unsigned int message_row() const;
+    // Phase of message_row rounded to a multiple of its gadget entry
+    uint64_t decode_message(const BigInt& phase) const;
+
+    // Compact ciphertexts are the one row decryption reads, decryption_row
+    // for bits and message_row for integers, N digits (of ring elements)
+    // instead of N^2. Decryption and noise take either form.
+    unsigned int output_row() const;
+    uint64_t row_bits() const;
+    // Row i of a ciphertext, as a compact ciphertext
+    BitMatrix row(const BitMatrix&, unsigned int i) const;
+    // Row i of a ciphertext is row 0 of a compact one
+    unsigned int row_index(const BitMatrix&, unsigned int i) const;
+    // Row i of nand and mult alone, a vector times matrix product in
+    // O(N^2) instead of a full one. a may be compact.
+    virtual BitMatrix nand_row(const BitMatrix& a, const BitMatrix& b, unsigned int i) const = 0;
+    virtual BitMatrix mult_row(const BitMatrix& a, const BitMatrix& b, unsigned int i) const = 0;
+    // c ? x : y for a bit c, as D * C + Y with D = X - Y, a single product.
+    // With the difference on the left the noise of x and y only adds up
+    // along a chain of selections, c's is the one scaled by N.
+    virtual BitMatrix cmux(const BitMatrix& c, const BitMatrix& x, const BitMatrix& y) const = 0;
+    // Row i of cmux alone, which only needs row i of D
+    virtual BitMatrix cmux_row(const BitMatrix& c, const BitMatrix& x, const BitMatrix& y, unsigned int i) const = 0;
+
+    // Digit j of a flattened matrix
+    inline unsigned int digit(const BitMatrix& a, size_t j) const {
+        unsigned int d = 0;
+        for (unsigned int b = 0; b < k; b++) {
+            d |= a[j*k + b] << b;
+        }
+        return d;
+    }
+};
+
+class GSW : public GSWBase {
+    // quotient: q/sigma6 > 8((2^k - 1)N + 1)^L 2^(p - 1), L the multiplicative
+    // depth, p the plaintext bits
+    // n >= log(q/sigma)(kappa+110)/7.2
+    // m = O(n log q)
+    // N = (n + 1) * l
 
 public: 
-    BigInt quotient; // q/sigma6 > 8(N + 1)^L
-    unsigned int n, n_1; // n >= log(q/sigma)(k+110)/7.2
-    unsigned int m; // m = O(n log q)
-    unsigned int l; // l = floor(log q) + 1
-    unsigned int N; // N = (n + 1) * l
+    unsigned int n_1;
 
     GaussSampler *gaussSampler;
+    RNS *rns; // set when q is a product of word sized primes
+    MatrixBackend *backend; // ciphertext products, eigen by default
+    // Compile time specialised loops for preset gadgets, NULL otherwise and
+    // with the reference backend
+    FlattenKernel flatten_preset;
+    BitDecompKernel bit_decomp_preset;
+    InverseBitDecompKernel inverse_bit_decomp_preset;
+    DigitsKernel digits_preset;
     
     GSW();
-    GSW(const int, const int);
+    GSW(const int, const int, const unsigned int k = 1, const bool use_rns = false, const unsigned int plaintext_bits = 1,
+        const unsigned int noise_bits = 0);
     ~GSW();
 
+    std::string name() const;
+    uint64_t ciphertext_bits() const;
+    void set_params(unsigned int n, unsigned int m, const BigInt& q, unsigned int k);
+    void set_backend(const std::string& name);
+
     BIVector secret_key_gen() const; //sk = Z(n+1)_q
     BIMatrix public_key_gen(const BIVector& secret_key) const; //pk = Z(m, n+1)_q
 
     // C = flatten(message * identity + BitDecomp(R * A))
     BitMatrix encrypt(const BIMatrix& public_key, const BigInt& message) const;
+    BitMatrix encrypt_secret(const BIVector& secret_key, const BigInt& message) const;
 
     BigInt decrypt(const BIVector& private_key, const BitMatrix& cyphertext) const;
     bool decrypt_bit(const BIVector& private_key, const BitMatrix& cyphertext) const;
+    BigInt noise(const BIVector& private_key, const BitMatrix& cyphertext) const;
 
     // Homomorphic operations
     BitMatrix nand(const BitMatrix&, const BitMatrix&) const;
+    BitMatrix add(const BitMatrix&, const BitMatrix&) const;
+    BitMatrix negate(const BitMatrix&) const;
+    BitMatrix mult(const BitMatrix&, const BitMatrix&) const;
+    BitMatrix mult_const(const BitMatrix&, int64_t c) const;
+    uint64_t decrypt_int(const BIVector& private_key, const BitMatrix& cyphertext) const;
+    BitMatrix nand_row(const BitMatrix& a, const BitMatrix& b, unsigned int i) const;
+    BitMatrix mult_row(const BitMatrix& a, const BitMatrix& b, unsigned int i) const;
+    BitMatrix cmux(const BitMatrix& c, const BitMatrix& x, const BitMatrix& y) const;
+    BitMatrix cmux_row(const BitMatrix& c, const BitMatrix& x, const BitMatrix& y, unsigned int i) const;
 
 
     // utility functions
-    BIVector powers_of_2(const BIVector&) const ;
+    BIVector powers_of_base(const BIVector&) const ;
+
+    // Base 2^k digits of each entry, k bits per digit, which is the same
+    // as the binary expansion of the entry to l * k bits
 
     BitVector bit_decomp(const BIVector&) const ;
 
@@ -44,6 +172,33 @@ public:
 
     BitVector flatten(const BitVector&) const ;
     BitVector flatten(const BIVector&) const ;
-
+    // Of small integers, through flatten_preset when there is one
+    BitVector flatten(const std::vector<int64_t>&) const ;
+
+    // Unpacked digits of a flattened matrix
+    std::vector<uint16_t> digits(const BitMatrix&) const ;
+
+    // Whether xi is closer to v than to 0, mod q
+    bool decode_bit(const BigInt& xi, const BigInt& v) const ;
+
+private:
+    // Sets the presets for the parameters and backend
+    void pick_presets();
+    // BitDecomp(C + message * G), for the N x (n + 1) samples C
+    BitMatrix add_message(BIMatrix& C, const BigInt& message) const;
+    // A * B over the integers, for digit matrices A and B
+    std::vector<int64_t> product(const BitMatrix&, const BitMatrix&) const;
+    // Row i of A * B
+    std::vector<int64_t> product_row(const BitMatrix&, const BitMatrix&, unsigned int i) const;
+    // <C_i, powers_of_base(sk)> for row i
+    BigInt phase(const BIVector&, const BitMatrix&, unsigned int i) const;
+
+    // Residue number system paths, reconstruction to BigInt only happens
+    // before bit decomposition and at the end of decryption
+    BIMatrix rns_public_key_gen(const BIVector&) const;
+    BIMatrix rns_encrypt_RA(const BitMatrix& R, const BIMatrix& public_key) const;
+    BigInt rns_phase(const BIVector&, const BitMatrix&, unsigned int i) const;
+    BIVector rns_inverse_bit_decomp(const BitVector&) const;
+    BIVector rns_inverse_bit_decomp(const BIVector&) const;
 };
 
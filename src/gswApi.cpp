@@ -0,0 +1,409 @@
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <string>
+
+#include "gswApi.h"
+#include "utils.hpp"
+#include "gsw.hpp"
+#include "ringGsw.hpp"
+#include "keyFile.hpp"
+#include "cryptoCircuit.hpp"
+
+using namespace std;
+
+struct gsw_params {
+    unique_ptr<GSWBase> gsw;
+};
+
+struct gsw_key {
+    BIMatrix key;
+    bool secret;
+    // scheme and shape of the parameters the key belongs to
+    string scheme;
+    unsigned int n, m;
+    BigInt q;
+    unsigned int k, plaintext_bits;
+};
+
+struct gsw_ciphertext {
+    Ciphertext val;
+};
+
+struct gsw_circuit {
+    CryptoCircuit circuit;
+    gsw_circuit(const char* path) : circuit(string(path)) { }
+};
+
+namespace {
+
+thread_local string last_error;
+
+once_flag init_once;
+
+// encryption draws from the global random generators
+mutex encrypt_mutex;
+
+// Runs f, turning what it throws into a status
+template <typename F>
+int guarded(F f) {
+    try {
+        f();
+        return 0;
+    } catch (exception &e) {
+        last_error = e.what();
+    } catch (...) {
+        last_error = "Unknown error";
+    }
+    return -1;
+}
+
+// Runs f, turning what it throws into NULL
+template <typename T, typename F>
+T* guarded_new(F f) {
+    T *result = NULL;
+    guarded([&]() { result = f(); });
+    return result;
+}
+
+gsw_ciphertext* wrap(BitMatrix&& val) {
+    gsw_ciphertext *c = new gsw_ciphertext();
+    c->val = Ciphertext(move(val));
+    return c;
+}
+
+// Another handle on a gate's ciphertext, which stays with the circuit
+gsw_ciphertext* share(const Ciphertext& val) {
+    gsw_ciphertext *c = new gsw_ciphertext();
+    c->val = val;
+    return c;
+}
+
+// Frees out[0 .. count) and sets them to NULL, after a failed batch
+void release(gsw_ciphertext** out, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        delete out[i];
+        out[i] = NULL;
+    }
+}
+
+// Takes the shape of the key from the parameters it is made or loaded with
+void set_shape(gsw_key* key, const GSWBase& gsw) {
+    key->scheme = gsw.name();
+    key->n = gsw.n;
+    key->m = gsw.m;
+    key->q = gsw.quotient;
+    key->k = gsw.k;
+    key->plaintext_bits = gsw.plaintext_bits;
+}
+
+void check_key(const gsw_params* params, const gsw_key* key) {
+    const GSWBase &gsw = *params->gsw;
+    if (key->scheme != gsw.name() || key->n != gsw.n || key->m != gsw.m || key->q != gsw.quotient
+        || key->k != gsw.k || key->plaintext_bits != gsw.plaintext_bits) {
+        throw ex("Key of other parameters");
+    }
+}
+
+void check_size(const gsw_params* params, const gsw_ciphertext* c) {
+    if (c->val->size() != params->gsw->ciphertext_bits()) {
+        throw ex("Ciphertext of other parameters");
+    }
+}
+
+BitMatrix encrypt(const gsw_params* params, const gsw_key* key, uint64_t message) {
+    const GSWBase &gsw = *params->gsw;
+    BigInt val;
+    check_key(params, key);
+    val = (long) (message & ((1ull << gsw.plaintext_bits) - 1));
+    lock_guard<mutex> lock(encrypt_mutex);
+    return key->secret ? gsw.encrypt_secret(key->key, val) : gsw.encrypt(key->key, val);
+}
+
+uint64_t decrypt(const gsw_params* params, const gsw_key* key, const gsw_ciphertext* c) {
+    const GSWBase &gsw = *params->gsw;
+    if (!key->secret) {
+        throw ex("Decryption needs the secret key");
+    }
+    check_key(params, key);
+    check_size(params, c);
+    return gsw.plaintext_bits > 1 ? gsw.decrypt_int(key->key, *c->val) : gsw.decrypt_bit(key->key, *c->val);
+}
+
+}
+
+extern "C" {
+
+int gsw_api_version(void) {
+    return GSW_API_VERSION;
+}
+
+const char* gsw_last_error(void) {
+    return last_error.c_str();
+}
+
+gsw_params* gsw_params_new(unsigned int kappa, unsigned int depth, unsigned int gadget,
+                           unsigned int plaintext_bits, unsigned int flags) {
+    return guarded_new<gsw_params>([&]() {
+        call_once(init_once, utils_init);
+        unique_ptr<gsw_params> params(new gsw_params());
+        if (flags & GSW_RING) {
+            params->gsw.reset(new RingGSW(kappa, depth, gadget, plaintext_bits));
+        } else {
+            params->gsw.reset(new GSW(kappa, depth, gadget, flags & GSW_RNS, plaintext_bits));
+        }
+        return params.release();
+    });
+}
+
+gsw_params* gsw_params_load(const char* key_path) {
+    return guarded_new<gsw_params>([&]() {
+        call_once(init_once, utils_init);
+        unique_ptr<gsw_params> params(new gsw_params());
+        params->gsw.reset(new_scheme(read_key_scheme(key_path)));
+        read_key(key_path, *params->gsw);
+        return params.release();
+    });
+}
+
+void gsw_params_free(gsw_params* params) {
+    delete params;
+}
+
+uint64_t gsw_ciphertext_bits(const gsw_params* params) {
+    return params->gsw->ciphertext_bits();
+}
+
+size_t gsw_ciphertext_words(const gsw_params* params) {
+    return (params->gsw->ciphertext_bits() + 63) / 64;
+}
+
+int gsw_keygen(const gsw_params* params, gsw_key** public_key, gsw_key** secret_key) {
+    return guarded([&]() {
+        unique_ptr<gsw_key> sk(new gsw_key()), pk(new gsw_key());
+        {
+            lock_guard<mutex> lock(encrypt_mutex);
+            sk->key = params->gsw->secret_key_gen();
+            pk->key = params->gsw->public_key_gen(sk->key);
+        }
+        sk->secret = true;
+        pk->secret = false;
+        set_shape(sk.get(), *params->gsw);
+        set_shape(pk.get(), *params->gsw);
+        *public_key = pk.release();
+        *secret_key = sk.release();
+    });
+}
+
+gsw_key* gsw_key_load(const gsw_params* params, const char* path) {
+    return guarded_new<gsw_key>([&]() {
+        bool secret;
+        const GSWBase &gsw = *params->gsw;
+        unique_ptr<GSWBase> file_gsw(new_scheme(read_key_scheme(path, &secret)));
+        unique_ptr<gsw_key> key(new gsw_key());
+        key->key = read_key(path, *file_gsw);
+        key->secret = secret;
+        if (file_gsw->name() != gsw.name() || file_gsw->n != gsw.n || file_gsw->m != gsw.m
+            || file_gsw->quotient != gsw.quotient || file_gsw->k != gsw.k
+            || file_gsw->plaintext_bits != gsw.plaintext_bits) {
+            throw ex("Key of other parameters");
+        }
+        set_shape(key.get(), gsw);
+        return key.release();
+    });
+}
+
+int gsw_key_save(const gsw_params* params, const gsw_key* key, const char* path) {
+    return guarded([&]() {
+        check_key(params, key);
+        write_key(path, *params->gsw, key->key, key->secret);
+    });
+}
+
+void gsw_key_free(gsw_key* key) {
+    delete key;
+}
+
+gsw_ciphertext* gsw_encrypt(const gsw_params* params, const gsw_key* key, uint64_t message) {
+    return guarded_new<gsw_ciphertext>([&]() { return wrap(encrypt(params, key, message)); });
+}
+
+int gsw_encrypt_batch(const gsw_params* params, const gsw_key* key, const uint64_t* messages, size_t count,
+                      gsw_ciphertext** out) {
+    size_t done = 0;
+    const int status = guarded([&]() {
+        for (; done < count; done++) {
+            out[done] = wrap(encrypt(params, key, messages[done]));
+        }
+    });
+    if (status) {
+        release(out, done);
+    }
+    return status;
+}
+
+int gsw_decrypt(const gsw_params* params, const gsw_key* key, const gsw_ciphertext* c, uint64_t* message) {
+    return guarded([&]() { *message = decrypt(params, key, c); });
+}
+
+int gsw_decrypt_batch(const gsw_params* params, const gsw_key* key, gsw_ciphertext* const* in, size_t count,
+                      uint64_t* messages) {
+    return guarded([&]() {
+        for (size_t i = 0; i < count; i++) {
+            messages[i] = decrypt(params, key, in[i]);
+        }
+    });
+}
+
+void gsw_ciphertext_free(gsw_ciphertext* c) {
+    delete c;
+}
+
+int gsw_ciphertext_export(const gsw_params* params, const gsw_ciphertext* c, uint64_t* words) {
+    return guarded([&]() {
+        check_size(params, c);
+        pack_bits(*c->val, words);
+    });
+}
+
+gsw_ciphertext* gsw_ciphertext_import(const gsw_params* params, const uint64_t* words) {
+    return guarded_new<gsw_ciphertext>([&]() {
+        BitMatrix val;
+        unpack_bits(words, params->gsw->ciphertext_bits(), val);
+        return wrap(move(val));
+    });
+}
+
+gsw_ciphertext* gsw_nand(const gsw_params* params, const gsw_ciphertext* a, const gsw_ciphertext* b) {
+    return guarded_new<gsw_ciphertext>([&]() {
+        check_size(params, a);
+        check_size(params, b);
+        return wrap(params->gsw->nand(*a->val, *b->val));
+    });
+}
+
+gsw_ciphertext* gsw_and(const gsw_params* params, const gsw_ciphertext* a, const gsw_ciphertext* b) {
+    return guarded_new<gsw_ciphertext>([&]() {
+        check_size(params, a);
+        check_size(params, b);
+        return wrap(params->gsw->mult(*a->val, *b->val));
+    });
+}
+
+gsw_ciphertext* gsw_xor(const gsw_params* params, const gsw_ciphertext* a, const gsw_ciphertext* b) {
+    return guarded_new<gsw_ciphertext>([&]() {
+        check_size(params, a);
+        check_size(params, b);
+        return wrap(params->gsw->add(*a->val, *b->val));
+    });
+}
+
+gsw_ciphertext* gsw_not(const gsw_params* params, const gsw_ciphertext* a) {
+    return guarded_new<gsw_ciphertext>([&]() {
+        check_size(params, a);
+        return wrap(params->gsw->negate(*a->val));
+    });
+}
+
+gsw_ciphertext* gsw_mux(const gsw_params* params, const gsw_ciphertext* c, const gsw_ciphertext* x,
+                        const gsw_ciphertext* y) {
+    return guarded_new<gsw_ciphertext>([&]() {
+        check_size(params, c);
+        check_size(params, x);
+        check_size(params, y);
+        return wrap(params->gsw->cmux(*c->val, *x->val, *y->val));
+    });
+}
+
+int gsw_nand_batch(const gsw_params* params, gsw_ciphertext* const* a, gsw_ciphertext* const* b, size_t count,
+                   gsw_ciphertext** out) {
+    size_t done = 0;
+    const int status = guarded([&]() {
+        for (; done < count; done++) {
+            check_size(params, a[done]);
+            check_size(params, b[done]);
+            out[done] = wrap(params->gsw->nand(*a[done]->val, *b[done]->val));
+        }
+    });
+    if (status) {
+        release(out, done);
+    }
+    return status;
+}
+
+gsw_circuit* gsw_circuit_load(const char* path) {
+    return guarded_new<gsw_circuit>([&]() { return new gsw_circuit(path); });
+}
+
+void gsw_circuit_free(gsw_circuit* circuit) {
+    delete circuit;
+}
+
+size_t gsw_circuit_inputs(const gsw_circuit* circuit) {
+    return circuit->circuit.inputs.size();
+}
+
+size_t gsw_circuit_outputs(const gsw_circuit* circuit) {
+    return circuit->circuit.selected_outputs().size();
+}
+
+int gsw_circuit_select(gsw_circuit* circuit, const uint8_t* wanted, size_t count) {
+    return guarded([&]() { circuit->circuit.select_outputs(vector<bool>(wanted, wanted + count)); });
+}
+
+int gsw_circuit_eval(const gsw_params* params, gsw_circuit* circuit, gsw_ciphertext* const* in,
+                     gsw_ciphertext** out) {
+    size_t done = 0;
+    const int status = guarded([&]() {
+        CryptoCircuit &c = circuit->circuit;
+        vector<Ciphertext> inputs;
+        for (size_t i = 0; i < c.inputs.size(); i++) {
+            check_size(params, in[i]);
+            inputs.push_back(in[i]->val);
+        }
+        c.update(inputs, *params->gsw);
+        // the gates keep their ciphertexts for the next update, the outputs
+        // share them
+        for (auto &g : c.selected_outputs()) {
+            out[done++] = share(g->val);
+        }
+    });
+    if (status) {
+        release(out, done);
+    }
+    return status;
+}
+
+int gsw_circuit_eval_batch(const gsw_params* params, gsw_circuit* circuit, gsw_ciphertext* const* in, size_t sets,
+                           gsw_ciphertext** out) {
+    size_t done = 0;
+    const int status = guarded([&]() {
+        CryptoCircuit &c = circuit->circuit;
+        const size_t width = c.inputs.size();
+        vector<vector<Ciphertext> > batch(sets, vector<Ciphertext>(width));
+        for (size_t i = 0; i < sets * width; i++) {
+            check_size(params, in[i]);
+            batch[i / width][i % width] = in[i]->val;
+        }
+        for (auto &outputs : c.eval_batch(batch, *params->gsw)) {
+            for (auto &o : outputs) {
+                out[done++] = share(o);
+            }
+        }
+    });
+    if (status) {
+        release(out, done);
+    }
+    return status;
+}
+
+void gsw_circuit_counts(const gsw_circuit* circuit, uint64_t* reused, uint64_t* recomputed) {
+    *reused = circuit->circuit.reused;
+    *recomputed = circuit->circuit.recomputed;
+}
+
+uint64_t gsw_copied_bytes(void) {
+    return Ciphertext::copied_bytes();
+}
+
+}
@@ -0,0 +1,107 @@
+/* C interface of libgswApi, to embed the scheme in other programs instead of
+ * running gsw-fhe for every operation. Parameters, keys, ciphertexts and
+ * circuits are opaque handles that stay in memory between calls.
+ *
+ * Functions returning int give 0 on success and -1 on failure, those
+ * returning a handle NULL, gsw_last_error then has the message. Every handle
+ * is freed with its own gsw_*_free. Handles may be shared between threads,
+ * except a circuit, which only one thread may evaluate at a time.
+ */
+#ifndef GSW_API_H
+#define GSW_API_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Bumped on any incompatible change of the functions below */
+#define GSW_API_VERSION 1
+
+/* Flags of gsw_params_new */
+#define GSW_RING 1 /* Ring-GSW instead of GSW */
+#define GSW_RNS 2  /* quotient a product of word sized primes, GSW bits only */
+
+typedef struct gsw_params gsw_params;
+typedef struct gsw_key gsw_key;
+typedef struct gsw_ciphertext gsw_ciphertext;
+typedef struct gsw_circuit gsw_circuit;
+
+int gsw_api_version(void);
+/* Message of the last failure on the calling thread */
+const char* gsw_last_error(void);
+
+/* Parameters for keys that evaluate circuits of the given multiplicative
+ * depth, as gsw-fhe -k picks them. gadget is the k of base 2^k digits and
+ * plaintext_bits 1 for bits, both as -g and -P. */
+gsw_params* gsw_params_new(unsigned int kappa, unsigned int depth, unsigned int gadget,
+                           unsigned int plaintext_bits, unsigned int flags);
+/* Scheme and parameters of a key file */
+gsw_params* gsw_params_load(const char* key_path);
+void gsw_params_free(gsw_params*);
+/* Bits of a ciphertext, and the 64 bit words gsw_ciphertext_export packs
+ * them into */
+uint64_t gsw_ciphertext_bits(const gsw_params*);
+size_t gsw_ciphertext_words(const gsw_params*);
+
+/* Keys, generated for or loaded with parameters and only used with them,
+ * using them with others fails */
+int gsw_keygen(const gsw_params*, gsw_key** public_key, gsw_key** secret_key);
+gsw_key* gsw_key_load(const gsw_params*, const char* path);
+int gsw_key_save(const gsw_params*, const gsw_key*, const char* path);
+void gsw_key_free(gsw_key*);
+
+/* Encryption takes either key, a secret one skips the public key product.
+ * Messages are bits, or integers mod 2^plaintext_bits. */
+gsw_ciphertext* gsw_encrypt(const gsw_params*, const gsw_key*, uint64_t message);
+int gsw_encrypt_batch(const gsw_params*, const gsw_key*, const uint64_t* messages, size_t count,
+                      gsw_ciphertext** out);
+/* Needs the secret key */
+int gsw_decrypt(const gsw_params*, const gsw_key*, const gsw_ciphertext*, uint64_t* message);
+int gsw_decrypt_batch(const gsw_params*, const gsw_key*, gsw_ciphertext* const* in, size_t count,
+                      uint64_t* messages);
+void gsw_ciphertext_free(gsw_ciphertext*);
+/* gsw_ciphertext_words words, 64 bits to a word as the server sends them */
+int gsw_ciphertext_export(const gsw_params*, const gsw_ciphertext*, uint64_t* words);
+gsw_ciphertext* gsw_ciphertext_import(const gsw_params*, const uint64_t* words);
+
+/* Gates on ciphertexts, mux is c ? x : y for a bit c */
+gsw_ciphertext* gsw_nand(const gsw_params*, const gsw_ciphertext* a, const gsw_ciphertext* b);
+gsw_ciphertext* gsw_and(const gsw_params*, const gsw_ciphertext* a, const gsw_ciphertext* b);
+gsw_ciphertext* gsw_xor(const gsw_params*, const gsw_ciphertext* a, const gsw_ciphertext* b);
+gsw_ciphertext* gsw_not(const gsw_params*, const gsw_ciphertext* a);
+gsw_ciphertext* gsw_mux(const gsw_params*, const gsw_ciphertext* c, const gsw_ciphertext* x,
+                        const gsw_ciphertext* y);
+/* count pairs a[i], b[i] */
+int gsw_nand_batch(const gsw_params*, gsw_ciphertext* const* a, gsw_ciphertext* const* b, size_t count,
+                   gsw_ciphertext** out);
+
+/* A Bristol or compiled circuit, as gsw-fhe -c takes */
+gsw_circuit* gsw_circuit_load(const char* path);
+void gsw_circuit_free(gsw_circuit*);
+size_t gsw_circuit_inputs(const gsw_circuit*);
+/* Outputs an evaluation returns, all of them unless selected */
+size_t gsw_circuit_outputs(const gsw_circuit*);
+/* A non zero byte for every output wanted, as gsw-fhe -O */
+int gsw_circuit_select(gsw_circuit*, const uint8_t* wanted, size_t count);
+/* gsw_circuit_inputs ciphertexts in, gsw_circuit_outputs out. The circuit
+ * keeps its gates between calls, evaluating it again only recomputes the
+ * gates reading inputs that changed. */
+int gsw_circuit_eval(const gsw_params*, gsw_circuit*, gsw_ciphertext* const* in, gsw_ciphertext** out);
+/* sets input sets one after another in, their outputs in the same order out */
+int gsw_circuit_eval_batch(const gsw_params*, gsw_circuit*, gsw_ciphertext* const* in, size_t sets,
+                           gsw_ciphertext** out);
+/* Gates the last evaluation took from the one before and computed */
+void gsw_circuit_counts(const gsw_circuit*, uint64_t* reused, uint64_t* recomputed);
+
+/* Bytes of ciphertexts copied rather than shared since the library was
+ * loaded, outputs of a circuit share the ciphertexts of its gates */
+uint64_t gsw_copied_bytes(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
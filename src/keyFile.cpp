@@ -0,0 +1,104 @@
+#include <fstream>
+#include <sstream>
+#include <regex>
+#include <vector>
+#include <cstdio>
+
+#include "keyFile.hpp"
+#include "ringGsw.hpp"
+
+using namespace std;
+
+string read_key_scheme(const char* file_path, bool *secret) {
+    string tmp;
+    std::smatch match;
+    std::ifstream file(file_path);
+
+    if (!file.good()) {
+        throw ex("Key file not found");
+    }
+
+    std::getline(file, tmp);
+    if (!std::regex_match(tmp, match, std::regex("-----BEGIN (R?GSW) (SECRET|PUBLIC) KEY-----"))) {
+        throw ex("Invalid key file");
+    }
+    if (secret) {
+        *secret = match[2] == "SECRET";
+    }
+    return match[1];
+}
+
+GSWBase* new_scheme(const string& name) {
+    if (name == "RGSW") {
+        return new RingGSW();
+    }
+    return new GSW();
+}
+
+BIMatrix read_key(const char* file_path, GSWBase &gsw) {
+    BIMatrix key;
+    BigInt q;
+    string tmp;
+    vector<string> lines;
+    std::ifstream file(file_path);
+
+    if (!file.good()) {
+        throw ex("Key file not found");
+    }
+
+    std::getline(file, tmp);
+    if (!std::regex_match(tmp, std::regex("-----BEGIN " + gsw.name() + " (SECRET|PUBLIC) KEY-----"))) {
+        throw ex("Invalid key file");
+    }
+
+    // n, m, q, then k and the plaintext bits (missing in keys from before
+    // they were configurable, which are 1 for both) and the key itself on
+    // the last line
+    const std::regex end("-----END " + gsw.name() + " (SECRET|PUBLIC) KEY-----");
+    while (getline(file, tmp) && !std::regex_match(tmp, end)) {
+        lines.push_back(tmp);
+    }
+    if (!std::regex_match(tmp, end) || lines.size() < 4 || lines.size() > 6) {
+        throw ex("Invalid key file");
+    }
+    file.close();
+
+    // use extracted params
+    q = NTL::conv<NTL::ZZ>(lines[2].c_str());
+    const unsigned int k = lines.size() >= 5 ? stoul(lines[3]) : 1;
+    gsw.set_params(stoul(lines[0]), stoul(lines[1]), q, k);
+    gsw.set_plaintext_bits(lines.size() == 6 ? stoul(lines[4]) : 1);
+
+    stringstream sskey(lines.back());
+    string key_bit;
+    while(sskey >> key_bit) {
+        key.push_back(NTL::conv<NTL::ZZ>(key_bit.c_str()));
+    }
+    return key;
+}
+
+void write_key(const char* file_path, const GSWBase &gsw, const BIMatrix& key, bool secret) {
+    const char *output =
+        "-----BEGIN %s %s KEY-----\n"
+        "%i\n" // n
+        "%i\n" // m
+        "%s\n" // q
+        "%u\n" // k
+        "%u\n" // plaintext bits
+        "%s\n" // key
+        "-----END %s %s KEY-----\n"
+        ;
+    std::stringstream skey, q;
+    skey << key;
+    q << gsw.quotient;
+
+    FILE *fp = fopen(file_path, "w");
+    if (!fp) {
+        throw ex("Can not write key file");
+    }
+    const string name = gsw.name();
+    const char *kind = secret ? "SECRET" : "PUBLIC";
+    fprintf(fp, output, name.c_str(), kind, gsw.n, gsw.m, q.str().c_str(), gsw.k, gsw.plaintext_bits,
+            skey.str().c_str(), name.c_str(), kind);
+    fclose(fp);
+}
@@ -0,0 +1,17 @@
+/* Key files, a tagged text block with the parameters and the key
+ */
+#pragma once
+
+#include <string>
+
+#include "utils.hpp"
+#include "gsw.hpp"
+
+// Scheme tag of a key file, i.e. GSW or RGSW. secret, when given, is set to
+// whether it holds a secret key.
+std::string read_key_scheme(const char* file_path, bool *secret = NULL);
+// A scheme of the kind the tag names, without parameters
+GSWBase* new_scheme(const std::string& name);
+// Sets gsw's parameters to those of the file and returns its key
+BIMatrix read_key(const char* file_path, GSWBase &gsw);
+void write_key(const char* file_path, const GSWBase &gsw, const BIMatrix& key, bool secret);
@@ -0,0 +1,92 @@
+#include <omp.h>
+
+#include <Eigen/Dense>
+
+#include "matrixBackend.hpp"
+
+using namespace std;
+
+MatrixBackend* MatrixBackend::create(const string& name) {
+    if (name == "reference") {
+        return new ReferenceBackend();
+    }
+    if (name == "eigen") {
+        return new EigenBackend();
+    }
+    throw ex("Unknown matrix backend " + name);
+}
+
+string ReferenceBackend::name() const {
+    return "reference";
+}
+
+void ReferenceBackend::product(const vector<uint16_t>& A, const vector<uint16_t>& B,
+        unsigned int N, unsigned int /* k */, vector<int64_t>& C) const {
+    C.assign((size_t) N * N, 0);
+# pragma omp parallel for shared (A, B, C) schedule(guided)
+    for (unsigned int i = 0; i < N; i++) {
+        int64_t *C_i = &C[(size_t) i*N];
+        for (unsigned int t = 0; t < N; t++) {
+            const int64_t a_it = A[(size_t) i*N + t];
+            if (!a_it) continue;
+            const uint16_t *B_t = &B[(size_t) t*N];
+            for (unsigned int j = 0; j < N; j++) {
+                C_i[j] += a_it * B_t[j];
+            }
+        }
+    }
+}
+
+string EigenBackend::name() const {
+    return "eigen";
+}
+
+template <typename T>
+static void eigen_product(const vector<uint16_t>& A, const vector<uint16_t>& B,
+        unsigned int N, unsigned int panel_rows, vector<int64_t>& C) {
+    typedef Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> Mat;
+
+    Mat B_mat(N, N);
+# pragma omp parallel for shared (B, B_mat) schedule(static)
+    for (unsigned int t = 0; t < N; t++) {
+        for (unsigned int j = 0; j < N; j++) {
+            B_mat(t, j) = B[(size_t) t*N + j];
+        }
+    }
+
+    C.resize((size_t) N * N);
+    const unsigned int panels = (N + panel_rows - 1) / panel_rows;
+# pragma omp parallel for shared (A, B_mat, C) schedule(dynamic)
+    for (unsigned int p = 0; p < panels; p++) {
+        const unsigned int first = p * panel_rows;
+        const unsigned int rows = min(panel_rows, N - first);
+        Mat A_panel(rows, N);
+        for (unsigned int i = 0; i < rows; i++) {
+            for (unsigned int t = 0; t < N; t++) {
+                A_panel(i, t) = A[(size_t) (first + i)*N + t];
+            }
+        }
+        Mat C_panel(rows, N);
+        C_panel.noalias() = A_panel * B_mat;
+        for (unsigned int i = 0; i < rows; i++) {
+            for (unsigned int j = 0; j < N; j++) {
+                C[(size_t) (first + i)*N + j] = (int64_t) C_panel(i, j);
+            }
+        }
+    }
+}
+
+void EigenBackend::product(const vector<uint16_t>& A, const vector<uint16_t>& B,
+        unsigned int N, unsigned int k, vector<int64_t>& C) const {
+    // Every partial sum is an integer below the bound, so floating point
+    // is exact as long as the bound fits in the mantissa
+    const uint64_t digit_max = (1ull << k) - 1;
+    const uint64_t bound = N * digit_max * digit_max;
+    if (bound < (1ull << 24)) {
+        eigen_product<float>(A, B, N, panel_rows, C);
+    } else if (bound < (1ull << 53)) {
+        eigen_product<double>(A, B, N, panel_rows, C);
+    } else {
+        eigen_product<int64_t>(A, B, N, panel_rows, C);
+    }
+}
@@ -0,0 +1,45 @@
+/* Exact products of flattened ciphertexts
+ */
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "utils.hpp"
+
+// Computes C = A * B for N x N row major matrices of base 2^k digits.
+// Entries of C are bounded by N(2^k - 1)^2, so integer arithmetic is
+// exact and every backend has to return the same result.
+class MatrixBackend {
+public:
+    virtual ~MatrixBackend() {};
+
+    virtual std::string name() const = 0;
+    virtual void product(const std::vector<uint16_t>& A, const std::vector<uint16_t>& B,
+            unsigned int N, unsigned int k, std::vector<int64_t>& C) const = 0;
+
+    // Backend by name, "reference" or "eigen"
+    static MatrixBackend* create(const std::string& name);
+};
+
+// Row by row triple loop, skipping zero digits of A
+class ReferenceBackend : public MatrixBackend {
+public:
+    std::string name() const;
+    void product(const std::vector<uint16_t>& A, const std::vector<uint16_t>& B,
+            unsigned int N, unsigned int k, std::vector<int64_t>& C) const;
+};
+
+// Eigen GEMM over panels of rows, one panel per thread. Eigen blocks the
+// panel product for cache itself. Uses float while N(2^k - 1)^2 fits in
+// its mantissa, then double, then 64 bit integers, the floating point
+// kernels being the vectorised ones.
+class EigenBackend : public MatrixBackend {
+public:
+    static const unsigned int panel_rows = 256;
+
+    std::string name() const;
+    void product(const std::vector<uint16_t>& A, const std::vector<uint16_t>& B,
+            unsigned int N, unsigned int k, std::vector<int64_t>& C) const;
+};
@@ -0,0 +1,103 @@
+#include <cstring>
+#include <cerrno>
+
+#include <unistd.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include "net.hpp"
+#include "utils.hpp"
+
+using namespace std;
+
+bool read_all(int fd, void *buf, size_t len) {
+    char *p = (char *) buf;
+    while (len) {
+        const ssize_t r = read(fd, p, len);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return false;
+        p += r;
+        len -= r;
+    }
+    return true;
+}
+
+bool write_all(int fd, const void *buf, size_t len) {
+    const char *p = (const char *) buf;
+    while (len) {
+        // a peer that went away must not kill the process with SIGPIPE
+        const ssize_t r = send(fd, p, len, MSG_NOSIGNAL);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return false;
+        p += r;
+        len -= r;
+    }
+    return true;
+}
+
+namespace {
+
+void no_delay(int fd) {
+    // ciphertexts are written in one go, nothing to coalesce
+    const int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+}
+
+int listen_tcp(unsigned int port) {
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+
+    const int fd = socket(AF_INET, SOCK_STREAM, 0);
+    const int one = 1;
+    if (fd < 0 || setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0 ||
+        ::bind(fd, (sockaddr *) &addr, sizeof(addr)) < 0 || listen(fd, 64) < 0) {
+        if (fd >= 0) close(fd);
+        throw ex("Can not listen on port " + to_string(port));
+    }
+    return fd;
+}
+
+int connect_tcp(const string& address) {
+    const size_t colon = address.rfind(':');
+    if (colon == string::npos) {
+        throw ex("Expected host:port, got " + address);
+    }
+    const string host = address.substr(0, colon), port = address.substr(colon + 1);
+
+    addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &res) != 0) {
+        throw ex("Can not resolve " + address);
+    }
+    int fd = -1;
+    for (addrinfo *ai = res; ai && fd < 0; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd >= 0 && connect(fd, ai->ai_addr, ai->ai_addrlen) < 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(res);
+    if (fd < 0) {
+        throw ex("Can not connect to " + address);
+    }
+    no_delay(fd);
+    return fd;
+}
+
+int accept_tcp(int listen_fd) {
+    const int fd = accept(listen_fd, NULL, NULL);
+    if (fd >= 0) {
+        no_delay(fd);
+    }
+    return fd;
+}
@@ -0,0 +1,18 @@
+/* Blocking socket helpers for the server and distributed evaluation
+ */
+#pragma once
+
+#include <string>
+#include <cstddef>
+
+// Whole buffers or false on EOF and errors, EINTR is retried. Writes never
+// raise SIGPIPE.
+bool read_all(int fd, void *buf, size_t len);
+bool write_all(int fd, const void *buf, size_t len);
+
+// TCP sockets with Nagle off, listening on every interface or connected to
+// "host:port". Both throw ex on failure.
+int listen_tcp(unsigned int port);
+int connect_tcp(const std::string& address);
+// Next connection on a listen_tcp socket, -1 on error
+int accept_tcp(int listen_fd);
@@ -0,0 +1,118 @@
+/* Negacyclic NTT, following Longa and Naehrig "Speeding up the Number
+ * Theoretic Transform for Faster Ideal Lattice-Based Cryptography"
+ */
+
+#include <NTL/ZZ.h>
+
+#include "utils.hpp"
+#include "ntt.hpp"
+
+static unsigned int bit_reverse(unsigned int x, unsigned int bits) {
+    unsigned int r = 0;
+    for (unsigned int i = 0; i < bits; i++) {
+        r = (r << 1) | ((x >> i) & 1);
+    }
+    return r;
+}
+
+NTT::NTT(uint64_t q, unsigned int d) : q(q), d(d) {
+    if (!is_ntt_prime(q, d)) {
+        throw ex("NTT: q must be a prime with q = 1 mod 2d");
+    }
+
+    // find a primitive 2d-th root of unity, i.e. psi^d = -1
+    uint64_t psi = 0;
+    for (uint64_t g = 2; g < q; g++) {
+        psi = pow_mod(g, (q - 1) / (2 * d));
+        if (pow_mod(psi, d) == q - 1) break;
+    }
+    uint64_t psi_inv = pow_mod(psi, q - 2);
+
+    unsigned int log_d = 0;
+    while ((1u << log_d) < d) log_d++;
+
+    psi_rev.resize(d);
+    psi_inv_rev.resize(d);
+    uint64_t p = 1, p_inv = 1;
+    for (unsigned int i = 0; i < d; i++) {
+        psi_rev[bit_reverse(i, log_d)] = p;
+        psi_inv_rev[bit_reverse(i, log_d)] = p_inv;
+        p = mul_mod(p, psi);
+        p_inv = mul_mod(p_inv, psi_inv);
+    }
+    d_inv = pow_mod(d, q - 2);
+}
+
+uint64_t NTT::pow_mod(uint64_t a, uint64_t e) const {
+    uint64_t r = 1;
+    a %= q;
+    while (e) {
+        if (e & 1) r = mul_mod(r, a);
+        a = mul_mod(a, a);
+        e >>= 1;
+    }
+    return r;
+}
+
+void NTT::forward(Poly& a) const {
+    unsigned int t = d;
+    for (unsigned int m = 1; m < d; m <<= 1) {
+        t >>= 1;
+        for (unsigned int i = 0; i < m; i++) {
+            const uint64_t s = psi_rev[m + i];
+            const unsigned int j1 = 2 * i * t, j2 = j1 + t;
+            for (unsigned int j = j1; j < j2; j++) {
+                uint64_t u = a[j], v = mul_mod(a[j + t], s);
+                a[j] = add_mod(u, v);
+                a[j + t] = sub_mod(u, v);
+            }
+        }
+    }
+}
+
+void NTT::inverse(Poly& a) const {
+    unsigned int t = 1;
+    for (unsigned int m = d; m > 1; m >>= 1) {
+        unsigned int j1 = 0;
+        const unsigned int h = m >> 1;
+        for (unsigned int i = 0; i < h; i++) {
+            const uint64_t s = psi_inv_rev[h + i];
+            for (unsigned int j = j1; j < j1 + t; j++) {
+                uint64_t u = a[j], v = a[j + t];
+                a[j] = add_mod(u, v);
+                a[j + t] = mul_mod(sub_mod(u, v), s);
+            }
+            j1 += 2 * t;
+        }
+        t <<= 1;
+    }
+    for (unsigned int j = 0; j < d; j++) {
+        a[j] = mul_mod(a[j], d_inv);
+    }
+}
+
+Poly NTT::mul(const Poly& a, const Poly& b) const {
+    Poly a_hat(a), b_hat(b);
+    forward(a_hat);
+    forward(b_hat);
+    for (unsigned int i = 0; i < d; i++) {
+        a_hat[i] = mul_mod(a_hat[i], b_hat[i]);
+    }
+    inverse(a_hat);
+    return a_hat;
+}
+
+bool NTT::is_ntt_prime(uint64_t q, unsigned int d) {
+    return q < (1ull << 62) && q % (2 * d) == 1 && NTL::ProbPrime((long) q);
+}
+
+uint64_t NTT::next_ntt_prime(uint64_t lower_bound, unsigned int d) {
+    uint64_t q = (lower_bound / (2 * d) + 1) * 2 * d + 1;
+    while (!is_ntt_prime(q, d)) {
+        q += 2 * d;
+        if (q >= (1ull << 62)) {
+            throw ex("NTT: no word sized prime above the lower bound");
+        }
+    }
+    return q;
+}
@@ -0,0 +1,44 @@
+/* Negacyclic number theoretic transform over Z_q[X]/(X^d + 1)
+ */
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+typedef std::vector<uint64_t> Poly;
+
+class NTT {
+public:
+    uint64_t q; // prime, q = 1 mod 2d, q < 2^62
+    unsigned int d; // power of 2
+
+    NTT(uint64_t q, unsigned int d);
+
+    // In place, coefficients in [0, q)
+    void forward(Poly&) const;
+    void inverse(Poly&) const;
+
+    // c = a * b mod (X^d + 1)
+    Poly mul(const Poly&, const Poly&) const;
+
+    static bool is_ntt_prime(uint64_t q, unsigned int d);
+    static uint64_t next_ntt_prime(uint64_t lower_bound, unsigned int d);
+
+    inline uint64_t mul_mod(uint64_t a, uint64_t b) const {
+        return (unsigned __int128) a * b % q;
+    }
+    inline uint64_t add_mod(uint64_t a, uint64_t b) const {
+        uint64_t c = a + b;
+        return c >= q ? c - q : c;
+    }
+    inline uint64_t sub_mod(uint64_t a, uint64_t b) const {
+        return a >= b ? a - b : a + q - b;
+    }
+
+private:
+    // powers of psi (primitive 2d-th root of unity) in bit reversed order
+    std::vector<uint64_t> psi_rev, psi_inv_rev;
+    uint64_t d_inv;
+
+    uint64_t pow_mod(uint64_t, uint64_t) const;
+};
@@ -0,0 +1,162 @@
+#include <cmath>
+#include <iomanip>
+#include <algorithm>
+
+#include <NTL/ZZ.h>
+
+#include "paramTuner.hpp"
+#include "gsw.hpp"
+#include "ntt.hpp"
+
+using namespace std;
+using namespace NTL;
+
+ParamTuner::ParamTuner(const CircuitFile& circuit, int kappa, unsigned int k, bool ring, unsigned int fail_bits,
+                       unsigned int plaintext_bits)
+    : n(0), circuit(circuit), order(circuit.topological_order()), kappa(kappa), k(k), ring(ring),
+      plaintext_bits(plaintext_bits) {
+    // P(|e| > z sd) <= 2 exp(-z^2/2), union bound over the outputs and,
+    // for Ring-GSW, the coefficients of their noise
+    z = sqrt(2 * (log(2.0) + log((double) max<uint64_t>(circuit.header.num_out, 1)) + fail_bits * log(2.0)));
+
+    BigInt lower_bound, g;
+    q = 4;
+    while (true) {
+        fit(q);
+        // a larger n can leave q no longer 1 mod 2n
+        if (ring && !NTT::is_ntt_prime(to_long(q), n)) {
+            q = (long) NTT::next_ntt_prime(to_long(q), n);
+            continue;
+        }
+        noise_bits = output_noise_bits(q);
+        // decryption fails at g/2t, g the largest power of B <= q/2
+        lower_bound = power2_ZZ((long) ceil(noise_bits) + 1 + plaintext_bits);
+        g = power2_ZZ(k*((NumBits(q/2) - 1) / k));
+        if (2 * g > lower_bound) {
+            break;
+        }
+        g = 1;
+        while (2 * g <= lower_bound) {
+            g <<= k;
+        }
+        if (ring) {
+            if (NumBits(g) >= 61) {
+                throw ex("ParamTuner: circuit too deep for a word sized quotient");
+            }
+            q = (long) NTT::next_ntt_prime(2 * to_long(g), n);
+        } else {
+            NextPrime(q, 2 * g);
+        }
+    }
+}
+
+void ParamTuner::fit(const BigInt& q) {
+    // the same lattice dimension rule as the constructors
+    const double log_q = log(q)/log(2.0);
+    const double min_n = (log_q - log2(ceil(sigma))) * (kappa + 110) / 7.2;
+    l = (NumBits(q) + k - 1) / k;
+    if (ring) {
+        if (n == 0) n = 2;
+        while (n < min_n) n <<= 1;
+        N = 2 * l;
+        m = NumBits(q);
+    } else {
+        n = max(min_n, 1.0);
+        N = (n + 1) * l;
+        m = ceil(n * log_q);
+    }
+}
+
+double ParamTuner::output_noise_bits(const BigInt& q) const {
+    const CircuitHeader &h = circuit.header;
+    // a message jt decrypts as j 2g = -j (q - 2g) mod q, so every wrap past
+    // the plaintext modulus adds q - 2g to the noise, negative ones too
+    const long double t = 1 << plaintext_bits;
+    const long double wrap = to_double(q - 2 * power2_ZZ(k*((NumBits(q/2) - 1) / k)));
+    const long double zd = ring ? sqrt(z*z + 2 * log((double) n)) : z;
+    const long double B = 1 << k, digit_sq = (B - 1) * (2*B - 1) / 6;
+    const long double d = ring ? n : 1;
+    // R is binary in GSW and ternary in Ring-GSW
+    const long double fresh = m * d * (ring ? 2.0L/3 : 0.5L) * sigma * sigma;
+    const long double spread = N * d * digit_sq;
+
+    // message of each wire lies in [lo, hi]
+    vector<long double> var(h.num_wires, 0), lo(h.num_wires, 0), hi(h.num_wires, 0);
+    for (uint64_t i = 0; i < h.num_in1 + h.num_in2; i++) {
+        var[i] = fresh;
+        hi[i] = t - 1;
+    }
+    for (auto i : order) {
+        const CircuitGate &g = circuit.gates[i];
+        const uint32_t a = g.in1, b = g.in2;
+        switch (g.type) {
+            case XOR:
+            case ADD:
+                var[g.out] = var[a] + var[b];
+                lo[g.out] = lo[a] + lo[b];
+                hi[g.out] = hi[a] + hi[b];
+                break;
+            case CMUL:
+                var[g.out] = (long double) g.constant * g.constant * var[a];
+                lo[g.out] = min(g.constant * lo[a], g.constant * hi[a]);
+                hi[g.out] = max(g.constant * lo[a], g.constant * hi[a]);
+                break;
+            case INV:
+                var[g.out] = var[a];
+                lo[g.out] = 1 - hi[a];
+                hi[g.out] = 1 - lo[a];
+                break;
+            case AND:
+            case NAND: {
+                // A * B, the left operand's noise is scaled by the right message
+                const long double mu_b = max(fabsl(lo[b]), fabsl(hi[b]));
+                var[g.out] = spread * var[b] + mu_b * mu_b * var[a];
+                const long double p[] = {lo[a]*lo[b], lo[a]*hi[b], hi[a]*lo[b], hi[a]*hi[b]};
+                lo[g.out] = *min_element(p, p + 4);
+                hi[g.out] = *max_element(p, p + 4);
+                if (g.type == NAND) {
+                    swap(lo[g.out], hi[g.out]);
+                    lo[g.out] = 1 - lo[g.out];
+                    hi[g.out] = 1 - hi[g.out];
+                }
+                break;
+            }
+            case MUX: {
+                // D * C + Y with D = X - Y, for a bit c
+                const uint32_t c = g.in3;
+                const long double mu_a = max(fabsl(lo[a]), fabsl(hi[a]));
+                var[g.out] = spread * var[a] + mu_a * mu_a * (var[b] + var[c]) + var[c];
+                lo[g.out] = min(lo[b], lo[c]);
+                hi[g.out] = max(hi[b], hi[c]);
+                break;
+            }
+        }
+    }
+
+    long double worst = zd * sqrtl(fresh);
+    for (uint64_t w = h.num_wires - h.num_out; w < h.num_wires; w++) {
+        const long double wraps = max(floorl(hi[w] / t), ceill(-lo[w] / t));
+        worst = max(worst, zd * sqrtl(var[w]) + wraps * wrap);
+    }
+    return log2l(worst);
+}
+
+long double ParamTuner::product_cost(unsigned int N, unsigned int d, bool ring) {
+    if (ring) {
+        // N^2 pointwise products plus N forward NTTs of a row's digits
+        return (long double) N * N * d + (long double) N * N * d * log2(d) / 2;
+    }
+    return (long double) N * N * N;
+}
+
+void ParamTuner::print(ostream& fp) const {
+    const uint64_t products = circuit.header.gate_count[AND] + circuit.header.gate_count[NAND] +
+                             circuit.header.gate_count[MUX];
+    const long double cost = product_cost(N, n, ring);
+    fp << scientific << setprecision(2);
+    fp << "tuned: q " << NumBits(q) << " bits, n " << n << ", m " << m << ", N " << N
+       << ", output noise " << fixed << setprecision(1) << noise_bits << " bits (z = " << z << ")" << endl;
+    fp << scientific << setprecision(2);
+    fp << "       " << cost << " multiply-adds per product, " << products << " products, "
+       << cost * products << " in total" << endl;
+}
@@ -0,0 +1,46 @@
+/* Parameters sized from the noise growth of an actual circuit rather than
+ * the worst case bound of the GSW constructors
+ */
+#pragma once
+
+#include "utils.hpp"
+#include "circuitFile.hpp"
+
+// Noise is tracked per wire as a variance:
+//   fresh   m/2 sigma^2, m d 2/3 sigma^2 for Ring-GSW's ternary R
+//   add     sum of the variances
+//   product N d E[digit^2] var2 + mu2^2 var1, mu2 the right message
+//   c *     c^2 var
+//   mux     N d E[digit^2] var_c + mu_c^2 (var_x + var_y) + var_y
+// where mu is bounded per wire too, additions grow it. The quotient has
+// to fit z standard deviations of the noisiest output, plus the offset of
+// every wrap of its message past the plaintext modulus t, in q/2t, with z
+// from a Gaussian tail bound on the failure probability.
+class ParamTuner {
+public:
+    // Chosen parameters, n is the ring dimension for Ring-GSW
+    BigInt q;
+    unsigned int n, m, l, N;
+    double noise_bits; // log2 of the noise bound of the noisiest output
+
+    ParamTuner(const CircuitFile&, int kappa, unsigned int k, bool ring, unsigned int fail_bits,
+               unsigned int plaintext_bits);
+
+    // Multiply-adds per ciphertext product
+    static long double product_cost(unsigned int N, unsigned int d, bool ring);
+    void print(std::ostream&) const;
+
+private:
+    const CircuitFile &circuit;
+    std::vector<uint32_t> order;
+    int kappa;
+    unsigned int k;
+    bool ring;
+    unsigned int plaintext_bits;
+    double z;
+
+    // n, m, l and N that go with a quotient
+    void fit(const BigInt& q);
+    // log2 of the largest output noise bound at quotient q
+    double output_noise_bits(const BigInt& q) const;
+};
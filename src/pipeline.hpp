@@ -0,0 +1,192 @@
+/* Bounded queues between threads, and the stages gsw-fhe streams through
+ */
+#pragma once
+
+#include <deque>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <functional>
+#include <exception>
+#include <cstdint>
+
+// Pushes block while it is full and pops while it is empty, until closed.
+// Aborting also drops what is queued.
+template <typename T>
+class BoundedQueue {
+public:
+    BoundedQueue(size_t capacity) : capacity(capacity), closed(false) { }
+
+    // false once closed
+    bool push(T&& item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        not_full.wait(lock, [this] { return closed || items.size() < capacity; });
+        if (closed) {
+            return false;
+        }
+        items.push_back(std::move(item));
+        not_empty.notify_one();
+        return true;
+    }
+
+    // false once closed and empty
+    bool pop(T& item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        not_empty.wait(lock, [this] { return closed || !items.empty(); });
+        if (items.empty()) {
+            return false;
+        }
+        item = std::move(items.front());
+        items.pop_front();
+        not_full.notify_one();
+        return true;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        not_full.notify_all();
+        not_empty.notify_all();
+    }
+
+    void abort() {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        items.clear();
+        not_full.notify_all();
+        not_empty.notify_all();
+    }
+
+private:
+    const size_t capacity;
+    bool closed;
+    std::deque<T> items;
+    std::mutex mutex;
+    std::condition_variable not_full, not_empty;
+};
+
+// Runs read on a reader thread until it returns false, compute on the calling
+// thread and write on a writer thread, with at most depth items queued between
+// them. Memory does not grow with the stream and the three overlap. The first
+// exception of any stage stops the others and is rethrown.
+template <typename In, typename Out>
+void pipeline(std::function<bool(In&)> read, std::function<void(In&, Out&)> compute,
+              std::function<void(Out&)> write, size_t depth = 4) {
+    BoundedQueue<In> in(depth);
+    BoundedQueue<Out> out(depth);
+    std::mutex error_mutex;
+    std::exception_ptr error;
+    auto fail = [&]() {
+        {
+            std::lock_guard<std::mutex> lock(error_mutex);
+            if (!error) {
+                error = std::current_exception();
+            }
+        }
+        in.abort();
+        out.abort();
+    };
+
+    std::thread reader([&]() {
+        try {
+            In item;
+            while (read(item) && in.push(std::move(item))) {
+                item = In();
+            }
+        } catch (...) {
+            fail();
+        }
+        in.close();
+    });
+    std::thread writer([&]() {
+        try {
+            Out item;
+            while (out.pop(item)) {
+                write(item);
+            }
+        } catch (...) {
+            fail();
+        }
+    });
+    try {
+        In item;
+        while (in.pop(item)) {
+            Out result;
+            compute(item, result);
+            if (!out.push(std::move(result))) {
+                break;
+            }
+        }
+    } catch (...) {
+        fail();
+    }
+    out.close();
+    // a failed writer leaves the reader blocked on a full queue otherwise
+    reader.join();
+    writer.join();
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+// Writes items numbered from 0 in order on its own thread, holding back those
+// that arrive early
+template <typename T>
+class OrderedWriter {
+public:
+    OrderedWriter(std::function<void(const T&)> write, size_t depth = 4)
+        : queue(depth), write(write), thread([this]() { run(); }) { }
+
+    ~OrderedWriter() {
+        if (thread.joinable()) {
+            queue.abort();
+            thread.join();
+        }
+    }
+
+    // Rethrows a failed write
+    void push(uint64_t index, T&& item) {
+        if (!queue.push(std::make_pair(index, std::move(item)))) {
+            finish();
+        }
+    }
+
+    // Waits for everything to be written
+    void finish() {
+        queue.close();
+        if (thread.joinable()) {
+            thread.join();
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+private:
+    BoundedQueue<std::pair<uint64_t, T> > queue;
+    std::function<void(const T&)> write;
+    std::exception_ptr error;
+    std::thread thread;
+
+    void run() {
+        try {
+            std::map<uint64_t, T> early;
+            uint64_t next = 0;
+            std::pair<uint64_t, T> item;
+            while (queue.pop(item)) {
+                early[item.first] = std::move(item.second);
+                for (auto it = early.begin(); it != early.end() && it->first == next; it = early.erase(it)) {
+                    write(it->second);
+                    next++;
+                }
+            }
+        } catch (...) {
+            error = std::current_exception();
+            queue.abort();
+        }
+    }
+
+    OrderedWriter(const OrderedWriter&);
+    OrderedWriter& operator=(const OrderedWriter&);
+};
@@ -0,0 +1,484 @@
+#include <cmath>
+
+#include <omp.h>
+
+#include <NTL/ZZ.h>
+
+#include "ringGsw.hpp"
+
+using namespace std;
+using namespace NTL;
+
+RingGSW::RingGSW() : ntt(NULL) {
+    gaussSampler = new GaussSampler(sigma);
+
+    omp_set_num_threads(4);
+}
+
+RingGSW::RingGSW(const int kappa, const int L, const unsigned int k, const unsigned int plaintext_bits,
+                 const unsigned int noise_bits) : ntt(NULL) {
+    // Search for suitable parameters:
+    // d >= log(q/sigma)(kappa+110)/7.2, rounded up to a power of 2
+    // q/sigma6 > 8 m d ((B - 1) N d + 1)^L, B = 2^k
+    // Fresh noise is a sum of m*d gaussian samples and every product
+    // multiplies it by at most (B - 1)N*d. As in GSW, q is the next NTT
+    // prime after 2B^j so that the parity of a message can be decrypted,
+    // and p bit integer messages need 2^(p - 1) times more room, plus the
+    // noise_bits of additions and scalar products.
+    if (k < 1 || k > 16) {
+        throw ex("RingGSW: gadget base must be 2^k with 1 <= k <= 16");
+    }
+    long double lower_bound;
+    unsigned int d = 2;
+    uint64_t q = 4, g;
+    while (true) {
+        l = (NumBits((long) q) + k - 1) / k;
+        N = 2 * l;
+        // log q samples whatever the gadget, a ternary combination of
+        // fewer is far from uniform
+        m = NumBits((long) q);
+        double min_d = log2(q/ceil(sigma))*(kappa+110)/7.2;
+        while (d < min_d) d <<= 1;
+
+        lower_bound = 8.0L * sigma6 * m * d * powl((long double) ((1 << k) - 1) * N * d + 1, L);
+        lower_bound = ldexpl(lower_bound, plaintext_bits - 1 + noise_bits);
+        if (lower_bound >= (long double) (1ull << 62)) {
+            throw ex("RingGSW: circuit too deep for a word sized quotient");
+        }
+        if (q > lower_bound && NTT::is_ntt_prime(q, d)) {
+            break;
+        }
+        // smallest power of B with 2B^j > lower_bound
+        g = 1;
+        while (2.0L * g <= lower_bound) {
+            g <<= k;
+        }
+        q = NTT::next_ntt_prime(2 * g, d);
+    }
+
+    gaussSampler = new GaussSampler(sigma);
+
+    BigInt big_q;
+    big_q = q;
+    set_params(d, m, big_q, k);
+    set_plaintext_bits(plaintext_bits);
+
+    omp_set_num_threads(4);
+}
+
+RingGSW::~RingGSW() {
+    delete gaussSampler;
+    delete ntt;
+}
+
+string RingGSW::name() const {
+    return "RGSW";
+}
+
+uint64_t RingGSW::ciphertext_bits() const {
+    return (uint64_t) N * N * n * k;
+}
+
+void RingGSW::set_params(unsigned int n, unsigned int m, const BigInt& q, unsigned int k) {
+    if (n == 0 || (n & (n - 1))) {
+        throw ex("RingGSW: ring dimension must be a power of 2");
+    }
+    if (NumBits(q) > 62) {
+        throw ex("RingGSW: quotient must fit in 62 bits");
+    }
+    this->n = n;
+    this->m = m;
+    this->k = k;
+    this->q = to_long(q);
+    quotient = q;
+    l = (NumBits(q) + k - 1) / k;
+    N = 2 * l;
+
+    delete ntt;
+    ntt = new NTT(this->q, n);
+}
+
+
+BIVector RingGSW::secret_key_gen() const {
+    BIVector secret_key(2 * n);
+    for (unsigned int i = 0; i < n; i++) {
+        secret_key[i] = 0;
+        secret_key[n + i] = RandomBnd(quotient);
+    }
+    secret_key[0] = 1;
+    return secret_key;
+}
+
+BIMatrix RingGSW::public_key_gen(const BIVector& sk) const {
+    Poly s(n);
+    for (unsigned int t = 0; t < n; t++) {
+        s[t] = to_long(sk[n + t]);
+    }
+    ntt->forward(s);
+
+    // m samples (b, a)
+    BIMatrix pk(m * 2 * n);
+    Poly b, a;
+    for (unsigned int j = 0; j < m; j++) {
+        sample(s, b, a);
+        for (unsigned int t = 0; t < n; t++) {
+            pk[(2*j)*n + t] = b[t];
+            pk[(2*j + 1)*n + t] = a[t];
+        }
+    }
+
+    return pk;
+}
+
+void RingGSW::sample(const Poly& s_hat, Poly& b, Poly& a) const {
+    Poly as(n);
+    a.resize(n);
+    b.resize(n);
+    for (unsigned int t = 0; t < n; t++) {
+        a[t] = RandomBnd((long) q);
+        as[t] = a[t];
+    }
+    ntt->forward(as);
+    for (unsigned int t = 0; t < n; t++) {
+        as[t] = ntt->mul_mod(as[t], s_hat[t]);
+    }
+    ntt->inverse(as);
+
+    for (unsigned int t = 0; t < n; t++) {
+        // the error is signed, negative samples map to q - |e|
+        const int64_t e = gaussSampler->sample() % sigma6;
+        b[t] = ntt->add_mod(ntt->sub_mod(0, as[t]), e < 0 ? q + e : e);
+    }
+}
+
+BitMatrix RingGSW::encrypt(const BIMatrix& public_key, const BigInt& message) const {
+    // R is ternary rather than binary: with mean 1/2 every row of R * A
+    // would share the error (1 + X + ... + X^(d-1)) * sum(e) / 2, which
+    // products multiply by another near all-ones digit polynomial. Drawn
+    // from the seeded NTL generator, as the keys are.
+    vector<Poly> pk_hat(2 * m, Poly(n));
+    for (unsigned int j = 0; j < 2 * m; j++) {
+        for (unsigned int t = 0; t < n; t++) {
+            pk_hat[j][t] = to_long(public_key[j*n + t]);
+        }
+        ntt->forward(pk_hat[j]);
+    }
+
+    vector<Poly> R(N * m, Poly(n));
+    for (size_t i = 0; i < R.size(); i++) {
+        for (unsigned int t = 0; t < n; t++) {
+            const long r = RandomBnd(3) - 1;
+            R[i][t] = r < 0 ? q - 1 : r;
+        }
+    }
+
+    // R * A
+    vector<Poly> C(N * 2);
+# pragma omp parallel for shared (R, pk_hat, C) schedule(guided)
+    for (unsigned int i = 0; i < N; i++) {
+        Poly acc0(n, 0), acc1(n, 0);
+        for (unsigned int j = 0; j < m; j++) {
+            Poly &r = R[i*m + j];
+            ntt->forward(r);
+            for (unsigned int t = 0; t < n; t++) {
+                acc0[t] = ntt->add_mod(acc0[t], ntt->mul_mod(r[t], pk_hat[2*j][t]));
+                acc1[t] = ntt->add_mod(acc1[t], ntt->mul_mod(r[t], pk_hat[2*j + 1][t]));
+            }
+        }
+        ntt->inverse(acc0);
+        ntt->inverse(acc1);
+        C[2*i].swap(acc0);
+        C[2*i + 1].swap(acc1);
+    }
+
+    return add_message(C, message);
+}
+
+BitMatrix RingGSW::encrypt_secret(const BIVector& sk, const BigInt& message) const {
+    Poly s(n);
+    for (unsigned int t = 0; t < n; t++) {
+        s[t] = to_long(sk[n + t]);
+    }
+    ntt->forward(s);
+
+    // a fresh sample per row rather than R * A
+    vector<Poly> C(N * 2);
+    for (unsigned int i = 0; i < N; i++) {
+        sample(s, C[2*i], C[2*i + 1]);
+    }
+
+    return add_message(C, message);
+}
+
+BitMatrix RingGSW::add_message(vector<Poly>& C, const BigInt& message) const {
+    // + message * G
+    uint64_t msg = rem(message, (long) q);
+    for (unsigned int i = 0; i < l; i++) {
+        uint64_t g = ntt->mul_mod(msg, (1ull << (k*i)) % q);
+        C[2*i][0] = ntt->add_mod(C[2*i][0], g);
+        C[2*(l + i) + 1][0] = ntt->add_mod(C[2*(l + i) + 1][0], g);
+    }
+
+    return bit_decomp(C);
+}
+
+bool RingGSW::decrypt_bit(const BIVector& sk, const BitMatrix& C) const {
+    const uint64_t v = 1ull << (k*decryption_row());
+
+    // constant coefficient of <C_i, sk> = message * v + e
+    uint64_t xi = phase(sk, C, row_index(C, decryption_row()))[0];
+    uint64_t dist_0 = min(xi, q - xi);
+    uint64_t dist_v = xi > v ? xi - v : v - xi;
+    dist_v = min(dist_v, q - dist_v);
+
+    return dist_v < dist_0;
+}
+
+// Largest error coefficient, the message only sits in the constant one
+BigInt RingGSW::noise(const BIVector& sk, const BitMatrix& C) const {
+    const uint64_t v = 1ull << (k*decryption_row());
+    const Poly xi = phase(sk, C, row_index(C, decryption_row()));
+
+    uint64_t dist_v = xi[0] > v ? xi[0] - v : v - xi[0];
+    uint64_t e = min(min(xi[0], q - xi[0]), min(dist_v, q - dist_v));
+    for (unsigned int t = 1; t < n; t++) {
+        e = max(e, min(xi[t], q - xi[t]));
+    }
+
+    BigInt result;
+    result = e;
+    return result;
+}
+
+BitMatrix RingGSW::nand(const BitMatrix& a, const BitMatrix& b) const {
+    // G - BitDecomp(A) * B
+    vector<Poly> res = product(a, b);
+    subtract_from_gadget(res);
+
+    return bit_decomp(res);
+}
+
+BitMatrix RingGSW::add(const BitMatrix& a, const BitMatrix& b) const {
+    vector<Poly> res = inverse_bit_decomp(a);
+    const vector<Poly> B = inverse_bit_decomp(b);
+    for (size_t i = 0; i < res.size(); i++) {
+        for (unsigned int t = 0; t < n; t++) {
+            res[i][t] = ntt->add_mod(res[i][t], B[i][t]);
+        }
+    }
+
+    return bit_decomp(res);
+}
+
+BitMatrix RingGSW::negate(const BitMatrix& a) const {
+    // G - A
+    vector<Poly> res = inverse_bit_decomp(a);
+    subtract_from_gadget(res);
+
+    return bit_decomp(res);
+}
+
+BitMatrix RingGSW::mult(const BitMatrix& a, const BitMatrix& b) const {
+    return bit_decomp(product(a, b));
+}
+
+BitMatrix RingGSW::mult_const(const BitMatrix& a, int64_t c) const {
+    const uint64_t c_mod = c < 0 ? q - (uint64_t) -c % q : (uint64_t) c % q;
+    vector<Poly> res = inverse_bit_decomp(a);
+    for (auto &p : res) {
+        for (unsigned int t = 0; t < n; t++) {
+            p[t] = ntt->mul_mod(p[t], c_mod);
+        }
+    }
+
+    return bit_decomp(res);
+}
+
+BitMatrix RingGSW::nand_row(const BitMatrix& a, const BitMatrix& b, unsigned int i) const {
+    vector<Poly> res(2);
+    product_row(a, row_index(a, i), forward_product_operand(b), res[0], res[1]);
+
+    // row i of G - BitDecomp(A) * B
+    for (auto &p : res) {
+        for (unsigned int t = 0; t < n; t++) {
+            p[t] = ntt->sub_mod(0, p[t]);
+        }
+    }
+    Poly &g = i < l ? res[0] : res[1];
+    g[0] = ntt->add_mod(g[0], (1ull << (k*(i % l))) % q);
+
+    return bit_decomp(res);
+}
+
+BitMatrix RingGSW::mult_row(const BitMatrix& a, const BitMatrix& b, unsigned int i) const {
+    vector<Poly> res(2);
+    product_row(a, row_index(a, i), forward_product_operand(b), res[0], res[1]);
+
+    return bit_decomp(res);
+}
+
+BitMatrix RingGSW::cmux(const BitMatrix& c, const BitMatrix& x, const BitMatrix& y) const {
+    // X - Y
+    vector<Poly> D = inverse_bit_decomp(x);
+    const vector<Poly> Y = inverse_bit_decomp(y);
+    for (size_t i = 0; i < D.size(); i++) {
+        for (unsigned int t = 0; t < n; t++) {
+            D[i][t] = ntt->sub_mod(D[i][t], Y[i][t]);
+        }
+    }
+
+    // BitDecomp(D) * C + Y
+    vector<Poly> res = product(bit_decomp(D), c);
+    for (size_t i = 0; i < res.size(); i++) {
+        for (unsigned int t = 0; t < n; t++) {
+            res[i][t] = ntt->add_mod(res[i][t], Y[i][t]);
+        }
+    }
+
+    return bit_decomp(res);
+}
+
+BitMatrix RingGSW::cmux_row(const BitMatrix& c, const BitMatrix& x, const BitMatrix& y, unsigned int i) const {
+    // row i of X - Y is all of D the row needs
+    vector<Poly> D(2), Y(2), res(2);
+    for (unsigned int col = 0; col < 2; col++) {
+        D[col] = inverse_bit_decomp(x, i, col);
+        Y[col] = inverse_bit_decomp(y, i, col);
+        for (unsigned int t = 0; t < n; t++) {
+            D[col][t] = ntt->sub_mod(D[col][t], Y[col][t]);
+        }
+    }
+
+    product_row(bit_decomp(D), 0, forward_product_operand(c), res[0], res[1]);
+    for (unsigned int col = 0; col < 2; col++) {
+        for (unsigned int t = 0; t < n; t++) {
+            res[col][t] = ntt->add_mod(res[col][t], Y[col][t]);
+        }
+    }
+
+    return bit_decomp(res);
+}
+
+uint64_t RingGSW::decrypt_int(const BIVector& sk, const BitMatrix& C) const {
+    // the message sits in the constant coefficient
+    BigInt xi;
+    xi = phase(sk, C, row_index(C, message_row()))[0];
+    return decode_message(xi);
+}
+
+vector<Poly> RingGSW::product(const BitMatrix& a, const BitMatrix& b) const {
+    const vector<Poly> B = forward_product_operand(b);
+
+    // BitDecomp(A) * B
+    vector<Poly> res(N * 2);
+# pragma omp parallel for shared (a, B, res) schedule(guided)
+    for (unsigned int i = 0; i < N; i++) {
+        product_row(a, i, B, res[2*i], res[2*i + 1]);
+    }
+
+    return res;
+}
+
+vector<Poly> RingGSW::forward_product_operand(const BitMatrix& b) const {
+    vector<Poly> B = inverse_bit_decomp(b);
+    for (auto &p : B) {
+        ntt->forward(p);
+    }
+    return B;
+}
+
+void RingGSW::product_row(const BitMatrix& a, unsigned int i, const vector<Poly>& B, Poly& res0, Poly& res1) const {
+    Poly acc0(n, 0), acc1(n, 0), digits(n);
+    for (unsigned int j = 0; j < N; j++) {
+        const size_t offset = ((size_t) i*N + j) * n;
+        for (unsigned int t = 0; t < n; t++) {
+            digits[t] = digit(a, offset + t);
+        }
+        ntt->forward(digits);
+        for (unsigned int t = 0; t < n; t++) {
+            acc0[t] = ntt->add_mod(acc0[t], ntt->mul_mod(digits[t], B[2*j][t]));
+            acc1[t] = ntt->add_mod(acc1[t], ntt->mul_mod(digits[t], B[2*j + 1][t]));
+        }
+    }
+    ntt->inverse(acc0);
+    ntt->inverse(acc1);
+    res0.swap(acc0);
+    res1.swap(acc1);
+}
+
+//////////////////////////////////////////////
+// Utility Functions
+//////////////////////////////////////////////
+
+Poly RingGSW::phase(const BIVector& sk, const BitMatrix& C, unsigned int i) const {
+    Poly s(n);
+    for (unsigned int t = 0; t < n; t++) {
+        s[t] = to_long(sk[n + t]);
+    }
+    Poly xi = inverse_bit_decomp(C, i, 0);
+    const Poly c1s = ntt->mul(inverse_bit_decomp(C, i, 1), s);
+    for (unsigned int t = 0; t < n; t++) {
+        xi[t] = ntt->add_mod(xi[t], c1s[t]);
+    }
+    return xi;
+}
+
+void RingGSW::subtract_from_gadget(vector<Poly>& a) const {
+    for (unsigned int i = 0; i < N; i++) {
+        for (unsigned int t = 0; t < n; t++) {
+            a[2*i][t] = ntt->sub_mod(0, a[2*i][t]);
+            a[2*i + 1][t] = ntt->sub_mod(0, a[2*i + 1][t]);
+        }
+        Poly &g = i < l ? a[2*i] : a[2*i + 1];
+        g[0] = ntt->add_mod(g[0], (1ull << (k*(i % l))) % q);
+    }
+}
+
+// Digit polynomial p of row i lives at digits [(i*N + p)*d, (i*N + p + 1)*d),
+// where p = col*l + j holds digit j of column col. Rows past the first are
+// optional, a single row decomposes to a compact ciphertext.
+BitMatrix RingGSW::bit_decomp(const vector<Poly>& a) const {
+    const unsigned int rows = a.size() / 2;
+    BitMatrix result((size_t) rows * N * n * k);
+    for (unsigned int i = 0; i < rows; i++) {
+        for (unsigned int col = 0; col < 2; col++) {
+            const Poly &p = a[2*i + col];
+            for (unsigned int j = 0; j < l; j++) {
+                const size_t offset = ((size_t) i*N + col*l + j) * n;
+                for (unsigned int t = 0; t < n; t++) {
+                    for (unsigned int b = 0; b < k; b++) {
+                        result[(offset + t)*k + b] = (p[t] >> (j*k + b)) & 1;
+                    }
+                }
+            }
+        }
+    }
+
+    return result;
+}
+
+vector<Poly> RingGSW::inverse_bit_decomp(const BitMatrix& a) const {
+    vector<Poly> result(N * 2);
+# pragma omp parallel for shared (result, a) schedule(guided)
+    for (unsigned int i = 0; i < N; i++) {
+        result[2*i] = inverse_bit_decomp(a, i, 0);
+        result[2*i + 1] = inverse_bit_decomp(a, i, 1);
+    }
+
+    return result;
+}
+
+Poly RingGSW::inverse_bit_decomp(const BitMatrix& a, unsigned int row, unsigned int col) const {
+    Poly result(n, 0);
+    for (unsigned int j = 0; j < l; j++) {
+        const size_t offset = ((size_t) row*N + col*l + j) * n;
+        for (unsigned int t = 0; t < n; t++) {
+            result[t] += (uint64_t) digit(a, offset + t) << (j*k);
+        }
+    }
+    for (unsigned int t = 0; t < n; t++) {
+        result[t] %= q;
+    }
+
+    return result;
+}
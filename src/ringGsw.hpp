@@ -0,0 +1,79 @@
+#pragma once
+
+#include "utils.hpp"
+#include "gaussSampler.hpp"
+#include "gsw.hpp"
+#include "ntt.hpp"
+
+// GSW over R_q = Z_q[X]/(X^d + 1). A ciphertext is C = R * A + message * G
+// with C in R_q^(N x 2), stored gadget decomposed, i.e. as an N x N matrix
+// of polynomials with base 2^k digit coefficients. Products are
+// C1 . C2 = BitDecomp(C1) * C2, which is N^2 polynomial multiplications
+// done in the NTT domain.
+class RingGSW : public GSWBase {
+    // n = d, the ring dimension, a power of 2
+    // quotient: q/sigma6 > 8 m d ((2^k - 1) N d + 1)^L 2^(p - 1), q = 1 mod 2d, q < 2^62
+    // m = log q, number of RLWE samples in the public key
+    // N = 2 * l
+
+public:
+    uint64_t q; // quotient as a machine word
+
+    NTT *ntt;
+    GaussSampler *gaussSampler;
+
+    RingGSW(); // parameters are left for set_params
+    RingGSW(const int, const int, const unsigned int k = 1, const unsigned int plaintext_bits = 1,
+            const unsigned int noise_bits = 0);
+    ~RingGSW();
+
+    std::string name() const;
+    uint64_t ciphertext_bits() const;
+    void set_params(unsigned int n, unsigned int m, const BigInt& q, unsigned int k);
+
+    BIVector secret_key_gen() const; //sk = (1, s), s in R_q
+    BIMatrix public_key_gen(const BIVector& secret_key) const; //pk = R_q(m, 2)
+
+    // C = BitDecomp(R * A + message * G)
+    BitMatrix encrypt(const BIMatrix& public_key, const BigInt& message) const;
+    BitMatrix encrypt_secret(const BIVector& secret_key, const BigInt& message) const;
+
+    bool decrypt_bit(const BIVector& private_key, const BitMatrix& cyphertext) const;
+    BigInt noise(const BIVector& private_key, const BitMatrix& cyphertext) const;
+
+    // Homomorphic operations
+    BitMatrix nand(const BitMatrix&, const BitMatrix&) const;
+    BitMatrix add(const BitMatrix&, const BitMatrix&) const;
+    BitMatrix negate(const BitMatrix&) const;
+    BitMatrix mult(const BitMatrix&, const BitMatrix&) const;
+    BitMatrix mult_const(const BitMatrix&, int64_t c) const;
+    uint64_t decrypt_int(const BIVector& private_key, const BitMatrix& cyphertext) const;
+    BitMatrix nand_row(const BitMatrix& a, const BitMatrix& b, unsigned int i) const;
+    BitMatrix mult_row(const BitMatrix& a, const BitMatrix& b, unsigned int i) const;
+    BitMatrix cmux(const BitMatrix& c, const BitMatrix& x, const BitMatrix& y) const;
+    BitMatrix cmux_row(const BitMatrix& c, const BitMatrix& x, const BitMatrix& y, unsigned int i) const;
+
+
+    // utility functions
+    // N x 2 polynomial matrix <-> N x N digit polynomial matrix
+    BitMatrix bit_decomp(const std::vector<Poly>&) const;
+    std::vector<Poly> inverse_bit_decomp(const BitMatrix&) const;
+    Poly inverse_bit_decomp(const BitMatrix&, unsigned int row, unsigned int col) const;
+
+private:
+    // BitDecomp(A) * B, not decomposed
+    std::vector<Poly> product(const BitMatrix&, const BitMatrix&) const;
+    // The right operand of a product, composed and in the NTT domain
+    std::vector<Poly> forward_product_operand(const BitMatrix&) const;
+    // Row i of BitDecomp(A) * B, for B from forward_product_operand
+    void product_row(const BitMatrix& a, unsigned int i, const std::vector<Poly>& B, Poly& res0, Poly& res1) const;
+    // <C_i, sk> for row i
+    Poly phase(const BIVector&, const BitMatrix&, unsigned int i) const;
+    // (b, a) with a uniform and b = -a*s + e, so that b + a*s = e, for s
+    // in the NTT domain
+    void sample(const Poly& s_hat, Poly& b, Poly& a) const;
+    // BitDecomp(C + message * G)
+    BitMatrix add_message(std::vector<Poly>& C, const BigInt& message) const;
+    // a = G - a
+    void subtract_from_gadget(std::vector<Poly>& a) const;
+};
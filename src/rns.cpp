@@ -0,0 +1,90 @@
+#include <NTL/ZZ.h>
+
+#include "rns.hpp"
+
+using namespace std;
+using namespace NTL;
+
+RNS::RNS(const vector<uint64_t>& primes) : primes(primes) {
+    modulus = 1;
+    for (auto p : primes) {
+        modulus *= (long) p;
+    }
+
+    BigInt q_i;
+    for (auto p : primes) {
+        q_i = modulus / (long) p;
+        long inv = InvMod(rem(q_i, (long) p), (long) p);
+        crt_factors.push_back(q_i * inv);
+    }
+}
+
+// Largest prime below p, p odd
+uint64_t RNS::prime_below(uint64_t p) {
+    p -= 2;
+    while (!ProbPrime((long) p)) {
+        p -= 2;
+    }
+    return p;
+}
+
+vector<uint64_t> RNS::basis_for(const BigInt& lower_bound) {
+    vector<uint64_t> basis;
+    BigInt product;
+    product = 1;
+    uint64_t p = (1ull << 61) + 1;
+    while (product <= lower_bound) {
+        p = prime_below(p);
+        basis.push_back(p);
+        product *= (long) p;
+    }
+    return basis;
+}
+
+vector<uint64_t> RNS::basis_of(const BigInt& q) {
+    vector<uint64_t> basis;
+    BigInt product;
+    product = 1;
+    uint64_t p = (1ull << 61) + 1;
+    while (product < q) {
+        p = prime_below(p);
+        basis.push_back(p);
+        product *= (long) p;
+    }
+    if (product != q) {
+        basis.clear();
+    }
+    return basis;
+}
+
+vector<uint64_t> RNS::to_rns(const BIVector& a) const {
+    const size_t len = a.size();
+    vector<uint64_t> r(primes.size() * len);
+# pragma omp parallel for shared (r, a) schedule(guided)
+    for (size_t j = 0; j < len; j++) {
+        for (size_t i = 0; i < primes.size(); i++) {
+            r[i*len + j] = rem(a[j], (long) primes[i]);
+        }
+    }
+    return r;
+}
+
+BIVector RNS::from_rns(const vector<uint64_t>& r) const {
+    const size_t len = r.size() / primes.size();
+    BIVector a(len);
+# pragma omp parallel for shared (r, a) schedule(guided)
+    for (size_t j = 0; j < len; j++) {
+        a[j] = from_rns(r, len, j);
+    }
+    return a;
+}
+
+BigInt RNS::from_rns(const vector<uint64_t>& r, size_t len, size_t j) const {
+    BigInt x, temp;
+    x = 0;
+    for (size_t i = 0; i < primes.size(); i++) {
+        mul(temp, crt_factors[i], (long) r[i*len + j]);
+        x += temp;
+    }
+    return x % modulus;
+}
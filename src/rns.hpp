@@ -0,0 +1,47 @@
+/* Residue number system over a basis of word sized primes
+ */
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "utils.hpp"
+
+class RNS {
+public:
+    std::vector<uint64_t> primes; // p_i < 2^61
+    BigInt modulus; // product of the primes
+
+    RNS(const std::vector<uint64_t>& primes);
+
+    // Primes are taken from a fixed sequence (largest primes below 2^61,
+    // descending), so a modulus alone is enough to recover its basis
+    static std::vector<uint64_t> basis_for(const BigInt& lower_bound);
+    // Empty if q is not a product of the fixed sequence
+    static std::vector<uint64_t> basis_of(const BigInt& q);
+
+    size_t size() const { return primes.size(); }
+
+    // Residue vectors are prime major, r[i*len + j] = a[j] mod p_i, so every
+    // per prime loop runs over contiguous memory
+    std::vector<uint64_t> to_rns(const BIVector&) const;
+    BIVector from_rns(const std::vector<uint64_t>&) const;
+    BigInt from_rns(const std::vector<uint64_t>&, size_t len, size_t j) const;
+
+    static inline uint64_t add_mod(uint64_t a, uint64_t b, uint64_t p) {
+        uint64_t c = a + b;
+        return c >= p ? c - p : c;
+    }
+    static inline uint64_t sub_mod(uint64_t a, uint64_t b, uint64_t p) {
+        return a >= b ? a - b : a + p - b;
+    }
+    static inline uint64_t mul_mod(uint64_t a, uint64_t b, uint64_t p) {
+        return (unsigned __int128) a * b % p;
+    }
+
+private:
+    // CRT: x = sum r_i * crt_factors[i] mod modulus
+    BIVector crt_factors;
+
+    static uint64_t prime_below(uint64_t);
+};
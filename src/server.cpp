@@ -0,0 +1,401 @@
+#include <thread>
+#include <atomic>
+#include <csignal>
+#include <cstring>
+#include <cerrno>
+#include <stdexcept>
+
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "server.hpp"
+#include "net.hpp"
+#include "cryptoCircuit.hpp"
+
+using namespace std;
+
+namespace {
+
+// Longest circuit path an EVAL may carry
+const uint64_t MAX_PATH = 4096;
+// Most outputs an EVAL_SELECT may select from
+const uint64_t MAX_SELECTION = 1 << 24;
+// Most ciphertext bytes a request may carry or, encrypting, ask for, though
+// always at least one ciphertext
+const uint64_t MAX_CIPHERTEXT_BYTES = 1ull << 32;
+
+volatile sig_atomic_t stop_requested = 0;
+// write end of the wake pipe, the handler pokes it so that poll returns
+// even when another thread takes the signal
+int stop_wake_fd = -1;
+
+void request_stop(int) {
+    stop_requested = 1;
+    if (stop_wake_fd >= 0) {
+        const int saved = errno;
+        if (write(stop_wake_fd, "s", 1) < 0) { }
+        errno = saved;
+    }
+}
+
+}
+
+Server::Server(GSWBase& gsw, const BIMatrix& public_key, const BIVector& secret_key, unsigned int workers)
+    : gsw(gsw), public_key(public_key), secret_key(secret_key), workers(workers),
+      gates_reused(0), gates_recomputed(0), stopping(false), served(0) {
+    ciphertext_words = (gsw.ciphertext_bits() + 63) / 64;
+    if (!this->workers) {
+        // every product already runs on a few OpenMP threads
+        this->workers = max(1u, thread::hardware_concurrency() / 4);
+    }
+    if (gsw.plaintext_bits > 1) {
+        throw ex("Server: integer keys are not supported");
+    }
+    if (pipe(wake) < 0) {
+        throw ex("Server: pipe failed");
+    }
+}
+
+Server::~Server() {
+    for (auto &c : circuits) {
+        delete c.second;
+    }
+    for (auto &s : sessions) {
+        delete s.second.circuit;
+    }
+    close(wake[0]);
+    close(wake[1]);
+}
+
+const CircuitFile& Server::circuit(const string& path) {
+    lock_guard<mutex> lock(circuits_mutex);
+    auto it = circuits.find(path);
+    if (it == circuits.end()) {
+        it = circuits.insert(make_pair(path, new CircuitFile(path))).first;
+    }
+    return *it->second;
+}
+
+CryptoCircuit& Server::session_circuit(int fd, const string& path) {
+    lock_guard<mutex> lock(sessions_mutex);
+    Session &session = sessions[fd];
+    if (!session.circuit || session.path != path) {
+        delete session.circuit;
+        session.circuit = NULL;
+        // the parsed circuit is shared, its gate graph is per connection
+        session.circuit = new CryptoCircuit(circuit(path));
+        session.path = path;
+    }
+    return *session.circuit;
+}
+
+void Server::close_connection(int fd) {
+    {
+        lock_guard<mutex> lock(sessions_mutex);
+        auto it = sessions.find(fd);
+        if (it != sessions.end()) {
+            delete it->second.circuit;
+            sessions.erase(it);
+        }
+    }
+    close(fd);
+}
+
+void Server::handle(int fd, const RequestHeader& req, const vector<uint64_t>& in,
+                    vector<uint64_t>& out, uint32_t& count) {
+    const uint64_t bits = gsw.ciphertext_bits();
+    vector<BitMatrix> ciphertexts;
+    const uint64_t *first_ct = in.data();
+
+    switch (req.op) {
+        case OP_INFO:
+            out.push_back(bits);
+            count = 1;
+            return;
+
+        case OP_ENCRYPT: {
+            if (public_key.empty() && secret_key.empty()) {
+                throw ex("No key loaded");
+            }
+            const uint8_t *messages = (const uint8_t *) in.data();
+            out.resize(req.count * ciphertext_words);
+            for (uint32_t i = 0; i < req.count; i++) {
+                BigInt message;
+                message = messages[i] & 1;
+                BitMatrix C;
+                {
+                    lock_guard<mutex> lock(encrypt_mutex);
+                    C = secret_key.empty() ? gsw.encrypt(public_key, message) : gsw.encrypt_secret(secret_key, message);
+                }
+                pack_bits(C, &out[i * ciphertext_words]);
+            }
+            count = req.count;
+            return;
+        }
+
+        case OP_EVAL: case OP_EVAL_SELECT:
+            // skip the path and selection, checked by serve_request
+            first_ct += 1 + (in[0] + 7) / 8;
+            if (req.op == OP_EVAL_SELECT) {
+                first_ct += 1 + (*first_ct + 7) / 8;
+            }
+            break;
+    }
+
+    for (uint32_t i = 0; i < req.count; i++) {
+        ciphertexts.push_back(BitMatrix());
+        unpack_bits(first_ct + i * ciphertext_words, bits, ciphertexts.back());
+    }
+
+    switch (req.op) {
+        case OP_DECRYPT: {
+            if (secret_key.empty()) {
+                throw ex("No secret key loaded");
+            }
+            out.resize((req.count + 7) / 8);
+            uint8_t *plaintexts = (uint8_t *) out.data();
+            for (uint32_t i = 0; i < req.count; i++) {
+                plaintexts[i] = gsw.decrypt_bit(secret_key, ciphertexts[i]);
+            }
+            count = req.count;
+            return;
+        }
+
+        case OP_NAND: {
+            if (req.count % 2) {
+                throw ex("NAND takes pairs of ciphertexts");
+            }
+            count = req.count / 2;
+            out.resize(count * ciphertext_words);
+            for (uint32_t i = 0; i < count; i++) {
+                pack_bits(gsw.nand(ciphertexts[2*i], ciphertexts[2*i + 1]), &out[i * ciphertext_words]);
+            }
+            return;
+        }
+
+        case OP_EVAL: case OP_EVAL_SELECT: {
+            const string path((const char *) &in[1], in[0]);
+            CryptoCircuit &crypto_circuit = session_circuit(fd, path);
+            if (ciphertexts.size() != crypto_circuit.inputs.size()) {
+                throw ex("Circuit takes " + to_string(crypto_circuit.inputs.size()) + " inputs");
+            }
+            vector<bool> wanted;
+            if (req.op == OP_EVAL_SELECT) {
+                const uint64_t *selection = &in[1 + (in[0] + 7) / 8];
+                const uint8_t *bytes = (const uint8_t *) (selection + 1);
+                for (uint64_t i = 0; i < *selection; i++) {
+                    wanted.push_back(bytes[i] & 1);
+                }
+            }
+            crypto_circuit.select_outputs(wanted);
+            vector<Ciphertext> inputs;
+            for (auto &c : ciphertexts) {
+                inputs.push_back(Ciphertext(std::move(c)));
+            }
+            crypto_circuit.update(inputs, gsw);
+            gates_reused += crypto_circuit.reused;
+            gates_recomputed += crypto_circuit.recomputed;
+            const vector<shared_ptr<Gate<Ciphertext> > > results = crypto_circuit.selected_outputs();
+            count = results.size();
+            out.resize(count * ciphertext_words);
+            for (uint32_t i = 0; i < count; i++) {
+                pack_bits(*results[i]->val, &out[i * ciphertext_words]);
+            }
+            return;
+        }
+    }
+}
+
+bool Server::serve_request(int fd) {
+    RequestHeader req;
+    if (!read_all(fd, &req, sizeof(req))) {
+        return false;
+    }
+
+    // sizes are checked before anything is allocated
+    const uint64_t ct_bytes = req.count * ciphertext_words * 8;
+    bool valid;
+    switch (req.op) {
+        case OP_INFO: valid = req.length == 0; break;
+        case OP_ENCRYPT: valid = req.length == req.count; break;
+        case OP_DECRYPT: case OP_NAND: valid = req.length == ct_bytes; break;
+        case OP_EVAL: valid = req.length >= 8 + ct_bytes && req.length <= 8 + MAX_PATH + ct_bytes; break;
+        case OP_EVAL_SELECT: valid = req.length >= 16 + ct_bytes && req.length <= 16 + MAX_PATH + MAX_SELECTION + ct_bytes; break;
+        default: valid = false;
+    }
+    valid = valid && ct_bytes <= max(MAX_CIPHERTEXT_BYTES, ciphertext_words * 8);
+
+    vector<uint64_t> in, out;
+    if (valid) {
+        in.resize((req.length + 7) / 8);
+        if (!read_all(fd, in.data(), req.length)) {
+            return false;
+        }
+        if (req.op == OP_EVAL) {
+            valid = in[0] <= MAX_PATH && req.length == 8 + (in[0] + 7) / 8 * 8 + ct_bytes;
+        }
+        if (req.op == OP_EVAL_SELECT) {
+            const uint64_t path_bytes = (in[0] + 7) / 8 * 8;
+            valid = in[0] <= MAX_PATH && req.length >= 16 + path_bytes + ct_bytes;
+            if (valid) {
+                const uint64_t selection = in[1 + path_bytes / 8];
+                valid = selection <= MAX_SELECTION && req.length == 16 + path_bytes + (selection + 7) / 8 * 8 + ct_bytes;
+            }
+        }
+    }
+
+    ResponseHeader resp = {0, 0, 0};
+    string error = "Malformed request";
+    if (valid) {
+        try {
+            handle(fd, req, in, out, resp.count);
+        } catch (exception &e) {
+            resp.status = 1;
+            error = e.what();
+        }
+    } else {
+        resp.status = 1;
+    }
+    served++;
+
+    if (resp.status) {
+        resp.count = 0;
+        resp.length = error.size();
+        // the rest of a malformed request can not be told from the next one
+        return write_all(fd, &resp, sizeof(resp)) && write_all(fd, error.data(), error.size()) && valid;
+    }
+    switch (req.op) {
+        case OP_ENCRYPT: case OP_NAND: case OP_EVAL: case OP_EVAL_SELECT: resp.length = resp.count * ciphertext_words * 8; break;
+        case OP_DECRYPT: resp.length = resp.count; break;
+        default: resp.length = out.size() * 8;
+    }
+    return write_all(fd, &resp, sizeof(resp)) && write_all(fd, out.data(), resp.length);
+}
+
+void Server::worker() {
+    while (true) {
+        int fd;
+        {
+            unique_lock<mutex> lock(queue_mutex);
+            queue_cv.wait(lock, [this] { return stopping || !ready.empty(); });
+            if (stopping) {
+                return;
+            }
+            fd = ready.front();
+            ready.pop_front();
+        }
+
+        if (serve_request(fd)) {
+            {
+                lock_guard<mutex> lock(queue_mutex);
+                returned.push_back(fd);
+            }
+            const char c = 0;
+            if (write(wake[1], &c, 1) < 0) { }
+        } else {
+            close_connection(fd);
+        }
+    }
+}
+
+void Server::run(const string& socket_path) {
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(addr.sun_path)) {
+        throw ex("Server: socket path too long");
+    }
+    strcpy(addr.sun_path, socket_path.c_str());
+
+    const int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(socket_path.c_str());
+    if (listen_fd < 0 || ::bind(listen_fd, (sockaddr *) &addr, sizeof(addr)) < 0 || listen(listen_fd, 64) < 0) {
+        throw ex("Server: can not listen on " + socket_path);
+    }
+
+    // no SA_RESTART, so that poll returns on a signal
+    stop_wake_fd = wake[1];
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = request_stop;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    // the workers, and the OpenMP threads they start, inherit a mask
+    // blocking the signals, which leaves them to this thread
+    sigset_t stop_signals, old_mask;
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stop_signals, &old_mask);
+    vector<thread> pool;
+    for (unsigned int i = 0; i < workers; i++) {
+        pool.push_back(thread(&Server::worker, this));
+    }
+    pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+    cerr << "Serving on " << socket_path << " with " << workers << " workers" << endl;
+
+    // connections waiting for their next request
+    vector<int> idle;
+    while (!stop_requested) {
+        vector<pollfd> fds;
+        fds.push_back({listen_fd, POLLIN, 0});
+        fds.push_back({wake[0], POLLIN, 0});
+        for (int fd : idle) {
+            fds.push_back({fd, POLLIN, 0});
+        }
+        if (poll(fds.data(), fds.size(), -1) < 0) {
+            continue;
+        }
+
+        vector<int> still_idle;
+        vector<int> readable;
+        for (size_t i = 2; i < fds.size(); i++) {
+            // a hang up is handed over too, the worker sees EOF and closes
+            if (fds[i].revents) {
+                readable.push_back(fds[i].fd);
+            } else {
+                still_idle.push_back(fds[i].fd);
+            }
+        }
+        idle.swap(still_idle);
+        if (fds[0].revents & POLLIN) {
+            const int fd = accept(listen_fd, NULL, NULL);
+            if (fd >= 0) {
+                idle.push_back(fd);
+            }
+        }
+        {
+            lock_guard<mutex> lock(queue_mutex);
+            if (fds[1].revents & POLLIN) {
+                char buf[64];
+                if (read(wake[0], buf, sizeof(buf)) < 0) { }
+                idle.insert(idle.end(), returned.begin(), returned.end());
+                returned.clear();
+            }
+            ready.insert(ready.end(), readable.begin(), readable.end());
+        }
+        queue_cv.notify_all();
+    }
+
+    // jobs in flight are finished, queued ones dropped
+    {
+        lock_guard<mutex> lock(queue_mutex);
+        stopping = true;
+    }
+    queue_cv.notify_all();
+    for (auto &t : pool) {
+        t.join();
+    }
+    stop_wake_fd = -1;
+    for (int fd : idle) close(fd);
+    for (int fd : ready) close(fd);
+    for (int fd : returned) close(fd);
+    close(listen_fd);
+    unlink(socket_path.c_str());
+    cerr << "Served " << served << " requests, reused " << gates_reused << " of "
+         << gates_reused + gates_recomputed << " gates evaluated" << endl;
+}
@@ -0,0 +1,103 @@
+/* gsw-fhe as a daemon: keys, parameters and circuits are loaded once and
+ * jobs arrive over a Unix socket
+ */
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstdint>
+
+#include "utils.hpp"
+#include "gsw.hpp"
+#include "circuitFile.hpp"
+#include "cryptoCircuit.hpp"
+
+// Every request is a RequestHeader and length bytes of payload, answered by
+// a ResponseHeader and its payload, all in host byte order. Ciphertexts are
+// pack_bits words, ciphertext_bits of them rounded up to whole words.
+//   INFO     -> count 1, the ciphertext size in bits as one word
+//   ENCRYPT  count bytes of 0 or 1 -> count ciphertexts, from the secret
+//            key when the server has it
+//   DECRYPT  count ciphertexts -> count bytes of 0 or 1
+//   NAND     count ciphertexts -> count/2 ciphertexts, NANDed in pairs
+//   EVAL     path length word, circuit path padded to a word, count
+//            ciphertexts -> the circuit outputs. A connection keeps the gates
+//            of its last EVAL, evaluating the same circuit again only
+//            recomputes those reading inputs that changed.
+//   EVAL_SELECT  as EVAL with, after the path, an output count word and a
+//            byte of 0 or 1 per output padded to a word -> the outputs with a
+//            1, only what they read is evaluated
+// A non zero status means the payload is an error message.
+enum ServerOp { OP_INFO, OP_ENCRYPT, OP_DECRYPT, OP_NAND, OP_EVAL, OP_EVAL_SELECT };
+
+struct RequestHeader {
+    uint32_t op; // ServerOp
+    uint32_t count;
+    uint64_t length;
+};
+
+struct ResponseHeader {
+    uint32_t status;
+    uint32_t count;
+    uint64_t length;
+};
+
+// A poll loop hands connections with a pending request to a pool of workers,
+// each runs one request and gives the connection back. Requests on different
+// connections run concurrently, those on one connection in order.
+class Server {
+public:
+    // Either key may be empty, its operations then fail
+    Server(GSWBase&, const BIMatrix& public_key, const BIVector& secret_key, unsigned int workers);
+    ~Server();
+
+    // Serves until SIGINT or SIGTERM
+    void run(const std::string& socket_path);
+
+private:
+    GSWBase &gsw;
+    const BIMatrix &public_key;
+    const BIVector &secret_key;
+    unsigned int workers;
+    uint64_t ciphertext_words;
+
+    // encryption draws from the global random generators
+    std::mutex encrypt_mutex;
+
+    std::mutex circuits_mutex;
+    std::map<std::string, CircuitFile*> circuits; // by path, loaded on first use
+
+    // Last EVAL of every connection, a worker only touches its connection's
+    struct Session {
+        std::string path;
+        CryptoCircuit *circuit;
+    };
+    std::mutex sessions_mutex;
+    std::map<int, Session> sessions;
+    std::atomic<uint64_t> gates_reused, gates_recomputed;
+
+    std::mutex queue_mutex;
+    std::condition_variable queue_cv;
+    std::deque<int> ready; // connections with a request to read
+    std::vector<int> returned; // connections workers are done with
+    int wake[2]; // tells the poll loop about returned connections
+    bool stopping;
+    std::atomic<uint64_t> served; // replies sent
+
+    void worker();
+    // false closes the connection
+    bool serve_request(int fd);
+    void handle(int fd, const RequestHeader&, const std::vector<uint64_t>& in,
+                std::vector<uint64_t>& out, uint32_t& count);
+    const CircuitFile& circuit(const std::string& path);
+    CryptoCircuit& session_circuit(int fd, const std::string& path);
+    void close_connection(int fd);
+
+    Server(const Server&);
+    Server& operator=(const Server&);
+};
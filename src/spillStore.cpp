@@ -0,0 +1,109 @@
+#include <cstdlib>
+#include <stdexcept>
+#include <iomanip>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "spillStore.hpp"
+
+using namespace std;
+
+SpillStore::SpillStore(uint64_t budget)
+    : budget(budget), spills(0), reloads(0), peak_resident(0),
+      fd(-1), map(NULL), bits(0), slot_words(0), num_slots(0) { }
+
+SpillStore::~SpillStore() {
+    if (map) {
+        munmap(map, num_slots * slot_words * 8);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+uint64_t SpillStore::capacity(uint64_t ciphertext_bits) const {
+    return max<uint64_t>(4, budget / ((ciphertext_bits + 7) / 8));
+}
+
+void SpillStore::open_file() {
+    const char *dir = getenv("TMPDIR");
+    string path = string(dir ? dir : "/tmp") + "/gsw-spill-XXXXXX";
+    vector<char> name(path.begin(), path.end());
+    name.push_back('\0');
+    fd = mkstemp(name.data());
+    if (fd < 0) {
+        throw runtime_error("SpillStore: can not create " + path);
+    }
+    // gone with the process, however it ends
+    unlink(name.data());
+}
+
+void SpillStore::grow() {
+    const uint64_t slot_bytes = slot_words * 8;
+    const uint64_t new_slots = max<uint64_t>(4, 2 * num_slots);
+    if (map) {
+        munmap(map, num_slots * slot_bytes);
+    }
+    if (ftruncate(fd, new_slots * slot_bytes) < 0) {
+        throw runtime_error("SpillStore: scratch file full");
+    }
+    void *p = mmap(NULL, new_slots * slot_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        map = NULL;
+        throw runtime_error("SpillStore: can not map scratch file");
+    }
+    map = (uint64_t *) p;
+    // lowest slots first
+    for (uint64_t s = new_slots; s > num_slots; s--) {
+        free_slots.push_back(s - 1);
+    }
+    num_slots = new_slots;
+}
+
+uint64_t SpillStore::spill(const BitMatrix& C) {
+    if (!slot_words) {
+        // every ciphertext of a key has the same size
+        const uint64_t page_words = sysconf(_SC_PAGESIZE) / 8;
+        bits = C.size();
+        slot_words = ((bits + 63) / 64 + page_words - 1) / page_words * page_words;
+        open_file();
+    } else if (C.size() != bits) {
+        throw runtime_error("SpillStore: ciphertexts differ in size");
+    }
+    if (free_slots.empty()) {
+        grow();
+    }
+    const uint64_t slot = free_slots.back();
+    free_slots.pop_back();
+
+    uint64_t *p = slot_ptr(slot);
+    pack_bits(C, p);
+    // start writeback and drop the pages from this process
+    msync(p, slot_words * 8, MS_ASYNC);
+    madvise(p, slot_words * 8, MADV_DONTNEED);
+    spills++;
+    return slot;
+}
+
+void SpillStore::reload(uint64_t slot, BitMatrix& C) {
+    const uint64_t *p = slot_ptr(slot);
+    unpack_bits(p, bits, C);
+    madvise((void *) p, slot_words * 8, MADV_DONTNEED);
+    free_slots.push_back(slot);
+    reloads++;
+}
+
+void SpillStore::prefetch(uint64_t slot) const {
+    madvise(slot_ptr(slot), slot_words * 8, MADV_WILLNEED);
+}
+
+void SpillStore::print(ostream& fp) const {
+    const double mb = (bits + 7) / 8 / 1048576.0;
+    fp << fixed << setprecision(1);
+    fp << "memory budget " << budget / 1048576.0 << " MB, at most " << peak_resident
+       << " ciphertexts in memory" << endl;
+    fp << "spilled " << spills << " ciphertexts (" << spills * mb << " MB), reloaded "
+       << reloads << " (" << reloads * mb << " MB)" << endl;
+}
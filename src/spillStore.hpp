@@ -0,0 +1,51 @@
+/* Scratch space for the ciphertexts of a circuit evaluation that do not
+ * fit its memory budget
+ */
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <cstdint>
+
+#include "utils.hpp"
+
+// Fixed size slots in an unlinked, mmapped file in $TMPDIR. Ciphertexts are
+// stored with pack_bits, slots are page aligned so that they can be
+// released from memory and prefetched on their own. The file grows by
+// doubling and freed slots are reused.
+class SpillStore {
+public:
+    uint64_t budget; // bytes of ciphertexts kept in memory
+    uint64_t spills, reloads;
+    uint64_t peak_resident; // most ciphertexts in memory at once, set by the evaluator
+
+    SpillStore(uint64_t budget);
+    ~SpillStore();
+
+    // Ciphertexts the budget holds, at least the three inputs and the output
+    // of a MUX
+    uint64_t capacity(uint64_t ciphertext_bits) const;
+
+    // Writes C to a free slot and returns it
+    uint64_t spill(const BitMatrix& C);
+    // Reads a slot into C and frees the slot
+    void reload(uint64_t slot, BitMatrix& C);
+    // Starts reading a slot in without waiting for it
+    void prefetch(uint64_t slot) const;
+
+    // Spill and reload volume
+    void print(std::ostream&) const;
+
+private:
+    int fd;
+    uint64_t *map;
+    uint64_t bits, slot_words, num_slots;
+    std::vector<uint64_t> free_slots;
+
+    void open_file();
+    void grow();
+    uint64_t* slot_ptr(uint64_t slot) const { return map + slot * slot_words; }
+
+    SpillStore(const SpillStore&);
+    SpillStore& operator=(const SpillStore&);
+};
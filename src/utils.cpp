@@ -27,6 +27,33 @@ std::ostream& operator<<(std::ostream &o, const BitMatrix &container){
     return o;
 }
 
+const BitMatrix Ciphertext::none;
+std::atomic<uint64_t> Ciphertext::copied(0);
+
+BitMatrix Ciphertext::copy() const {
+    copied += ((**this).size() + 7) / 8;
+    return **this;
+}
+
+void pack_bits(const BitMatrix &C, uint64_t *words) {
+    const uint64_t bits = C.size();
+    for (uint64_t w = 0; w * 64 < bits; w++) {
+        const uint64_t end = std::min(bits, (w + 1) * 64);
+        uint64_t word = 0;
+        for (uint64_t i = w * 64; i < end; i++) {
+            word |= (uint64_t) C[i] << (i & 63);
+        }
+        words[w] = word;
+    }
+}
+
+void unpack_bits(const uint64_t *words, uint64_t bits, BitMatrix &C) {
+    C.resize(bits);
+    for (uint64_t i = 0; i < bits; i++) {
+        C[i] = (words[i >> 6] >> (i & 63)) & 1;
+    }
+}
+
 void utils_init() {
     rand_init();
 }
@@ -6,6 +6,9 @@
 #include <string>
 #include <vector>
 #include <bitset>
+#include <memory>
+#include <atomic>
+#include <cstdint>
 
 #include <NTL/ZZ.h>
 #include <cymric.h>
@@ -28,6 +31,41 @@ std::ostream& operator<<(std::ostream&, const std::vector<int> &);
 std::ostream& operator<<(std::ostream&, const std::vector<BigInt> &);
 std::ostream& operator<<(std::ostream&, const BitMatrix &);
 
+// 64 bits of a BitMatrix to a word, (bits + 63) / 64 words
+void pack_bits(const BitMatrix&, uint64_t *words);
+void unpack_bits(const uint64_t *words, uint64_t bits, BitMatrix&);
+
+// An immutable ciphertext shared by reference count, so that gates, the
+// gates reading them and the output writers hold one buffer between them.
+// copy() is the only way to a BitMatrix of one's own and counts its bytes.
+// The buffer is the BitMatrix itself, words from operator new, rather than
+// an aligned or mapped region: every scheme, the kernels, the spill store
+// and the workers index ciphertexts as a BitMatrix, and nothing reads them
+// wider than a word.
+class Ciphertext {
+public:
+    Ciphertext() { }
+    // Takes the matrix over without copying it
+    explicit Ciphertext(BitMatrix&& C) : p(std::make_shared<const BitMatrix>(std::move(C))) { }
+
+    const BitMatrix& operator*() const { return p ? *p : none; }
+    const BitMatrix* operator->() const { return &**this; }
+    bool empty() const { return !p || p->empty(); }
+    void reset() { p.reset(); }
+    // Same buffer, or the same bits in another one
+    bool operator==(const Ciphertext& other) const { return p == other.p || **this == *other; }
+    bool operator!=(const Ciphertext& other) const { return !(*this == other); }
+
+    BitMatrix copy() const;
+    // Bytes copy() has copied, over every thread
+    static uint64_t copied_bytes() { return copied; }
+
+private:
+    std::shared_ptr<const BitMatrix> p;
+    static const BitMatrix none;
+    static std::atomic<uint64_t> copied;
+};
+
 class ex: public std::exception {
 public:
     std::string value;
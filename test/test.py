@@ -1,31 +1,117 @@
 #!/usr/bin/env python3.5
 
+import ctypes
+import json
+import os
+import re
+import signal
+import socket
+import struct
 import subprocess as sp
+import time
 import unittest
 
 
-def gen_key(pub, priv):
-    return sp.run(['../build/gsw-fhe', '-k', '-L', '1', '-p', pub, '-s', priv])
+def gen_key(pub, priv, scheme=[]):
+    return sp.run(['../build/gsw-fhe', '-k', '-L', '1', '-p', pub, '-s', priv] + scheme)
 
 def encrypt(key, input_file, output_file):
     return sp.run(['../build/gsw-fhe', '-e', '-p', key, '-i', input_file, '-o', output_file])
 
+def encrypt_secret(key, input_file, output_file):
+    return sp.run(['../build/gsw-fhe', '-e', '-s', key, '-i', input_file, '-o', output_file])
+
 def decrypt(key, input_file, output_file):
     return sp.run(['../build/gsw-fhe', '-d', '-s', key, '-i', input_file, '-o', output_file])
 
-def nand(input_file, output_file):
-    return sp.run(['../build/gsw-fhe', '-n', '-i', input_file, '-o', output_file])
+def nand(input_file, output_file, backend=None, key=None):
+    backend_args = ['-b', backend] if backend else []
+    key_args = ['-p', key] if key else []
+    return sp.run(['../build/gsw-fhe', '-n', '-i', input_file, '-o', output_file] + backend_args + key_args)
+
+def run_circuit(circuit, input_file, output_file, memory=None, batch=False, compact=False, key=None):
+    memory_args = ['-m', str(memory)] if memory else []
+    batch_args = ['-B'] if batch else []
+    compact_args = ['-C'] if compact else []
+    key_args = ['-p', key] if key else []
+    return sp.run(['../build/gsw-fhe', '-c', circuit, '-i', input_file, '-o', output_file] + memory_args + batch_args
+                  + compact_args + key_args)
+
+def run_distributed(circuit, key, input_file, output_file, workers):
+    return sp.run(['../build/gsw-fhe', '-c', circuit, '-p', key, '-D', ','.join(workers), '-i', input_file, '-o', output_file])
+
+def start_worker(port, key):
+    worker = sp.Popen(['../build/gsw-fhe', '-W', str(port), '-p', key])
+    while True:
+        try:
+            socket.create_connection(('localhost', port)).close()
+            return worker
+        except ConnectionRefusedError:
+            time.sleep(0.1)
+
+def serve(socket_path, pub, priv, stderr=None):
+    server = sp.Popen(['../build/gsw-fhe', '-S', socket_path, '-p', pub, '-s', priv], stderr=stderr)
+    while not os.path.exists(socket_path):
+        time.sleep(0.1)
+    return server
 
-def run_circuit(circuit, input_file, output_file):
-    return sp.run(['../build/gsw-fhe', '-c', circuit, '-i', input_file, '-o', output_file])
+def request(conn, op, count, payload=b''):
+    conn.sendall(struct.pack('=IIQ', op, count, len(payload)) + payload)
+    status, count, length = struct.unpack('=IIQ', recv_all(conn, 16))
+    return status, count, recv_all(conn, length)
+
+def recv_all(conn, n):
+    data = b''
+    while len(data) < n:
+        chunk = conn.recv(n - len(data))
+        if not chunk:
+            raise EOFError
+        data += chunk
+    return data
+
+# GateType of compiled circuits, and the wire of an unused input
+AND, XOR, INV, NAND, ADD, CMUL, MUX = range(7)
+NO_WIRE = 2**32 - 1
 
 def diff_files(a, b):
     return sp.run(['diff', a, b], stdout=sp.PIPE).returncode
 
+def toy_keys(pub, priv, n, m, q, k):
+    # GSW keys of a few dimensions from libgswApi, for the schemes whose
+    # real keys take too long to test with: a key file with only the
+    # parameters for gsw_params_load, then keys generated for them
+    with open(pub, 'w') as fp:
+        fp.write('-----BEGIN GSW PUBLIC KEY-----\n{}\n{}\n{}\n{}\n1\n0\n-----END GSW PUBLIC KEY-----\n'
+                 .format(n, m, q, k))
+    lib = ctypes.CDLL('../build/libgswApi.so')
+    lib.gsw_params_load.restype = ctypes.c_void_p
+    lib.gsw_params_load.argtypes = [ctypes.c_char_p]
+    lib.gsw_keygen.argtypes = [ctypes.c_void_p] * 3
+    lib.gsw_key_save.argtypes = [ctypes.c_void_p, ctypes.c_void_p, ctypes.c_char_p]
+    lib.gsw_key_free.argtypes = [ctypes.c_void_p]
+    lib.gsw_params_free.argtypes = [ctypes.c_void_p]
+    params = lib.gsw_params_load(pub.encode())
+    public, secret = ctypes.c_void_p(), ctypes.c_void_p()
+    status = lib.gsw_keygen(params, ctypes.byref(public), ctypes.byref(secret))
+    if not status:
+        status = lib.gsw_key_save(params, public, pub.encode()) or lib.gsw_key_save(params, secret, priv.encode())
+    lib.gsw_key_free(public)
+    lib.gsw_key_free(secret)
+    lib.gsw_params_free(params)
+    return status
+
 class GSWTest(unittest.TestCase):
+    # keygen options of the scheme under test, e.g. -r for Ring-GSW
+    scheme = []
+    # or the (n, m, q, k) of toy keys instead
+    toy = None
+
     @classmethod
     def setUpClass(cls):
-        gen_key('key.pub', 'key')
+        if cls.toy:
+            toy_keys('key.pub', 'key', *cls.toy)
+        else:
+            gen_key('key.pub', 'key', cls.scheme)
 
     @classmethod
     def tearDownClass(cls):
@@ -39,6 +125,45 @@ class EncryptionTest(GSWTest):
         decrypt('key', 'ciphertext', 'output')
         self.assertEqual(diff_files('input', 'output'), 0)
 
+    def test_secret_key_encryption(self):
+        encrypt_secret('key', 'input', 'ciphertext')
+        decrypt('key', 'ciphertext', 'output')
+        self.assertEqual(diff_files('input', 'output'), 0)
+
+class EncryptionRingTest(GSWTest):
+    # Ring-GSW keys
+    scheme = ['-r']
+
+    def test_fresh_randomness(self):
+        # the same plaintext encrypts differently in every process
+        with open('in1', 'w') as fp:
+            fp.write('1')
+        encrypt('key.pub', 'in1', 'ciphertext')
+        encrypt('key.pub', 'in1', 'ciphertext2')
+        self.assertNotEqual(diff_files('ciphertext', 'ciphertext2'), 0)
+        decrypt('key', 'ciphertext2', 'output')
+        self.assertEqual(chr(sp.run(['cat', 'output'], stdout=sp.PIPE).stdout[0]), '1')
+        sp.run(['rm', 'in1', 'ciphertext2'])
+
+    def test_circuit_checks_inputs(self):
+        # ciphertexts of Ring-GSW keys against the GSW a lone -c derives,
+        # then one input short, fail rather than evaluate
+        with open('in1', 'w') as fp:
+            fp.write('1\n0')
+        with open('circuit_and', 'w') as fp:
+            fp.write('1 3\n2 0 1\n\n2 1 0 1 2 AND\n')
+        encrypt('key.pub', 'in1', 'ciphertext')
+        res = sp.run(['../build/gsw-fhe', '-c', 'circuit_and', '-i', 'ciphertext', '-o', 'output'], stderr=sp.PIPE)
+        self.assertNotEqual(res.returncode, 0)
+        self.assertIn(b'Ciphertext of other parameters than the key', res.stderr)
+        with open('circuit_and', 'w') as fp:
+            fp.write('1 4\n3 0 1\n\n2 1 0 1 3 AND\n')
+        res = sp.run(['../build/gsw-fhe', '-c', 'circuit_and', '-p', 'key.pub', '-i', 'ciphertext', '-o', 'output'],
+                     stderr=sp.PIPE)
+        self.assertNotEqual(res.returncode, 0)
+        self.assertIn(b'Circuit takes 3 inputs, got 2', res.stderr)
+        sp.run(['rm', 'in1', 'circuit_and'])
+
 class NandTest(GSWTest):
     @classmethod
     def setUpClass(cls):
@@ -61,17 +186,368 @@ class NandTest(GSWTest):
     def test_nand(self):
         for i, s in enumerate(self.inputs):
             encrypt('key.pub', 'in{}'.format(s), 'ciphertext')
-            nand('ciphertext', 'ciphertext')
+            nand('ciphertext', 'ciphertext', key='key.pub')
             decrypt('key', 'ciphertext', 'output')
             self.assertEqual(chr(sp.run(['cat', 'output'], stdout=sp.PIPE).stdout[0]), self.results[i], s)
 
-class Adder1BitTest(GSWTest):
+class NandRingTest(NandTest):
+    # Ring-GSW keys
+    scheme = ['-r']
+
+class NandRnsTest(NandTest):
+    # Toy GSW keys with an RNS quotient, recognised from q: the product of
+    # the two largest primes below 2^61
+    toy = (4, 64, 5316911983139663417828251946283171871, 1)
+
+class NandGadget2Test(NandTest):
+    # Toy GSW keys decomposing in base 4
+    toy = (4, 64, 2097169, 2)
+
+class NandGadget4Test(NandTest):
+    # Toy GSW keys decomposing in base 16
+    toy = (4, 64, 2097169, 4)
+
+class BackendTest(GSWTest):
     @classmethod
     def setUpClass(cls):
         super().setUpClass()
 
-        cls.inputs = ['00', '01', '10', '11']
-        cls.results = ['0', '1', '1', '0']
+        with open('in11', 'w') as fp:
+            fp.write('1\n1')
+
+    @classmethod
+    def tearDownClass(cls):
+        sp.run(['rm', 'in11', 'ciphertext', 'ct_reference', 'ct_eigen', 'output'])
+
+    def test_backends_agree(self):
+        encrypt('key.pub', 'in11', 'ciphertext')
+        nand('ciphertext', 'ct_reference', 'reference')
+        nand('ciphertext', 'ct_eigen', 'eigen')
+        self.assertEqual(diff_files('ct_reference', 'ct_eigen'), 0)
+        decrypt('key', 'ct_eigen', 'output')
+        self.assertEqual(chr(sp.run(['cat', 'output'], stdout=sp.PIPE).stdout[0]), '0')
+
+class GadgetKernelTest(unittest.TestCase):
+    # The compiled flatten, decomposition and digit loops against the generic
+    # path, which the reference backend takes. Toy keys of a few dimensions, from libgswApi,
+    # keep every (k, l) shape to seconds: k with quotients of 22, 40 and
+    # about 60 bits, each just above 2 B^j.
+    shapes = [(1, 2097169), (1, 549755813911), (1, 1152921504606847009),
+              (2, 2097169), (2, 549755813911), (2, 576460752303423619),
+              (4, 2097169), (4, 137438953481), (4, 144115188075855881)]
+
+    @classmethod
+    def setUpClass(cls):
+        with open('in11', 'w') as fp:
+            fp.write('1\n1')
+
+    @classmethod
+    def tearDownClass(cls):
+        sp.run(['rm', 'in11', 'toy.pub', 'toy', 'ciphertext', 'ct_reference', 'ct_eigen', 'output'])
+
+    def test_presets_match_generic(self):
+        for k, q in self.shapes:
+            self.assertEqual(toy_keys('toy.pub', 'toy', 4, 64, q, k), 0)
+            encrypt('toy.pub', 'in11', 'ciphertext')
+            decrypt('toy', 'ciphertext', 'output')
+            self.assertEqual(chr(sp.run(['cat', 'output'], stdout=sp.PIPE).stdout[0]), '1', (k, q))
+            nand('ciphertext', 'ct_reference', 'reference', key='toy.pub')
+            nand('ciphertext', 'ct_eigen', 'eigen', key='toy.pub')
+            self.assertEqual(diff_files('ct_reference', 'ct_eigen'), 0, (k, q))
+            decrypt('toy', 'ct_eigen', 'output')
+            self.assertEqual(chr(sp.run(['cat', 'output'], stdout=sp.PIPE).stdout[0]), '0', (k, q))
+
+class CircuitFileTest(unittest.TestCase):
+    def compile(self, circuit):
+        return sp.run(['../build/circuit-converter', '-b'], input=circuit.encode(), stdout=sp.PIPE, stderr=sp.PIPE)
+
+    def test_rejects_bad_numbers(self):
+        self.assertEqual(self.compile('1 3\n2 0 1\n\n2 1 0 1 2 AND\n').returncode, 0)
+        # a wire of 2^32 + 2 used to wrap to wire 2, a number past 2^64 to
+        # wrap at all, and a fourth input to shift the rest of the line
+        for circuit in ['1 3\n2 0 1\n\n2 1 0 1 4294967298 AND\n',
+                        '1 3\n2 0 1\n\n2 1 0 1 18446744073709551618 AND\n',
+                        '1 99999999999999999999\n2 0 1\n\n2 1 0 1 2 AND\n',
+                        '1 5\n2 0 1\n\n4 1 0 1 2 3 4 AND\n']:
+            res = self.compile(circuit)
+            self.assertNotEqual(res.returncode, 0, circuit)
+            self.assertIn(b'Bad circuit', res.stderr, circuit)
+
+class ServerTest(GSWTest):
+    OP_INFO, OP_ENCRYPT, OP_DECRYPT, OP_NAND, OP_EVAL, OP_EVAL_SELECT = range(6)
+
+    @classmethod
+    def setUpClass(cls):
+        super().setUpClass()
+        cls.server = serve('gsw.sock', 'key.pub', 'key')
+
+    @classmethod
+    def tearDownClass(cls):
+        cls.server.terminate()
+        cls.server.wait()
+
+    def test_nand(self):
+        conn = socket.socket(socket.AF_UNIX)
+        conn.connect('gsw.sock')
+        status, _, info = request(conn, self.OP_INFO, 0)
+        self.assertEqual(status, 0)
+        size = (struct.unpack('=Q', info)[0] + 63) // 64 * 8
+
+        status, count, ciphertexts = request(conn, self.OP_ENCRYPT, 8, bytes([0, 0, 0, 1, 1, 0, 1, 1]))
+        self.assertEqual((status, count, len(ciphertexts)), (0, 8, 8 * size))
+        status, count, results = request(conn, self.OP_NAND, 8, ciphertexts)
+        self.assertEqual((status, count), (0, 4))
+        status, _, plaintexts = request(conn, self.OP_DECRYPT, 4, results)
+        self.assertEqual(list(plaintexts), [1, 1, 1, 0])
+
+        status, _, error = request(conn, self.OP_NAND, 1, ciphertexts[:size])
+        self.assertEqual((status, error), (1, b'NAND takes pairs of ciphertexts'))
+        conn.close()
+
+    def test_request_cap(self):
+        # an ENCRYPT asking for more ciphertexts than the cap is refused
+        # before anything is read or allocated
+        conn = socket.socket(socket.AF_UNIX)
+        conn.connect('gsw.sock')
+        conn.settimeout(30)
+        count = 2**32 - 1
+        conn.sendall(struct.pack('=IIQ', self.OP_ENCRYPT, count, count))
+        status, _, length = struct.unpack('=IIQ', recv_all(conn, 16))
+        self.assertEqual((status, recv_all(conn, length)), (1, b'Malformed request'))
+        conn.close()
+
+    def test_signal_stops(self):
+        # SIGINT ends the poll loop whichever thread it lands on
+        server = serve('gsw_stop.sock', 'key.pub', 'key')
+        conn = socket.socket(socket.AF_UNIX)
+        conn.connect('gsw_stop.sock')
+        status, _, _ = request(conn, self.OP_INFO, 0)
+        self.assertEqual(status, 0)
+        server.send_signal(signal.SIGINT)
+        self.assertEqual(server.wait(timeout=30), 0)
+        conn.close()
+        self.assertFalse(os.path.exists('gsw_stop.sock'))
+
+    def test_eval_again(self):
+        # a AND b, INV c; the second EVAL only changes c
+        with open('circuit_and_inv', 'w') as fp:
+            fp.write('2 5\n2 1 2\n\n2 1 0 1 3 AND\n1 1 2 4 INV\n')
+        path = b'circuit_and_inv'
+        header = struct.pack('=Q', len(path)) + path + bytes(-len(path) % 8)
+
+        # a server of its own, whose totals on exit are this test's alone
+        server = serve('gsw_again.sock', 'key.pub', 'key', stderr=sp.PIPE)
+        conn = socket.socket(socket.AF_UNIX)
+        conn.connect('gsw_again.sock')
+        status, _, info = request(conn, self.OP_INFO, 0)
+        size = (struct.unpack('=Q', info)[0] + 63) // 64 * 8
+        status, _, ciphertexts = request(conn, self.OP_ENCRYPT, 4, bytes([1, 1, 0, 1]))
+
+        for c, expected in [(2, [1, 1]), (3, [1, 0]), (3, [1, 0])]:
+            inputs = ciphertexts[:2 * size] + ciphertexts[c * size:(c + 1) * size]
+            status, count, results = request(conn, self.OP_EVAL, 3, header + inputs)
+            self.assertEqual((status, count), (0, 2))
+            status, _, plaintexts = request(conn, self.OP_DECRYPT, 2, results)
+            self.assertEqual(list(plaintexts), expected)
+
+        # then only the INV output, with c back to 0
+        selection = struct.pack('=Q', 2) + bytes([0, 1]) + bytes(6)
+        inputs = ciphertexts[:3 * size]
+        status, count, results = request(conn, self.OP_EVAL_SELECT, 3, header + selection + inputs)
+        self.assertEqual((status, count), (0, 1))
+        status, _, plaintexts = request(conn, self.OP_DECRYPT, 1, results)
+        self.assertEqual(list(plaintexts), [1])
+        conn.close()
+        os.remove('circuit_and_inv')
+        # both gates, the INV, neither, then the INV again
+        server.terminate()
+        _, errors = server.communicate(timeout=30)
+        self.assertIn('reused 3 of 7 gates evaluated', errors.decode())
+
+class ApiTest(GSWTest):
+    # libgswApi through ctypes, keys and circuit resident between calls
+    @classmethod
+    def setUpClass(cls):
+        super().setUpClass()
+        lib = ctypes.CDLL('../build/libgswApi.so')
+        for f in ['gsw_params_load', 'gsw_key_load', 'gsw_encrypt', 'gsw_nand', 'gsw_xor', 'gsw_mux',
+                  'gsw_circuit_load', 'gsw_ciphertext_import']:
+            getattr(lib, f).restype = ctypes.c_void_p
+        lib.gsw_params_load.argtypes = [ctypes.c_char_p]
+        lib.gsw_key_load.argtypes = [ctypes.c_void_p, ctypes.c_char_p]
+        lib.gsw_key_save.argtypes = [ctypes.c_void_p, ctypes.c_void_p, ctypes.c_char_p]
+        lib.gsw_encrypt.argtypes = [ctypes.c_void_p, ctypes.c_void_p, ctypes.c_uint64]
+        lib.gsw_encrypt_batch.argtypes = [ctypes.c_void_p, ctypes.c_void_p, ctypes.c_void_p, ctypes.c_size_t,
+                                          ctypes.c_void_p]
+        lib.gsw_decrypt_batch.argtypes = [ctypes.c_void_p, ctypes.c_void_p, ctypes.c_void_p, ctypes.c_size_t,
+                                          ctypes.c_void_p]
+        lib.gsw_nand.argtypes = [ctypes.c_void_p] * 3
+        lib.gsw_xor.argtypes = [ctypes.c_void_p] * 3
+        lib.gsw_mux.argtypes = [ctypes.c_void_p] * 4
+        lib.gsw_nand_batch.argtypes = [ctypes.c_void_p] * 3 + [ctypes.c_size_t, ctypes.c_void_p]
+        lib.gsw_decrypt.argtypes = [ctypes.c_void_p] * 4
+        lib.gsw_ciphertext_words.argtypes = [ctypes.c_void_p]
+        lib.gsw_ciphertext_export.argtypes = [ctypes.c_void_p] * 3
+        lib.gsw_ciphertext_import.argtypes = [ctypes.c_void_p] * 2
+        lib.gsw_circuit_load.argtypes = [ctypes.c_char_p]
+        lib.gsw_circuit_eval.argtypes = [ctypes.c_void_p] * 4
+        lib.gsw_circuit_eval_batch.argtypes = [ctypes.c_void_p] * 3 + [ctypes.c_size_t, ctypes.c_void_p]
+        lib.gsw_circuit_counts.argtypes = [ctypes.c_void_p] * 3
+        for f in ['gsw_ciphertext_free', 'gsw_key_free', 'gsw_params_free', 'gsw_circuit_free']:
+            getattr(lib, f).argtypes = [ctypes.c_void_p]
+        lib.gsw_last_error.restype = ctypes.c_char_p
+        lib.gsw_copied_bytes.restype = ctypes.c_uint64
+        cls.lib = lib
+        cls.params = lib.gsw_params_load(b'key.pub')
+        cls.pub = lib.gsw_key_load(cls.params, b'key.pub')
+        cls.priv = lib.gsw_key_load(cls.params, b'key')
+
+    @classmethod
+    def tearDownClass(cls):
+        cls.lib.gsw_key_free(cls.pub)
+        cls.lib.gsw_key_free(cls.priv)
+        cls.lib.gsw_params_free(cls.params)
+
+    def encrypt(self, bits):
+        return self.owned([self.lib.gsw_encrypt(self.params, self.pub, b) for b in bits])
+
+    def owned(self, handles):
+        # frees the handles a call returned once the test is done
+        for c in handles:
+            self.addCleanup(self.lib.gsw_ciphertext_free, c)
+        return handles
+
+    def decrypt(self, c):
+        m = ctypes.c_uint64()
+        self.assertEqual(self.lib.gsw_decrypt(self.params, self.priv, c, ctypes.byref(m)), 0)
+        return m.value
+
+    def test_nand(self):
+        lib = self.lib
+        bits = self.encrypt([0, 1])
+        for a, b, expected in [(0, 0, 1), (0, 1, 1), (1, 1, 0)]:
+            c, = self.owned([lib.gsw_nand(self.params, bits[a], bits[b])])
+            self.assertEqual(self.decrypt(c), expected)
+
+        words = (ctypes.c_uint64 * lib.gsw_ciphertext_words(self.params))()
+        self.assertEqual(lib.gsw_ciphertext_export(self.params, bits[1], words), 0)
+        c, = self.owned([lib.gsw_ciphertext_import(self.params, words)])
+        self.assertEqual(self.decrypt(c), 1)
+        self.assertEqual(lib.gsw_decrypt(self.params, self.pub, bits[1], ctypes.byref(ctypes.c_uint64())), -1)
+        self.assertEqual(lib.gsw_last_error(), b'Decryption needs the secret key')
+
+    def test_xor_mux(self):
+        lib = self.lib
+        bits = self.encrypt([0, 1])
+        for a, b in [(0, 0), (0, 1), (1, 0), (1, 1)]:
+            c, = self.owned([lib.gsw_xor(self.params, bits[a], bits[b])])
+            self.assertEqual(self.decrypt(c), a ^ b, (a, b))
+        for s in [0, 1]:
+            c, = self.owned([lib.gsw_mux(self.params, bits[s], bits[1], bits[0])])
+            self.assertEqual(self.decrypt(c), 1 if s else 0, s)
+
+    def test_batch(self):
+        lib = self.lib
+        messages = [0, 1, 1, 0, 0, 1]
+        cts = (ctypes.c_void_p * 6)()
+        self.assertEqual(lib.gsw_encrypt_batch(self.params, self.pub, (ctypes.c_uint64 * 6)(*messages), 6, cts), 0)
+        self.owned(cts)
+        out = (ctypes.c_uint64 * 6)()
+        self.assertEqual(lib.gsw_decrypt_batch(self.params, self.priv, cts, 6, out), 0)
+        self.assertEqual(list(out), messages)
+
+        nands = (ctypes.c_void_p * 3)()
+        self.assertEqual(lib.gsw_nand_batch(self.params, cts, ctypes.byref(cts, 3 * ctypes.sizeof(ctypes.c_void_p)),
+                                            3, nands), 0)
+        self.owned(nands)
+        self.assertEqual(lib.gsw_decrypt_batch(self.params, self.priv, nands, 3, out), 0)
+        self.assertEqual(list(out)[:3], [1, 1, 0])
+
+    def test_key_of_other_params(self):
+        # the key shape is checked against the parameters it is used with
+        with open('other.pub', 'w') as fp:
+            fp.write('-----BEGIN GSW PUBLIC KEY-----\n4\n64\n2097169\n1\n1\n0\n-----END GSW PUBLIC KEY-----\n')
+        lib = self.lib
+        other = lib.gsw_params_load(b'other.pub')
+        self.addCleanup(lib.gsw_params_free, other)
+        os.remove('other.pub')
+        self.assertIsNone(lib.gsw_encrypt(other, self.pub, 1))
+        self.assertEqual(lib.gsw_last_error(), b'Key of other parameters')
+        c, = self.encrypt([1])
+        self.assertEqual(lib.gsw_decrypt(other, self.priv, c, ctypes.byref(ctypes.c_uint64())), -1)
+        self.assertEqual(lib.gsw_last_error(), b'Key of other parameters')
+        self.assertEqual(lib.gsw_key_save(other, self.pub, b'other.pub'), -1)
+        self.assertFalse(os.path.exists('other.pub'))
+
+        # the same shape for integers of 4 bits instead of bits
+        with open('key.pub') as fp:
+            lines = fp.read().split('\n')
+        end = [i for i, line in enumerate(lines) if line.startswith('-----END')][0]
+        # n, m, q and k, 1 in keys from before it was stored
+        shape = (lines[1:min(5, end - 1)] + ['1'])[:4]
+        with open('other.pub', 'w') as fp:
+            fp.write('\n'.join([lines[0]] + shape + ['4'] + lines[end - 1:]))
+        integers = lib.gsw_params_load(b'other.pub')
+        self.addCleanup(lib.gsw_params_free, integers)
+        os.remove('other.pub')
+        self.assertIsNone(lib.gsw_encrypt(integers, self.pub, 1))
+        self.assertEqual(lib.gsw_last_error(), b'Key of other parameters')
+        self.assertEqual(lib.gsw_decrypt(integers, self.priv, c, ctypes.byref(ctypes.c_uint64())), -1)
+
+    def test_circuit(self):
+        with open('circuit_and', 'w') as fp:
+            fp.write('1 3\n2 0 1\n\n2 1 0 1 2 AND\n')
+        lib = self.lib
+        circuit = lib.gsw_circuit_load(b'circuit_and')
+        self.addCleanup(lib.gsw_circuit_free, circuit)
+        os.remove('circuit_and')
+        bits = self.encrypt([1, 1, 0])
+        copied = lib.gsw_copied_bytes()
+        for inputs, expected in [((0, 1), 1), ((0, 2), 0)]:
+            ins = (ctypes.c_void_p * 2)(*[bits[i] for i in inputs])
+            outs = (ctypes.c_void_p * 1)()
+            self.assertEqual(lib.gsw_circuit_eval(self.params, circuit, ins, outs), 0)
+            self.owned(outs)
+            self.assertEqual(self.decrypt(outs[0]), expected)
+        # inputs and outputs share the ciphertexts of the gates
+        self.assertEqual(lib.gsw_copied_bytes(), copied)
+
+        # three input sets in one call, outputs in their order
+        ins = (ctypes.c_void_p * 6)(*[bits[i] for i in [0, 1, 0, 2, 2, 1]])
+        outs = (ctypes.c_void_p * 3)()
+        self.assertEqual(lib.gsw_circuit_eval_batch(self.params, circuit, ins, 3, outs), 0)
+        self.owned(outs)
+        self.assertEqual([self.decrypt(c) for c in outs], [1, 0, 0])
+
+    def test_update_counts(self):
+        # a AND b, INV c; evaluating again only recomputes what reads c
+        with open('circuit_and_inv', 'w') as fp:
+            fp.write('2 5\n2 1 2\n\n2 1 0 1 3 AND\n1 1 2 4 INV\n')
+        lib = self.lib
+        circuit = lib.gsw_circuit_load(b'circuit_and_inv')
+        self.addCleanup(lib.gsw_circuit_free, circuit)
+        os.remove('circuit_and_inv')
+        bits = self.encrypt([1, 1, 0, 1])
+        reused, recomputed = ctypes.c_uint64(), ctypes.c_uint64()
+        for c, expected, counts in [(2, [1, 1], (0, 2)), (3, [1, 0], (1, 1)), (3, [1, 0], (2, 0))]:
+            ins = (ctypes.c_void_p * 3)(bits[0], bits[1], bits[c])
+            outs = (ctypes.c_void_p * 2)()
+            self.assertEqual(lib.gsw_circuit_eval(self.params, circuit, ins, outs), 0)
+            self.owned(outs)
+            self.assertEqual([self.decrypt(o) for o in outs], expected)
+            lib.gsw_circuit_counts(circuit, ctypes.byref(reused), ctypes.byref(recomputed))
+            self.assertEqual((reused.value, recomputed.value), counts, c)
+
+class Adder1BitTest(GSWTest):
+    memory = None
+    compact = False
+    workers = None
+    inputs = ['00', '01', '10', '11']
+    results = ['0', '1', '1', '0']
+
+    @classmethod
+    def setUpClass(cls):
+        super().setUpClass()
 
         for s in cls.inputs:
             with open('in{}'.format(s), 'w') as fp:
@@ -95,12 +571,270 @@ class Adder1BitTest(GSWTest):
     def test_add(self):
         for i, s in enumerate(self.inputs):
             encrypt('key.pub', 'in{}'.format(s), 'ciphertext')
-            run_circuit('circuit', 'ciphertext', 'ciphertext')
+            if self.workers:
+                run_distributed('circuit', 'key.pub', 'ciphertext', 'ciphertext', self.workers)
+            else:
+                run_circuit('circuit', 'ciphertext', 'ciphertext', self.memory, compact=self.compact, key='key.pub')
             decrypt('key', 'ciphertext', 'output')
             output = sp.run(['cat', 'output'], stdout=sp.PIPE, universal_newlines=True).stdout[:-1]
             for j, b in enumerate(output):
                 self.assertEqual(b, self.results[i][j], s)
 
+class Adder1BitNativeTest(Adder1BitTest):
+    # Same adder, evaluated with native XOR, AND and INV gates
+    @classmethod
+    def genCircuit(cls, out=1):
+        with open('adder_32bit.txt', 'r') as adderf, open('circuit', 'w') as circuitf:
+            sp.run(['../build/circuit-converter', '-s', '1', str(out+1)], stdin=adderf, stdout=circuitf, universal_newlines=True)
+
+class Adder1BitCompiledTest(Adder1BitTest):
+    # Same adder, loaded from the compiled binary form
+    @classmethod
+    def genCircuit(cls, out=1):
+        with open('adder_32bit.txt', 'r') as adderf, open('circuit', 'w') as circuitf:
+            sp.run(['../build/circuit-converter', '-s', '1', str(out+1), '-b'], stdin=adderf, stdout=circuitf)
+
+class Adder1BitSpecialisedTest(Adder1BitTest):
+    # Same adder with its first input fixed to 1, left is an INV of the other
+    inputs = ['0', '1']
+    results = ['1', '0']
+
+    @classmethod
+    def genCircuit(cls, out=1):
+        with open('adder_32bit.txt', 'r') as adderf:
+            res = sp.run(['../build/circuit-converter', '-s', '1', str(out+1)], stdin=adderf, stdout=sp.PIPE, universal_newlines=True)
+        with open('circuit', 'w') as circuitf:
+            sp.run(['../build/circuit-converter', '-f', '1'], input=res.stdout, stdout=circuitf, universal_newlines=True)
+
+class Adder1BitSpillTest(Adder1BitTest):
+    # Same adder with a budget of a single MB, far below its ciphertexts
+    memory = 1
+
+class Adder1BitCompactSpillTest(Adder1BitNativeTest):
+    # Compact outputs under the single MB budget, the rows are never spilled
+    memory = 1
+    compact = True
+
+class Adder1BitCompactTest(Adder1BitNativeTest):
+    # Compact outputs, the decryption row of each written as row:bits
+    compact = True
+
+    def test_rows(self):
+        encrypt('key.pub', 'in11', 'ciphertext')
+        run_circuit('circuit', 'ciphertext', 'ciphertext', compact=True, key='key.pub')
+        with open('ciphertext') as fp:
+            lines = fp.read().split()
+        self.assertEqual(len(lines), 1)
+        self.assertTrue(re.match(r'[0-9]+:[01]+$', lines[0]), lines[0][:20])
+        decrypt('key', 'ciphertext', 'output')
+        self.assertEqual(sp.run(['cat', 'output'], stdout=sp.PIPE, universal_newlines=True).stdout.split(), ['0'])
+
+class Adder1BitCompactRingTest(Adder1BitCompactTest):
+    # Same compact outputs under Ring-GSW keys
+    scheme = ['-r']
+
+class ProfileTest(GSWTest):
+    # (a AND b) AND c beside INV d, the two ANDs are the critical path
+    def test_trace(self):
+        with open('circuit_profile', 'w') as fp:
+            fp.write('3 7\n4 0 2\n\n2 1 0 1 4 AND\n1 1 3 5 INV\n2 1 4 2 6 AND\n')
+        with open('in_profile', 'w') as fp:
+            fp.write('1\n1\n1\n0')
+        encrypt('key.pub', 'in_profile', 'ciphertext')
+        res = sp.run(['../build/gsw-fhe', '-c', 'circuit_profile', '-p', 'key.pub', '-R', 'trace.json',
+                      '-i', 'ciphertext', '-o', 'ciphertext'], stderr=sp.PIPE, universal_newlines=True)
+        with open('trace.json') as fp:
+            trace = json.load(fp)
+        sp.run(['rm', 'circuit_profile', 'in_profile', 'trace.json'])
+
+        gates = [e for e in trace['traceEvents'] if e['ph'] == 'X']
+        self.assertEqual(sorted(e['name'] for e in gates), ['AND', 'AND', 'INV'])
+        self.assertEqual([e['name'] for e in gates if e['cat'] == 'critical'], ['AND', 'AND'])
+        self.assertIn('3 gates in', res.stderr)
+        self.assertIn('through 2 gates, 2 of them products', res.stderr)
+        self.assertIn('gates ran one at a time', res.stderr)
+        decrypt('key', 'ciphertext', 'output')
+        self.assertEqual(sp.run(['cat', 'output'], stdout=sp.PIPE, universal_newlines=True).stdout.split(), ['1', '1'])
+
+class TunerRingTest(unittest.TestCase):
+    # Tuned Ring-GSW keys for XOR chains of growing width, whose quotient
+    # has to stay an NTT prime for the n it ends up with
+    def test_ntt_prime(self):
+        for width in [2, 32, 128]:
+            with open('xor_chain', 'w') as fp:
+                fp.write('{} {}\n{} 0 1\n\n'.format(width - 1, 2 * width - 1, width))
+                for i in range(1, width):
+                    fp.write('2 1 {} {} {} XOR\n'.format(width + i - 2 if i > 1 else 0, i, width + i - 1))
+            sp.run(['../build/gsw-fhe', '-k', '-r', '-c', 'xor_chain', '-T', '-p', 'tuned.pub', '-s', 'tuned'],
+                   stderr=sp.DEVNULL)
+            with open('tuned.pub') as fp:
+                n, _, q = [int(v) for v in fp.read().split('\n')[1:4]]
+            self.assertEqual(q % (2 * n), 1, width)
+            with open('in_tuned', 'w') as fp:
+                fp.write('1\n0\n')
+            encrypt('tuned.pub', 'in_tuned', 'ct_tuned')
+            decrypt('tuned', 'ct_tuned', 'out_tuned')
+            self.assertEqual(diff_files('in_tuned', 'out_tuned'), 0, width)
+        sp.run(['rm', 'xor_chain', 'tuned.pub', 'tuned', 'in_tuned', 'ct_tuned', 'out_tuned'])
+
+class Adder1BitBatchTest(Adder1BitTest):
+    # Same adder, every input set in a single batched run
+    def test_add(self):
+        with open('in', 'w') as fp:
+            fp.write('\n'.join(b for s in self.inputs for b in s))
+        encrypt('key.pub', 'in', 'ciphertext')
+        run_circuit('circuit', 'ciphertext', 'ciphertext', batch=True)
+        decrypt('key', 'ciphertext', 'output')
+        output = sp.run(['cat', 'output'], stdout=sp.PIPE, universal_newlines=True).stdout.split()
+        sp.run(['rm', 'in'])
+        self.assertEqual(output, list(''.join(self.results)))
+
+class MuxTest(Adder1BitTest):
+    # A single MUX gate, c ? x : y
+    inputs = ['001', '010', '101', '110']
+    results = ['1', '0', '0', '1']
+
+    @classmethod
+    def genCircuit(cls, out=1):
+        with open('circuit', 'w') as circuitf:
+            circuitf.write('1 4\n3 0 1\n\n3 1 0 1 2 3 MUX\n')
+
+class MuxSpillTest(MuxTest):
+    # The MUX under the single MB budget, its three inputs stay resident
+    memory = 1
+
+class MuxRecognisedTest(MuxTest):
+    # The same selection as y XOR (c AND (x XOR y)), turned into a MUX
+    @classmethod
+    def genCircuit(cls, out=1):
+        with open('circuit', 'w') as circuitf:
+            sp.run(['../build/circuit-converter', '-m'], input='3 6\n3 0 1\n\n2 1 1 2 3 XOR\n2 1 0 3 4 AND\n2 1 2 4 5 XOR\n',
+                   stdout=circuitf, universal_newlines=True)
+
+class LeftDeepTest(MuxTest):
+    # 0 AND (1 AND 2), with the product put first as a chain
+    inputs = ['111', '110', '011', '101']
+    results = ['1', '0', '0', '0']
+
+    @classmethod
+    def genCircuit(cls, out=1):
+        with open('circuit', 'w') as circuitf:
+            circuitf.write(cls.left_deep('2 5\n3 0 1\n\n2 1 1 2 3 AND\n2 1 0 3 4 AND\n'))
+
+    @staticmethod
+    def left_deep(circuit):
+        return sp.run(['../build/circuit-converter', '-l'], input=circuit, stdout=sp.PIPE,
+                      universal_newlines=True).stdout
+
+    @classmethod
+    def gates(cls, circuit):
+        # gate lines of the converted circuit, as lists of fields
+        return [line.split() for line in cls.left_deep(circuit).split('\n')[3:] if line]
+
+    def test_chain(self):
+        # three inputs: the first product is read first by the second
+        self.assertEqual(self.gates('2 5\n3 0 1\n\n2 1 1 2 3 AND\n2 1 0 3 4 AND\n'),
+                         [['2', '1', '2', '0', '3', 'AND'], ['2', '1', '3', '1', '4', 'AND']])
+        # a balanced tree of four: every AND but the first reads the one
+        # before it first and a circuit input second
+        gates = self.gates('3 7\n4 0 1\n\n2 1 0 1 4 AND\n2 1 2 3 5 AND\n2 1 4 5 6 AND\n')
+        self.assertEqual(len(gates), 3)
+        products = {g[4] for g in gates}
+        first = [g for g in gates if g[2] not in products]
+        self.assertEqual(len(first), 1)
+        for g in gates:
+            self.assertLess(int(g[3]), 4, g)
+
+    def test_nand_and_mux_order(self):
+        # the product goes first into a NAND
+        self.assertIn(['2', '1', '3', '0', '4', 'NAND'],
+                      self.gates('2 5\n3 0 1\n\n2 1 1 2 3 AND\n2 1 0 3 4 NAND\n'))
+        # a MUX keeps its selector, then-input and else-input in place
+        self.assertIn(['3', '1', '0', '4', '3', '5', 'MUX'],
+                      self.gates('2 6\n4 0 1\n\n2 1 1 2 4 AND\n3 1 0 4 3 5 MUX\n'))
+        # and is the noisier operand of an AND reading it
+        self.assertIn(['2', '1', '4', '3', '5', 'AND'],
+                      self.gates('2 6\n4 0 1\n\n3 1 0 1 2 4 MUX\n2 1 3 4 5 AND\n'))
+
+class Adder1BitDistributedTest(Adder1BitTest):
+    # Same adder split over two local worker processes
+    workers = ['localhost:7301', 'localhost:7302']
+
+    @classmethod
+    def setUpClass(cls):
+        super().setUpClass()
+        cls.processes = [start_worker(int(w.split(':')[1]), 'key.pub') for w in cls.workers]
+
+    @classmethod
+    def tearDownClass(cls):
+        for p in cls.processes:
+            p.terminate()
+            p.wait()
+        super().tearDownClass()
+
+class IntegerTest(unittest.TestCase):
+    # Integers mod 16 through ADD and CMUL gates, outputs a + b, 3a + b and -3a
+    scheme = []
+    circuit = '4 6\n2 0 3\n\n1 1 0 2 CMUL 3\n2 1 0 1 3 ADD\n2 1 2 1 4 ADD\n1 1 0 5 CMUL -3\n'
+    gates = [(0, NO_WIRE, 2, CMUL, 3), (0, 1, 3, ADD, 0), (2, 1, 4, ADD, 0), (0, NO_WIRE, 5, CMUL, -3)]
+
+    @classmethod
+    def setUpClass(cls):
+        with open('int_circuit', 'w') as fp:
+            fp.write(cls.circuit)
+        cls.keygen('int_circuit', 'int.pub', 'int')
+
+    @classmethod
+    def tearDownClass(cls):
+        sp.run(['rm', '-f', 'int_circuit', 'int.pub', 'int', 'int_in', 'int_ciphertext', 'int_output'])
+
+    @classmethod
+    def keygen(cls, circuit, pub, priv):
+        return sp.run(['../build/gsw-fhe', '-k', '-c', circuit, '-P', '4', '-p', pub, '-s', priv] + cls.scheme)
+
+    def run_integers(self, circuit, values):
+        with open('int_in', 'w') as fp:
+            fp.write('\n'.join(str(v) for v in values))
+        sp.run(['../build/gsw-fhe', '-e', '-p', 'int.pub', '-i', 'int_in', '-o', 'int_ciphertext'])
+        sp.run(['../build/gsw-fhe', '-c', circuit, '-p', 'int.pub', '-i', 'int_ciphertext', '-o', 'int_ciphertext'])
+        decrypt('int', 'int_ciphertext', 'int_output')
+        with open('int_output') as fp:
+            return [int(v) for v in fp.read().split()]
+
+    def test_circuit(self):
+        for a, b in [(5, 7), (15, 15), (0, 9)]:
+            self.assertEqual(self.run_integers('int_circuit', [a, b]), [(a + b) % 16, (3*a + b) % 16, (-3*a) % 16])
+
+    def test_compiled_versions(self):
+        # version 2 gates have a 16 bit type and the constant, version 1 a
+        # 32 bit type, both lack in3 and version 1 integer gates
+        for magic, wires, counts, gates, expected in [
+                (b'GSWCIRC2', 6, [0, 0, 0, 0, 2, 2], self.gates, [12, 6, 1]),
+                (b'GSWCIRC1', 3, [0, 1, 0, 0], [(0, 1, 2, XOR, 0)], [12])]:
+            header = struct.pack('=8s7Q', magic, len(gates), wires, 2, 0, len(expected), 0, 3 * counts[XOR])
+            with open('int_compiled', 'wb') as fp:
+                fp.write(header + struct.pack('={}Q'.format(len(counts)), *counts))
+                for in1, in2, out, gate_type, constant in gates:
+                    fp.write(struct.pack('=3IHh', in1, in2, out, gate_type, constant))
+            self.assertEqual(self.run_integers('int_compiled', [5, 7]), expected, magic)
+        os.remove('int_compiled')
+
+    def test_bound(self):
+        # a large constant takes a larger quotient than the depth alone
+        with open('int_scaled', 'w') as fp:
+            fp.write('1 3\n2 0 1\n\n1 1 0 2 CMUL 30000\n')
+        self.keygen('int_scaled', 'int_scaled.pub', 'int_scaled')
+        quotients = []
+        for key in ['int.pub', 'int_scaled.pub']:
+            with open(key) as fp:
+                quotients.append(int(fp.read().split('\n')[3]))
+        sp.run(['rm', 'int_scaled', 'int_scaled.pub'])
+        self.assertGreater(quotients[1], quotients[0] * 2**12)
+
+class IntegerRingTest(IntegerTest):
+    # Same circuit under Ring-GSW keys
+    scheme = ['-r']
+
 
 if __name__ == '__main__':
     unittest.main()